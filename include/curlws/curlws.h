@@ -11,6 +11,7 @@
 
 #include <curl/curl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -25,6 +26,13 @@ extern "C" {
 #define CWS_FIRST 0x01000000
 #define CWS_LAST  0x02000000
 
+/* The priority classes a data message may be sent with.  Control messages
+ * (PING, PONG, CLOSE) are always sent ahead of data messages, but never in the
+ * middle of a frame. */
+#define CWS_PRIO_NORMAL 0x00000000
+#define CWS_PRIO_HIGH   0x00001000
+#define CWS_PRIO_BULK   0x00002000
+
 /* All possible error codes from all the curlws functions. Future versions
  * may return other values.
  *
@@ -44,6 +52,9 @@ typedef enum {
     CWSE_INVALID_OPTIONS,           /*  9 */
     CWSE_INVALID_UTF8,              /* 10 */
     CWSE_BAD_FUNCTION_ARGUMENT,     /* 11 */
+    CWSE_SEND_QUEUE_FULL,           /* 12 */
+    CWSE_MSG_DROPPED,               /* 13 */
+    CWSE_MSG_NOT_QUEUED,            /* 14 */
 
     CWSE_LAST /* never use! */
 } CWScode;
@@ -56,6 +67,16 @@ typedef enum {
 typedef struct cws_object CWS;
 
 
+/**
+ * One complete message passed to (*on_messages).
+ */
+struct cws_message {
+    int type;         /* CWS_TEXT or CWS_BINARY */
+    const void *data; /* The message (may be NULL if len is 0) */
+    size_t len;       /* The number of bytes in the message */
+};
+
+
 /**
  * The curlws configuration struct.  If initially filled with zeros and the
  * URL is added, this should give a reasonable set of defaults.
@@ -116,10 +137,93 @@ struct cws_config {
      */
     int expect;
 
-    /* The largest amount of payload data sent as one websocket frame.
-     * If set to 0 the library default of 1024 will be used.
+    /* Messages that fit in curl's upload buffer (see upload_buffer_size) are
+     * sent as a single frame, larger messages are fragmented into frames
+     * that fill the upload buffer.  These bound the payload size of each
+     * frame picked this way; max_payload_size wins if they conflict.
+     *
+     * If max_payload_size is set to 0 there is no upper bound.
+     * If min_payload_size is set to 0 there is no lower bound.
      */
     size_t max_payload_size;
+    size_t min_payload_size;
+
+    /* The size of the buffer curl uses for sending (CURLOPT_UPLOAD_BUFFERSIZE)
+     * in bytes.  If set to 0 the library default of 65536 will be used.
+     * curl limits this to between 16384 and 2097152 bytes.
+     */
+    long upload_buffer_size;
+
+    /* Limits how much data may wait to be sent.  Once the bytes queued
+     * (frame headers included) reach send_high_watermark, sending data
+     * fails with CWSE_SEND_QUEUE_FULL until the queue has been drained to
+     * send_low_watermark bytes or fewer, which is reported by (*on_drain).
+     * Control frames (PING, PONG and CLOSE) are always queued.
+     *
+     * If send_high_watermark is set to 0 there is no limit.
+     * send_low_watermark must be lower than send_high_watermark.
+     */
+    size_t send_high_watermark;
+    size_t send_low_watermark;
+
+    /* If not 0, the mask keys (and the handshake key) are generated from
+     * this seed so the bytes on the wire are the same from run to run.  This
+     * is meant for benchmarks and tests; masks are predictable this way.
+     *
+     * If set to 0 each handle is seeded from getrandom().
+     */
+    uint64_t random_seed;
+
+    /* The most PINGs per second accepted from the server.  A server that
+     * sends more is closed with 1008 (policy violation) so a flood of PINGs
+     * can't keep the handle busy replying.
+     *
+     * If set to 0 there is no limit.
+     */
+    uint32_t max_ping_rate;
+
+    /* Bounds how long a control frame (PING, PONG or CLOSE) can wait behind
+     * a data frame that is being sent, in payload bytes.  Data frames
+     * larger than this are cut into continuation frames as they are sent,
+     * unless they fit in what is left of curl's buffer.  The frames are
+     * still queued whole, so this only changes the framing on the wire.
+     *
+     * If set to 0 data frames are never cut.
+     */
+    size_t max_control_delay;
+
+    /* The largest message accepted from the server, in bytes.  The frame
+     * headers tell how big a message is before any of it is buffered, so a
+     * larger message is closed with 1009 (message too big) right away.
+     *
+     * If set to 0 there is no limit.
+     */
+    size_t max_message_size;
+
+    /* When (*on_fragment) is not set, fragmented messages are reassembled
+     * in a buffer that doubles in size as needed.  A buffer of up to this
+     * many bytes is kept for the next message instead of being freed.
+     *
+     * If set to 0 the library default of 65536 will be used.
+     */
+    size_t recv_buffer_keep;
+
+    /* When (*on_fragment) is not set, a message being reassembled that grows
+     * larger than this many bytes is moved to a temporary file, so the
+     * memory used stays bounded however large the message is.  The file is
+     * mapped read-only and passed to (*on_spilled), or to (*on_text) and
+     * (*on_binary) if that is not set.
+     *
+     * If set to 0 messages are always reassembled in memory.
+     */
+    size_t spill_threshold;
+
+    /* The directory the temporary files are created in.  The files are
+     * created without a name (O_TMPFILE) when the file system allows it.
+     *
+     * If set to NULL "/tmp" will be used.
+     */
+    const char *spill_dir;
 
     /**
      * This callback provides the way to configure all the parameters CURL has
@@ -149,6 +253,7 @@ struct cws_config {
      *      CURLOPT_STDERR
      *      CURLOPT_TIMEOUT
      *      CURLOPT_UPLOAD
+     *      CURLOPT_UPLOAD_BUFFERSIZE
      *      CURLOPT_URL
      *      CURLOPT_VERBOSE
      *      CURLOPT_WRITEDATA
@@ -238,6 +343,10 @@ struct cws_config {
      * @note If this callback is set to a non-NULL value, then the callbacks
      *       (*on_text) and (*on_binary) are disabled.
      *
+     * @note Text is validated as it arrives and passed on right away, so a
+     *       multi-byte UTF-8 character may be split between fragments.  The
+     *       connection is closed (1007) as soon as the text can't be valid.
+     *
      * @note Valid combinations of the info bitmask:
      *       CWS_BINARY | CWS_FIRST | CWS_LAST - a single binary fragment
      *
@@ -323,6 +432,196 @@ struct cws_config {
      *         reason is used, otherwise a default close reason is used.
      */
     int (*on_close)(void *user, CWS *handle, int code, const char *reason, size_t len);
+
+    /**
+     * Reports that the library no longer references a buffer passed to
+     * cws_send_ref() or a file descriptor passed to cws_send_fd(), so the
+     * buffer can be reused or freed, or the descriptor closed.
+     *
+     * @note This is called once the last byte of the message has been handed
+     *       to curl (for cws_send_fd(), once it has been read), or when the
+     *       message is discarded because the connection is closing or the
+     *       handle is being destroyed.
+     *
+     * @param user   the user data specified in this configuration
+     * @param handle handle for this websocket
+     * @param tag    the tag passed to cws_send_ref() or cws_send_fd()
+     * @param status CWSE_OK if the message was sent, CWSE_CLOSED_CONNECTION
+     *               if it was discarded, CWSE_MSG_DROPPED if it was cancelled,
+     *               expired or replaced by a newer message
+     */
+    void (*on_sent)(void *user, CWS *handle, void *tag, CWScode status);
+
+    /**
+     * Reports that the send queue has drained to send_low_watermark bytes or
+     * fewer after reaching send_high_watermark, so sending can resume.
+     *
+     * @param user   the user data specified in this configuration
+     * @param handle handle for this websocket
+     */
+    void (*on_drain)(void *user, CWS *handle);
+
+    /**
+     * Provides the buffer the next received message is reassembled in, so
+     * it doesn't need to be copied out of the library.  The buffer then
+     * belongs to the application again when it is passed to (*on_text) or
+     * (*on_binary).
+     *
+     * @note If (*on_fragment) is set, this callback behavior is disabled.
+     *
+     * @note If the message is larger than the buffer the connection is
+     *       closed with 1009 (message too big).  If the connection closes
+     *       before the message is complete, the buffer is not passed back
+     *       and the application must release it.
+     *
+     * @param user         the user data specified in this configuration
+     * @param handle       handle for this websocket
+     * @param expected_len the length of the message if it is known (it is
+     *                     a single frame), otherwise 0
+     * @param size         the size of the buffer returned (out)
+     *
+     * @return the buffer, or NULL to reassemble this message in the library's
+     *         own buffer and only lend it to (*on_text) or (*on_binary)
+     */
+    void *(*get_buffer)(void *user, CWS *handle, size_t expected_len, size_t *size);
+
+    /**
+     * Provides a message that was reassembled in a temporary file because
+     * it grew larger than spill_threshold.
+     *
+     * @note The file and the mapping are only valid during the callback.  To
+     *       keep the file, dup() the file descriptor.
+     *
+     * @note If (*on_fragment) is set, this callback behavior is disabled.
+     *
+     * @param user   the user data specified in this configuration
+     * @param handle handle for this websocket
+     * @param type   CWS_TEXT or CWS_BINARY
+     * @param fd     the file holding the message
+     * @param data   the file mapped read-only
+     * @param len    the length of the message
+     *
+     * @return 0 if you would like to proceed, any other value terminates
+     *         the connection.  If a valid close reason is returned that close
+     *         reason is used, otherwise a default close reason is used.
+     */
+    int (*on_spilled)(void *user, CWS *handle, int type, int fd, const void *data, size_t len);
+
+    /**
+     * Provides the complete messages received in one buffer from curl with a
+     * single call, instead of calling (*on_text) or (*on_binary) for each.
+     * Messages that are whole in curl's buffer point into it, so a burst of
+     * small messages is delivered without copying.
+     *
+     * @note The messages are only valid during the callback.  Messages in
+     *       a buffer from (*get_buffer) belong to the application again.
+     *
+     * @note Control messages are still reported as they arrive; the
+     *       messages received before one are delivered first.
+     *
+     * @note If (*on_fragment) is set, this callback behavior is disabled.
+     *
+     * @param user   the user data specified in this configuration
+     * @param handle handle for this websocket
+     * @param msgs   the messages in the order they were received
+     * @param count  the number of messages
+     *
+     * @return 0 if you would like to proceed, any other value terminates
+     *         the connection.  If a valid close reason is returned that close
+     *         reason is used, otherwise a default close reason is used.
+     */
+    int (*on_messages)(void *user, CWS *handle, const struct cws_message *msgs, size_t count);
+};
+
+
+/**
+ * The optional per message settings used by cws_send_msg().  If filled with
+ * zeros the message is sent the same way cws_send_blk_binary() or
+ * cws_send_blk_text() sends it.
+ */
+struct cws_send_opts {
+    /* The priority class of the message: CWS_PRIO_NORMAL, CWS_PRIO_HIGH or
+     * CWS_PRIO_BULK.  Messages in a higher class are started before those in
+     * a lower class, but a message that has started sending is always
+     * completed before another data message is started. */
+    int priority;
+
+    /* If not 0, the message is dropped instead of sent if it has not started
+     * sending within this many microseconds of being queued. */
+    uint32_t ttl_usec;
+
+    /* If not NULL, set to the handle of the queued message, which can be
+     * passed to cws_cancel_msg(). */
+    uint64_t *msg_id;
+
+    /* If not 0, the conflation key of the message.  A queued message of the
+     * same priority with the same key that has not started sending is
+     * replaced by this one, which takes its place in the queue.  This keeps
+     * only the latest value per key queued. */
+    uint64_t conflate_key;
+
+    /* If not 0, the message is sent as a single frame however large it is,
+     * with the payload read from the caller's buffer as curl has room for
+     * it.  Only cws_send_ref() and cws_send_prepared() support this since
+     * their payloads are not copied; other sends fail with
+     * CWSE_INVALID_OPTIONS.
+     *
+     * Control frames (like PONG replies) can't be sent until the frame is
+     * done, so if cws_config.max_control_delay is set the frame is cut as
+     * it is for any other message. */
+    int unfragmented;
+};
+
+
+/**
+ * One segment of a message sent with cws_send_iov().
+ */
+struct cws_iov {
+    const void *base; /* The segment data (may only be NULL if len is 0) */
+    size_t len;       /* The number of bytes in the segment */
+};
+
+
+/* The value (*read) returns to give up on a cws_send_producer() message. */
+#define CWS_PRODUCER_ABORT SIZE_MAX
+
+
+/**
+ * The source of the payload of a message sent with cws_send_producer().
+ */
+struct cws_producer {
+    /**
+     * Provides the next part of the message.  This is only called when curl
+     * wants more data to send, and each call provides the payload of one
+     * frame.
+     *
+     * @param user   the user value in this structure
+     * @param handle handle for this websocket
+     * @param buf    the buffer to fill
+     * @param len    the most bytes that may be written into buf
+     * @param eom    set to non-zero if the message ends with these bytes
+     *
+     * @return the number of bytes written into buf.  Returning 0 without
+     *         setting eom means no data is ready; sending pauses until
+     *         cws_producer_ready() is called.  Returning CWS_PRODUCER_ABORT
+     *         drops the message, and if part of it was sent already the
+     *         connection is closed with 1011.
+     */
+    size_t (*read)(void *user, CWS *handle, void *buf, size_t len, int *eom);
+
+    /**
+     * Optional.  Reports that (*read) will not be called again.
+     *
+     * @param user   the user value in this structure
+     * @param handle handle for this websocket
+     * @param status CWSE_OK if the whole message was read, CWSE_MSG_DROPPED
+     *               if it was aborted, cancelled, expired or replaced and
+     *               CWSE_CLOSED_CONNECTION if it was discarded
+     */
+    void (*done)(void *user, CWS *handle, CWScode status);
+
+    /* The value passed to (*read) and (*done). */
+    void *user;
 };
 
 
@@ -494,6 +793,7 @@ CWScode cws_close(CWS *handle, int code, const char *reason, size_t len);
  * @retval CWSE_OK
  * @retval CWSE_OUT_OF_MEMORY
  * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
  * @retval CWSE_BAD_FUNCTION_ARGUMENT
  */
 CWScode cws_send_blk_binary(CWS *handle, const void *data, size_t len);
@@ -514,12 +814,183 @@ CWScode cws_send_blk_binary(CWS *handle, const void *data, size_t len);
  * @retval CWSE_OK
  * @retval CWSE_OUT_OF_MEMORY
  * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
  * @retval CWSE_INVALID_UTF8
  * @retval CWSE_BAD_FUNCTION_ARGUMENT
  */
 CWScode cws_send_blk_text(CWS *handle, const char *s, size_t len);
 
 
+/**
+ * Send a binary (opcode 0x2) or text (opcode 0x1) message of a given size
+ * with the specified options.
+ *
+ * @note If the type is CWS_TEXT and len is SIZE_MAX then strlen() is used to
+ *       determine the string length and a terminating '\0' is required.
+ *
+ * @param handle the websocket handle to interact with
+ * @param type   either CWS_BINARY or CWS_TEXT
+ * @param data   the buffer to send
+ * @param len    the number of bytes in the buffer
+ * @param opts   the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_INVALID_UTF8
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_msg(CWS *handle, int type, const void *data, size_t len,
+                     const struct cws_send_opts *opts);
+
+
+/**
+ * Send a binary (opcode 0x2) or text (opcode 0x1) message without copying
+ * it.  The caller keeps ownership of the buffer, which must stay valid and
+ * unchanged until (*on_sent) is called with the same tag.  The payload is
+ * masked as it is handed to curl.
+ *
+ * @note If anything other than CWSE_OK is returned, nothing of the message
+ *       was queued and (*on_sent) is not called.
+ *
+ * @note If the type is CWS_TEXT and len is SIZE_MAX then strlen() is used to
+ *       determine the string length and a terminating '\0' is required.
+ *
+ * @param handle the websocket handle to interact with
+ * @param type   either CWS_BINARY or CWS_TEXT
+ * @param data   the buffer to send
+ * @param len    the number of bytes in the buffer
+ * @param tag    the user value passed to (*on_sent)
+ * @param opts   the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_STREAM_CONTINUITY_ISSUE
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_INVALID_UTF8
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_ref(CWS *handle, int type, const void *data, size_t len,
+                     void *tag, const struct cws_send_opts *opts);
+
+
+/**
+ * Send a binary (opcode 0x2) or text (opcode 0x1) message made up of the
+ * segments in order, without joining them first.  Frames are not aligned to
+ * the segments, so a frame may hold the end of one segment and the start of
+ * the next.
+ *
+ * @note For CWS_TEXT the whole message must be valid UTF-8, but characters
+ *       may be split between segments.
+ *
+ * @param handle the websocket handle to interact with
+ * @param type   either CWS_BINARY or CWS_TEXT
+ * @param iov    the segments of the message
+ * @param count  the number of segments
+ * @param opts   the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_INVALID_UTF8
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_iov(CWS *handle, int type, const struct cws_iov *iov,
+                     size_t count, const struct cws_send_opts *opts);
+
+
+/**
+ * Removes a queued message that has not started sending.  Once the first
+ * byte of a message is handed to curl the whole message is sent.
+ *
+ * @note If the message was sent with cws_send_ref(), (*on_sent) is called
+ *       with CWSE_MSG_DROPPED before this returns.
+ *
+ * @param handle the websocket handle to interact with
+ * @param msg_id the message handle from struct cws_send_opts
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_MSG_NOT_QUEUED if the message has started sending, was sent,
+ *                             was dropped or is unknown
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_cancel_msg(CWS *handle, uint64_t msg_id);
+
+
+/**
+ * Send a binary (opcode 0x2) or text (opcode 0x1) message whose payload is
+ * pulled from the producer as curl has room for it, so the message never
+ * needs to be in memory all at once.
+ *
+ * @note For CWS_TEXT the producer must provide valid UTF-8; the payload is
+ *       not validated.
+ *
+ * @note The producer is copied, so it does not need to outlive this call,
+ *       but producer->user must stay valid until (*done) is called.
+ *
+ * @param handle   the websocket handle to interact with
+ * @param type     either CWS_BINARY or CWS_TEXT
+ * @param producer the source of the payload
+ * @param opts     the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_STREAM_CONTINUITY_ISSUE
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_producer(CWS *handle, int type, const struct cws_producer *producer,
+                          const struct cws_send_opts *opts);
+
+
+/**
+ * Resumes sending after a producer had no data ready.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_producer_ready(CWS *handle);
+
+
+/**
+ * Send a binary (opcode 0x2) or text (opcode 0x1) message read from a file
+ * descriptor with pread(), so the file position is not changed.  The file
+ * is read as curl has room for more data.
+ *
+ * @note The descriptor must stay open until (*on_sent) is called with the
+ *       tag.  If the file ends early the message is aborted as described in
+ *       struct cws_producer.
+ *
+ * @param handle the websocket handle to interact with
+ * @param type   either CWS_BINARY or CWS_TEXT
+ * @param fd     the file descriptor to read from
+ * @param offset the offset in the file to start reading at
+ * @param len    the number of bytes to send
+ * @param tag    the value passed to (*on_sent)
+ * @param opts   the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_STREAM_CONTINUITY_ISSUE
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_fd(CWS *handle, int type, int fd, uint64_t offset, uint64_t len,
+                    void *tag, const struct cws_send_opts *opts);
+
+
 /*----------------------------------------------------------------------------*/
 /*                              Stream Based APIs                             */
 /*----------------------------------------------------------------------------*/
@@ -539,6 +1010,7 @@ CWScode cws_send_blk_text(CWS *handle, const char *s, size_t len);
  * @retval CWSE_OK
  * @retval CWSE_OUT_OF_MEMORY
  * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
  * @retval CWSE_STREAM_CONTINUITY_ISSUE
  * @retval CWSE_INVALID_OPTIONS
  * @retval CWSE_BAD_FUNCTION_ARGUMENT
@@ -568,6 +1040,7 @@ CWScode cws_send_strm_binary(CWS *handle, int info, const void *data, size_t len
  * @retval CWSE_OK
  * @retval CWSE_OUT_OF_MEMORY
  * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
  * @retval CWSE_STREAM_CONTINUITY_ISSUE
  * @retval CWSE_INVALID_OPTIONS
  * @retval CWSE_INVALID_UTF8
@@ -575,6 +1048,277 @@ CWScode cws_send_strm_binary(CWS *handle, int info, const void *data, size_t len
  */
 CWScode cws_send_strm_text(CWS *handle, int info, const char *s, size_t len);
 
+
+/*----------------------------------------------------------------------------*/
+/*                               Send Batch APIs                              */
+/*----------------------------------------------------------------------------*/
+
+
+/**
+ * Starts a batch of sends.  Messages sent during a batch are queued, but
+ * curl is only woken up to send them once, when the batch is committed.
+ * This saves curl from starting a send attempt for each message when many
+ * small messages are sent at once.
+ *
+ * @note Batches may be nested; curl is woken up when the outermost batch is
+ *       committed.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_batch_begin(CWS *handle);
+
+
+/**
+ * Ends a batch of sends started with cws_batch_begin() and wakes up curl if
+ * anything was queued while it was waiting for data.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT if no batch was started
+ */
+CWScode cws_batch_commit(CWS *handle);
+
+
+/**
+ * Corks the handle.  While corked, sent messages (and automatic replies like
+ * PONG frames) are queued but not handed to curl, so they go out in a few
+ * large writes instead of many small ones when the handle is uncorked.
+ *
+ * If max_usec is not 0 the queued frames are released once the first of
+ * them has waited max_usec microseconds, and the handle stays corked for the
+ * frames sent after that.  curlws has no timer of its own, so the time limit
+ * is only checked when a message is sent or data is received.
+ *
+ * @note Closing the connection removes the cork.
+ *
+ * @param handle   the websocket handle to interact with
+ * @param max_usec the longest a frame is held back, or 0 for no limit
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_cork(CWS *handle, uint32_t max_usec);
+
+
+/**
+ * Removes the cork set by cws_cork() and sends everything queued.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_uncork(CWS *handle);
+
+
+/**
+ * Stops delivering received data to the callbacks until cws_resume_recv() is
+ * called.  curl stops reading from the socket, so once the socket buffers
+ * fill up TCP flow control holds the server back.  Use this when the
+ * application can't keep up with what it receives.
+ *
+ * If called from a callback, the data already handed over by curl but not
+ * delivered yet is kept by curlws until receiving resumes.
+ *
+ * @note While paused, PINGs and a CLOSE from the server aren't seen either.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_pause_recv(CWS *handle);
+
+
+/**
+ * Resumes receiving after cws_pause_recv().  Any data kept while paused is
+ * delivered before this returns, so the callbacks may be called from
+ * within it.
+ *
+ * @param handle the websocket handle to interact with
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_resume_recv(CWS *handle);
+
+
+/**
+ * The send statistics reported by cws_get_send_stats().
+ */
+struct cws_send_stats {
+    /* The number of times curl was woken up to send queued data. */
+    uint64_t unpauses;
+
+    /* The number of wake ups avoided by batching.  This is the number of
+     * frames queued during a batch while curl was waiting for data, less the
+     * single wake up done when the batch was committed. */
+    uint64_t unpauses_saved;
+
+    /* The number of bytes (frame headers included) and frames queued that
+     * have not been handed to curl yet. */
+    size_t queued_bytes;
+    size_t queued_frames;
+
+    /* The number of messages dropped by cws_cancel_msg() or because they
+     * waited longer than their ttl_usec. */
+    uint64_t msgs_cancelled;
+    uint64_t msgs_expired;
+
+    /* The number of messages replaced by a newer one with the same
+     * conflate_key. */
+    uint64_t msgs_conflated;
+
+    /* The number of PONGs that replaced a queued PONG which had not been
+     * sent yet. */
+    uint64_t pongs_coalesced;
+
+    /* The number of data frames cut because of max_control_delay. */
+    uint64_t frames_cut;
+};
+
+
+/**
+ * Gets the send statistics for the handle.
+ *
+ * @param handle the websocket handle to interact with
+ * @param stats  the structure to fill in
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_get_send_stats(CWS *handle, struct cws_send_stats *stats);
+
+
+/*----------------------------------------------------------------------------*/
+/*                               Broadcast APIs                               */
+/*----------------------------------------------------------------------------*/
+
+/* A message that is validated and copied once, then sent on any number of
+ * handles without copying it again. */
+struct cws_prepared;
+
+/* A set of handles that can be sent a prepared message with one call. */
+struct cws_group;
+
+
+/**
+ * Creates a prepared message.  The payload is copied and (for CWS_TEXT)
+ * validated once, and each handle it is sent on references the same copy,
+ * masking it as it is handed to curl.
+ *
+ * @note Prepared messages and groups are not thread safe; all the handles a
+ *       message or group is used with must be used from the same thread.
+ *
+ * @param msg  set to the new message
+ * @param type either CWS_BINARY or CWS_TEXT
+ * @param data the payload of the message
+ * @param len  the number of bytes in the payload.  For CWS_TEXT, SIZE_MAX
+ *             means data is '\0' terminated
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_INVALID_UTF8
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_prepare(struct cws_prepared **msg, int type, const void *data, size_t len);
+
+
+/**
+ * Releases the caller's reference to a prepared message.  The message is
+ * freed once it is no longer queued on any handle.
+ *
+ * @param msg the message to release (may be NULL)
+ */
+void cws_prepared_release(struct cws_prepared *msg);
+
+
+/**
+ * Sends a prepared message on a handle.
+ *
+ * @param handle the websocket handle to interact with
+ * @param msg    the message to send
+ * @param opts   the optional message settings (may be NULL)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
+ * @retval CWSE_STREAM_CONTINUITY_ISSUE
+ * @retval CWSE_INVALID_OPTIONS
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_send_prepared(CWS *handle, struct cws_prepared *msg,
+                          const struct cws_send_opts *opts);
+
+
+/**
+ * Creates an empty group of handles.
+ *
+ * @return the group or NULL if out of memory
+ */
+struct cws_group *cws_group_create(void);
+
+
+/**
+ * Destroys a group.  The handles in it are not affected.
+ *
+ * @param group the group to destroy (may be NULL)
+ */
+void cws_group_destroy(struct cws_group *group);
+
+
+/**
+ * Adds a handle to a group.  A handle may be in any number of groups, and
+ * leaves them all when it is destroyed.
+ *
+ * @param group  the group to add the handle to
+ * @param handle the websocket handle to add
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ */
+CWScode cws_group_add(struct cws_group *group, CWS *handle);
+
+
+/**
+ * Removes a handle from a group.
+ *
+ * @param group  the group to remove the handle from
+ * @param handle the websocket handle to remove
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT if the handle is not in the group
+ */
+CWScode cws_group_remove(struct cws_group *group, CWS *handle);
+
+
+/**
+ * Sends a prepared message on every handle in the group.  Handles that
+ * can't take the message (because they are closing or their queue is full)
+ * are skipped.
+ *
+ * @param group  the group to send to
+ * @param msg    the message to send
+ * @param opts   the optional message settings (may be NULL), msg_id is
+ *               ignored
+ * @param queued set to the number of handles the message was queued on
+ *               (may be NULL)
+ *
+ * @retval CWSE_OK if the message was queued on every handle
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ * @retval any of the cws_send_prepared() errors from the last handle that
+ *         failed
+ */
+CWScode cws_group_broadcast(struct cws_group *group, struct cws_prepared *msg,
+                            const struct cws_send_opts *opts, size_t *queued);
+
 #ifdef __cplusplus
 }
 #endif
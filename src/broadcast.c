@@ -0,0 +1,206 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <curlws/curlws.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "broadcast.h"
+#include "internal.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define GROUP_MIN_SIZE 16
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                             Function Prototypes                            */
+/*----------------------------------------------------------------------------*/
+static bool _unlink(CWS *, struct cws_group *);
+static void _drop_member(struct cws_group *, CWS *);
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+
+struct cws_prepared *prepared_create(int type, const void *data, size_t len)
+{
+    struct cws_prepared *msg;
+
+    if (SIZE_MAX - sizeof(struct cws_prepared) < len) {
+        return NULL;
+    }
+
+    msg = (struct cws_prepared *) malloc(sizeof(struct cws_prepared) + len);
+    if (!msg) {
+        return NULL;
+    }
+
+    msg->refs = 1;
+    msg->type = type;
+    msg->len  = len;
+    if (len) {
+        memcpy(msg->data, data, len);
+    }
+
+    return msg;
+}
+
+
+void prepared_ref(struct cws_prepared *msg)
+{
+    msg->refs++;
+}
+
+
+void prepared_unref(struct cws_prepared *msg)
+{
+    msg->refs--;
+    if (0 == msg->refs) {
+        free(msg);
+    }
+}
+
+
+struct cws_group *group_create(void)
+{
+    return (struct cws_group *) calloc(1, sizeof(struct cws_group));
+}
+
+
+void group_destroy(struct cws_group *group)
+{
+    for (size_t i = 0; i < group->count; i++) {
+        _unlink(group->members[i], group);
+    }
+
+    if (group->members) {
+        free(group->members);
+    }
+    free(group);
+}
+
+
+CWScode group_add(struct cws_group *group, CWS *priv)
+{
+    struct group_link *link;
+
+    for (link = priv->groups; link; link = link->next) {
+        if (group == link->group) {
+            return CWSE_OK;
+        }
+    }
+
+    if (group->count == group->size) {
+        size_t size  = (group->size) ? group->size * 2 : GROUP_MIN_SIZE;
+        CWS **larger = (CWS **) realloc(group->members, size * sizeof(CWS *));
+
+        if (!larger) {
+            return CWSE_OUT_OF_MEMORY;
+        }
+        group->members = larger;
+        group->size    = size;
+    }
+
+    link = (struct group_link *) malloc(sizeof(struct group_link));
+    if (!link) {
+        return CWSE_OUT_OF_MEMORY;
+    }
+
+    link->group  = group;
+    link->next   = priv->groups;
+    priv->groups = link;
+
+    group->members[group->count++] = priv;
+
+    return CWSE_OK;
+}
+
+
+CWScode group_remove(struct cws_group *group, CWS *priv)
+{
+    if (!_unlink(priv, group)) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    _drop_member(group, priv);
+
+    return CWSE_OK;
+}
+
+
+void group_leave_all(CWS *priv)
+{
+    while (priv->groups) {
+        struct group_link *link = priv->groups;
+
+        priv->groups = link->next;
+        _drop_member(link->group, priv);
+        free(link);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+
+
+/**
+ * Removes a group from the list of groups a handle is in.
+ *
+ * @param priv  the handle to update
+ * @param group the group to forget
+ *
+ * @return true if the handle was in the group, false otherwise
+ */
+static bool _unlink(CWS *priv, struct cws_group *group)
+{
+    struct group_link **p = &priv->groups;
+
+    while (*p) {
+        struct group_link *link = *p;
+
+        if (group == link->group) {
+            *p = link->next;
+            free(link);
+            return true;
+        }
+        p = &link->next;
+    }
+
+    return false;
+}
+
+
+/**
+ * Removes a handle from the members of a group.  The order of the members
+ * doesn't matter, so the last member takes its place.
+ *
+ * @param group the group to update
+ * @param priv  the handle to remove
+ */
+static void _drop_member(struct cws_group *group, CWS *priv)
+{
+    for (size_t i = 0; i < group->count; i++) {
+        if (priv == group->members[i]) {
+            group->count--;
+            group->members[i] = group->members[group->count];
+            return;
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef __BROADCAST_H__
+#define __BROADCAST_H__
+
+#include <curlws/curlws.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal.h"
+
+/* A message shared read-only by all the handles it is queued on. */
+struct cws_prepared {
+    /* The creator holds one reference and each queued copy holds another. */
+    size_t refs;
+
+    /* CWS_TEXT or CWS_BINARY */
+    int type;
+
+    size_t len;
+    uint8_t data[];
+};
+
+/* A set of handles that can be sent the same message with one call. */
+struct cws_group {
+    CWS **members;
+    size_t count;
+    size_t size;
+};
+
+/* The groups a handle is in, so it can leave them when destroyed. */
+struct group_link {
+    struct cws_group *group;
+    struct group_link *next;
+};
+
+
+/**
+ * Creates a prepared message holding a copy of the payload.
+ *
+ * @note Text must be validated before calling this.
+ *
+ * @param type CWS_TEXT or CWS_BINARY
+ * @param data the payload (may be NULL if len is 0)
+ * @param len  the number of bytes in the payload
+ *
+ * @return the message with one reference, or NULL if out of memory
+ */
+struct cws_prepared *prepared_create(int type, const void *data, size_t len);
+
+
+/**
+ * Adds a reference to a prepared message.
+ *
+ * @param msg the message to reference
+ */
+void prepared_ref(struct cws_prepared *msg);
+
+
+/**
+ * Drops a reference to a prepared message, freeing it with the last one.
+ *
+ * @param msg the message to release
+ */
+void prepared_unref(struct cws_prepared *msg);
+
+
+/**
+ * Creates an empty group.
+ *
+ * @return the group or NULL if out of memory
+ */
+struct cws_group *group_create(void);
+
+
+/**
+ * Removes all the handles from a group and frees it.
+ *
+ * @param group the group to destroy
+ */
+void group_destroy(struct cws_group *group);
+
+
+/**
+ * Adds a handle to a group.  Adding a handle that is already in the group
+ * does nothing.
+ *
+ * @param group the group to add to
+ * @param priv  the handle to add
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ */
+CWScode group_add(struct cws_group *group, CWS *priv);
+
+
+/**
+ * Removes a handle from a group.
+ *
+ * @param group the group to remove from
+ * @param priv  the handle to remove
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT if the handle isn't in the group
+ */
+CWScode group_remove(struct cws_group *group, CWS *priv);
+
+
+/**
+ * Removes a handle from all the groups it is in.
+ *
+ * @param priv the handle being destroyed
+ */
+void group_leave_all(CWS *priv);
+
+#endif
@@ -159,6 +159,100 @@ void cb_on_close(CWS *priv, int code, const char *text, size_t len)
 }
 
 
+void cb_on_sent(CWS *priv, void *tag, CWScode status)
+{
+    verbose(priv, "< websocket on_sent() status: %d\n", status);
+
+    if (priv->cb.on_sent_fn) {
+        (*priv->cb.on_sent_fn)(priv->cfg.user, priv, tag, status);
+    }
+
+    verbose(priv, "> websocket on_sent()\n");
+}
+
+
+void cb_on_drain(CWS *priv)
+{
+    verbose(priv, "< websocket on_drain()\n");
+
+    if (priv->cb.on_drain_fn) {
+        (*priv->cb.on_drain_fn)(priv->cfg.user, priv);
+    }
+
+    verbose(priv, "> websocket on_drain()\n");
+}
+
+
+void *cb_get_buffer(CWS *priv, size_t expected_len, size_t *size)
+{
+    void *buf = NULL;
+
+    verbose(priv, "< websocket get_buffer() expected_len: %zd\n", expected_len);
+
+    *size = 0;
+    if (priv->cb.get_buffer_fn) {
+        buf = (*priv->cb.get_buffer_fn)(priv->cfg.user, priv, expected_len, size);
+    }
+    if (!buf) {
+        *size = 0;
+    }
+
+    verbose(priv, "> websocket get_buffer() size: %zd\n", *size);
+
+    return buf;
+}
+
+
+void cb_on_spilled(CWS *priv, int type, int fd, const void *data, size_t len)
+{
+    verbose(priv, "< websocket on_spilled() type: 0x%08x, fd: %d, len: %zd\n", type, fd, len);
+
+    if (priv->cb.on_spilled_fn) {
+        int rv;
+
+        rv = (*priv->cb.on_spilled_fn)(priv->cfg.user, priv, type, fd, data, len);
+        __process_rv(priv, rv);
+    }
+
+    verbose(priv, "> websocket on_spilled()\n");
+}
+
+
+void cb_add_message(CWS *priv, int type, const void *data, size_t len)
+{
+    struct batch *b = &priv->recv.batch;
+
+    if (RECV_BATCH_MAX == b->count) {
+        cb_on_messages(priv);
+    }
+
+    b->msgs[b->count].type = type;
+    b->msgs[b->count].data = (0 < len) ? data : NULL;
+    b->msgs[b->count].len  = len;
+    b->count++;
+}
+
+
+void cb_on_messages(CWS *priv)
+{
+    struct batch *b = &priv->recv.batch;
+    size_t count    = b->count;
+    int rv;
+
+    if (0 == count) {
+        return;
+    }
+
+    verbose(priv, "< websocket on_messages() count: %zd\n", count);
+
+    rv       = (*priv->cb.on_messages_fn)(priv->cfg.user, priv, b->msgs, count);
+    b->count = 0;
+    __process_rv(priv, rv);
+
+    verbose(priv, "> websocket on_messages()\n");
+}
+
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
@@ -23,5 +23,11 @@ void cb_on_fragment(CWS *priv, int info, const void *buf, size_t len);
 void cb_on_ping(CWS *priv, const void *buf, size_t len);
 void cb_on_pong(CWS *priv, const void *buf, size_t len);
 void cb_on_close(CWS *priv, int code, const char *text, size_t len);
+void cb_on_sent(CWS *priv, void *tag, CWScode status);
+void cb_on_drain(CWS *priv);
+void *cb_get_buffer(CWS *priv, size_t expected_len, size_t *size);
+void cb_on_spilled(CWS *priv, int type, int fd, const void *data, size_t len);
+void cb_add_message(CWS *priv, int type, const void *data, size_t len);
+void cb_on_messages(CWS *priv);
 
 #endif
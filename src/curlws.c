@@ -4,15 +4,24 @@
  *
  * SPDX-License-Identifier: MIT
  */
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 #include <curlws/curlws.h>
 #include <trower-base64/base64.h>
 
+#include "broadcast.h"
+#include "cb.h"
 #include "data_block_sender.h"
 #include "frame_senders.h"
 #include "handlers.h"
@@ -48,10 +57,39 @@
 #define CURL_SSLVERSION_MAX_DEFAULT CURL_SSLVERSION_TLSv1_2
 #endif
 
+/* The upload buffer size curl allows, and what is used by default. */
+#define UPLOAD_BUFFER_MIN     16384
+#define UPLOAD_BUFFER_MAX     2097152
+#define UPLOAD_BUFFER_DEFAULT 65536
+
+/* The size of reassembly buffer kept between messages by default. */
+#define RECV_BUFFER_KEEP_DEFAULT 65536
+
+/* Where received messages are spilled to by default. */
+#define SPILL_DIR_DEFAULT "/tmp"
+
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
-/* none */
+
+/* Where the payload of a queued message comes from and who is told when the
+ * library is done with it.  Only one of iov, producer or prepared is used. */
+struct msg_src {
+    const struct cws_iov *iov;
+    size_t count;
+    const struct cws_producer *producer;
+    struct cws_prepared *prepared;
+    bool has_tag;
+    void *tag;
+};
+
+/* The state of a cws_send_fd() message. */
+struct fd_source {
+    int fd;
+    uint64_t offset;
+    uint64_t left;
+    void *tag;
+};
 
 /*----------------------------------------------------------------------------*/
 /*                            File Scoped Variables                           */
@@ -63,6 +101,12 @@
 /*----------------------------------------------------------------------------*/
 static CWScode _normalize_close_inputs(int *, int *, const char **, size_t *);
 static int _check_curl_version(const struct cws_config *);
+static CWScode _get_msg_options(CWS *, int, const struct cws_send_opts *, int *);
+static CWScode _validate_text_iov(const struct cws_iov *, size_t);
+static CWScode _validate_text(const char *, size_t *);
+static CWScode _queue_msg(CWS *, int, const struct msg_src *, const struct cws_send_opts *);
+static size_t _fd_read(void *, CWS *, void *, size_t, int *);
+static void _fd_done(void *, CWS *, CWScode);
 CWScode _send_stream(CWS *, int, int, const void *, size_t);
 static CURLcode _config_url(CWS *, const struct cws_config *);
 static CURLcode _config_redirects(CWS *, const struct cws_config *);
@@ -70,6 +114,8 @@ static CURLcode _config_security(CWS *, const struct cws_config *);
 static CURLcode _config_verbosity(CWS *, const struct cws_config *);
 static CURLcode _config_ws_workarounds(CWS *, const struct cws_config *);
 static CURLcode _config_memorypool(CWS *, const struct cws_config *);
+static CURLcode _config_watermarks(CWS *, const struct cws_config *);
+static CURLcode _config_receive(CWS *, const struct cws_config *);
 static CURLcode _config_ws_key(CWS *);
 static CURLcode _config_ws_protocols(CWS *, const struct cws_config *);
 static CURLcode _config_http_headers(CWS *, const struct cws_config *);
@@ -105,8 +151,14 @@ CWS *cws_create(const struct cws_config *config)
 
     priv->cfg.user = config->user;
 
+    priv->cfg.max_ping_rate     = config->max_ping_rate;
+    priv->cfg.max_control_delay = config->max_control_delay;
+
+    cws_random_seed(priv, config->random_seed);
     populate_callbacks(&priv->cb, config);
     status |= _config_memorypool(priv, config);
+    status |= _config_watermarks(priv, config);
+    status |= _config_receive(priv, config);
     status |= _config_url(priv, config);
     status |= _config_security(priv, config);
     status |= _config_redirects(priv, config);
@@ -139,6 +191,11 @@ void cws_destroy(CWS *priv)
         if (priv->dispatching > 0)
             return;
 
+        /* Discarding the queue reports each message to the user, who must
+         * not be able to queue more or reach curl from those callbacks. */
+        priv->close_state |= CLOSE_QUEUED | CLOSED;
+        send_destroy(priv);
+
         if (priv->cfg.url) {
             free(priv->cfg.url);
         }
@@ -158,7 +215,8 @@ void cws_destroy(CWS *priv)
             free(priv->expected_key_header);
         }
 
-        send_destroy(priv);
+        receive_destroy(priv);
+        group_leave_all(priv);
 
         if (priv->mem) {
             mem_cleanup_pool(priv->mem);
@@ -166,6 +224,10 @@ void cws_destroy(CWS *priv)
         if (priv->stream_buffer) {
             free(priv->stream_buffer);
         }
+        spill_close(&priv->spill, NULL);
+        if (priv->cfg.spill_dir) {
+            free(priv->cfg.spill_dir);
+        }
 
         free(priv);
     }
@@ -265,24 +327,206 @@ CWScode cws_send_blk_binary(CWS *priv, const void *data, size_t len)
 
 CWScode cws_send_blk_text(CWS *priv, const char *s, size_t len)
 {
+    CWScode rv;
+
     if (!priv || (!s && (0 < len))) {
         return CWSE_BAD_FUNCTION_ARGUMENT;
     }
 
-    if (s && (0 < len)) {
-        size_t prev_len;
+    rv = _validate_text(s, &len);
+    if (CWSE_OK != rv) {
+        return rv;
+    }
 
-        if (SIZE_MAX == len) {
-            len = strlen(s);
-        }
+    return data_block_sender(priv, CWS_TEXT, s, len);
+}
 
-        prev_len = len;
-        if (0 != utf8_validate(s, &len) || (prev_len != len)) {
-            return CWSE_INVALID_UTF8;
+
+CWScode cws_send_msg(CWS *priv, int type, const void *data, size_t len,
+                     const struct cws_send_opts *opts)
+{
+    CWScode rv;
+    int options;
+    struct cws_iov iov;
+    struct msg_src src = { .iov = &iov, .count = 1 };
+
+    if (!data && (0 < len)) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    rv = _get_msg_options(priv, type, opts, &options);
+    if ((CWSE_OK == rv) && (CWS_TEXT == type)) {
+        rv = _validate_text(data, &len);
+    }
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    iov.base = data;
+    iov.len  = len;
+
+    return _queue_msg(priv, options, &src, opts);
+}
+
+
+CWScode cws_send_ref(CWS *priv, int type, const void *data, size_t len,
+                     void *tag, const struct cws_send_opts *opts)
+{
+    CWScode rv;
+    int options;
+    struct cws_iov iov;
+    struct msg_src src = { .iov = &iov, .count = 1 };
+
+    if (!data && (0 < len)) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    rv = _get_msg_options(priv, type, opts, &options);
+    if ((CWSE_OK == rv) && (CWS_TEXT == type)) {
+        rv = _validate_text(data, &len);
+    }
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    iov.base    = data;
+    iov.len     = len;
+    src.has_tag = true;
+    src.tag     = tag;
+
+    return _queue_msg(priv, options | CWS_REF, &src, opts);
+}
+
+
+CWScode cws_send_iov(CWS *priv, int type, const struct cws_iov *iov,
+                     size_t count, const struct cws_send_opts *opts)
+{
+    CWScode rv;
+    int options;
+    size_t total       = 0;
+    struct msg_src src = { .iov = NULL };
+
+    if (!iov && (0 < count)) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if ((!iov[i].base && (0 < iov[i].len)) || (SIZE_MAX - total < iov[i].len)) {
+            return CWSE_BAD_FUNCTION_ARGUMENT;
         }
+        total += iov[i].len;
     }
 
-    return data_block_sender(priv, CWS_TEXT, s, len);
+    rv = _get_msg_options(priv, type, opts, &options);
+    if ((CWSE_OK == rv) && (CWS_TEXT == type)) {
+        rv = _validate_text_iov(iov, count);
+    }
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    src.iov   = iov;
+    src.count = count;
+
+    return _queue_msg(priv, options, &src, opts);
+}
+
+
+CWScode cws_cancel_msg(CWS *priv, uint64_t msg_id)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    return send_msg_cancel(priv, msg_id);
+}
+
+
+CWScode cws_send_producer(CWS *priv, int type, const struct cws_producer *producer,
+                          const struct cws_send_opts *opts)
+{
+    CWScode rv;
+    int options;
+    int lastinfo;
+    struct msg_src src = { .producer = NULL };
+
+    if (!producer || !producer->read) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    rv = _get_msg_options(priv, type, opts, &options);
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    /* The length isn't known up front, so it can't be a single frame. */
+    if (CWS_WHOLE & options) {
+        return CWSE_INVALID_OPTIONS;
+    }
+
+    if (priv->close_state) {
+        return CWSE_CLOSED_CONNECTION;
+    }
+
+    /* The message is queued whole, so a stream can't be open. */
+    lastinfo = priv->last_sent_data_frame_info;
+    if ((0 != lastinfo) && !(CWS_LAST & lastinfo)) {
+        return CWSE_STREAM_CONTINUITY_ISSUE;
+    }
+
+    if (send_is_full(priv)) {
+        return CWSE_SEND_QUEUE_FULL;
+    }
+
+    src.producer = producer;
+
+    return _queue_msg(priv, options, &src, opts);
+}
+
+
+CWScode cws_producer_ready(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    send_producer_ready(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_send_fd(CWS *priv, int type, int fd, uint64_t offset, uint64_t len,
+                    void *tag, const struct cws_send_opts *opts)
+{
+    struct cws_producer producer;
+    struct fd_source *src;
+    CWScode rv;
+
+    if ((fd < 0) || (UINT64_MAX - offset < len)) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    src = (struct fd_source *) calloc(1, sizeof(struct fd_source));
+    if (!src) {
+        return CWSE_OUT_OF_MEMORY;
+    }
+
+    src->fd     = fd;
+    src->offset = offset;
+    src->left   = len;
+    src->tag    = tag;
+
+    producer.read = _fd_read;
+    producer.done = _fd_done;
+    producer.user = src;
+
+    rv = cws_send_producer(priv, type, &producer, opts);
+    if (CWSE_OK != rv) {
+        free(src);
+    }
+
+    return rv;
 }
 
 
@@ -309,6 +553,219 @@ CWScode cws_send_strm_text(CWS *priv, int info, const char *s, size_t len)
 }
 
 
+CWScode cws_batch_begin(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    send_batch_begin(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_batch_commit(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    return send_batch_commit(priv);
+}
+
+
+CWScode cws_cork(CWS *priv, uint32_t max_usec)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    send_cork(priv, max_usec);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_uncork(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    send_uncork(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_pause_recv(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    receive_pause(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_resume_recv(CWS *priv)
+{
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    receive_resume(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_get_send_stats(CWS *priv, struct cws_send_stats *stats)
+{
+    if (!priv || !stats) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    send_get_stats(priv, stats);
+
+    return CWSE_OK;
+}
+
+
+CWScode cws_prepare(struct cws_prepared **msg, int type, const void *data, size_t len)
+{
+    CWScode rv = CWSE_OK;
+
+    if (!msg || (!data && (0 < len))) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    if ((CWS_TEXT != type) && (CWS_BINARY != type)) {
+        return CWSE_INVALID_OPTIONS;
+    }
+
+    if (CWS_TEXT == type) {
+        rv = _validate_text(data, &len);
+    }
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    *msg = prepared_create(type, data, len);
+    if (!*msg) {
+        return CWSE_OUT_OF_MEMORY;
+    }
+
+    return CWSE_OK;
+}
+
+
+void cws_prepared_release(struct cws_prepared *msg)
+{
+    if (msg) {
+        prepared_unref(msg);
+    }
+}
+
+
+CWScode cws_send_prepared(CWS *priv, struct cws_prepared *msg,
+                          const struct cws_send_opts *opts)
+{
+    CWScode rv;
+    int options;
+    struct cws_iov iov;
+    struct msg_src src = { .iov = &iov, .count = 1 };
+
+    if (!msg) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    rv = _get_msg_options(priv, msg->type, opts, &options);
+    if (CWSE_OK != rv) {
+        return rv;
+    }
+
+    iov.base     = msg->data;
+    iov.len      = msg->len;
+    src.prepared = msg;
+
+    return _queue_msg(priv, options | CWS_REF, &src, opts);
+}
+
+
+struct cws_group *cws_group_create(void)
+{
+    return group_create();
+}
+
+
+void cws_group_destroy(struct cws_group *group)
+{
+    if (group) {
+        group_destroy(group);
+    }
+}
+
+
+CWScode cws_group_add(struct cws_group *group, CWS *priv)
+{
+    if (!group || !priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    return group_add(group, priv);
+}
+
+
+CWScode cws_group_remove(struct cws_group *group, CWS *priv)
+{
+    if (!group || !priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    return group_remove(group, priv);
+}
+
+
+CWScode cws_group_broadcast(struct cws_group *group, struct cws_prepared *msg,
+                            const struct cws_send_opts *opts, size_t *queued)
+{
+    struct cws_send_opts each;
+    CWScode rv   = CWSE_OK;
+    size_t count = 0;
+
+    if (!group || !msg) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    /* Each handle has its own message handles. */
+    memset(&each, 0, sizeof(each));
+    if (opts) {
+        each        = *opts;
+        each.msg_id = NULL;
+    }
+
+    for (size_t i = 0; i < group->count; i++) {
+        CWScode status = cws_send_prepared(group->members[i], msg, &each);
+
+        if (CWSE_OK == status) {
+            count++;
+        } else {
+            rv = status;
+        }
+    }
+
+    if (queued) {
+        *queued = count;
+    }
+
+    return rv;
+}
+
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
@@ -397,6 +854,216 @@ static int _check_curl_version(const struct cws_config *config)
 }
 
 
+/**
+ * Checks the message type and per message settings and combines them into
+ * the options used to queue the message.
+ *
+ * @param priv    the curlws object to send with
+ * @param type    CWS_TEXT or CWS_BINARY
+ * @param opts    the optional per message settings (may be NULL)
+ * @param options the type, priority and flags to queue with (out)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT
+ * @retval CWSE_INVALID_OPTIONS
+ */
+static CWScode _get_msg_options(CWS *priv, int type, const struct cws_send_opts *opts,
+                                int *options)
+{
+    int priority = CWS_PRIO_NORMAL;
+
+    if (!priv) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+
+    if (opts) {
+        priority = opts->priority;
+    }
+
+    switch (priority) {
+        case CWS_PRIO_NORMAL:
+        case CWS_PRIO_HIGH:
+        case CWS_PRIO_BULK:
+            break;
+        default:
+            return CWSE_INVALID_OPTIONS;
+    }
+
+    if ((CWS_TEXT != type) && (CWS_BINARY != type)) {
+        return CWSE_INVALID_OPTIONS;
+    }
+
+    *options = type | priority;
+    if (opts && opts->unfragmented) {
+        *options |= CWS_WHOLE;
+    }
+
+    return CWSE_OK;
+}
+
+
+/**
+ * Validates the text to send is complete UTF-8.
+ *
+ * @param s   the text to validate (may be NULL)
+ * @param len the length of the text (in), SIZE_MAX means use strlen(); the
+ *            length of the text to send (out)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_INVALID_UTF8
+ */
+static CWScode _validate_text(const char *s, size_t *len)
+{
+    if (s && (0 < *len)) {
+        size_t prev_len;
+
+        if (SIZE_MAX == *len) {
+            *len = strlen(s);
+        }
+
+        prev_len = *len;
+        if (0 != utf8_validate(s, len) || (prev_len != *len)) {
+            return CWSE_INVALID_UTF8;
+        }
+    }
+
+    return CWSE_OK;
+}
+
+
+/**
+ * Validates the segments of a text message are complete UTF-8 together.
+ * Characters may be split across segments.
+ *
+ * @param iov   the segments of the message
+ * @param count the number of segments
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_INVALID_UTF8
+ */
+static CWScode _validate_text_iov(const struct cws_iov *iov, size_t count)
+{
+    uint8_t state = UTF8_ACCEPT;
+
+    for (size_t i = 0; i < count; i++) {
+        if (0 != utf8_stream(&state, iov[i].base, iov[i].len)) {
+            return CWSE_INVALID_UTF8;
+        }
+    }
+
+    /* The last segment can't end part way through a character. */
+    if (UTF8_ACCEPT != state) {
+        return CWSE_INVALID_UTF8;
+    }
+
+    return CWSE_OK;
+}
+
+
+/**
+ * Queues a whole message, or none of it, so the caller always knows if a
+ * referenced buffer is still in use and the message can be cancelled as a
+ * whole.
+ *
+ * @param priv    the curlws object to send with
+ * @param options the message type and options
+ * @param src     the source of the payload
+ * @param opts    the optional per message settings
+ *
+ * @return the same as data_block_sender_iov() or send_producer()
+ */
+static CWScode _queue_msg(CWS *priv, int options, const struct msg_src *src,
+                          const struct cws_send_opts *opts)
+{
+    int lastinfo = priv->last_sent_data_frame_info;
+    uint32_t ttl = (opts) ? opts->ttl_usec : 0;
+    uint64_t key = (opts) ? opts->conflate_key : 0;
+    uint64_t msg_id;
+    CWScode rv;
+
+    msg_id = send_msg_begin(priv, options & CWS_PRIO_MASK, ttl, key);
+    if (src->producer) {
+        rv = send_producer(priv, options & ~CWS_PRIO_MASK, options & CWS_PRIO_MASK, src->producer);
+    } else {
+        rv = data_block_sender_iov(priv, options, src->iov, src->count);
+    }
+    if (CWSE_OK != rv) {
+        send_msg_abort(priv);
+        priv->last_sent_data_frame_info = lastinfo;
+        return rv;
+    }
+    if (src->prepared) {
+        send_msg_hold(priv, src->prepared);
+    }
+    send_msg_commit(priv, src->has_tag, src->tag);
+
+    if (opts && opts->msg_id) {
+        *opts->msg_id = msg_id;
+    }
+
+    return CWSE_OK;
+}
+
+
+/**
+ * The (*read) producer callback for cws_send_fd().  Reads the next part of
+ * the file range into the frame being sent.
+ *
+ * @param user the struct fd_source for the file
+ * @param priv the curlws object sending the message
+ * @param buf  the buffer to read into
+ * @param len  the size of the buffer
+ * @param eom  set once the end of the range has been read (out)
+ *
+ * @return the number of bytes read, or CWS_PRODUCER_ABORT if the file can't
+ *         be read or ends before the range does
+ */
+static size_t _fd_read(void *user, CWS *priv, void *buf, size_t len, int *eom)
+{
+    struct fd_source *src = (struct fd_source *) user;
+    ssize_t got;
+
+    IGNORE_UNUSED(priv);
+
+    if (src->left < len) {
+        len = (size_t) src->left;
+    }
+
+    do {
+        got = pread(src->fd, buf, len, (off_t) src->offset);
+    } while ((got < 0) && (EINTR == errno));
+
+    /* A file that ends early can't complete the message. */
+    if ((got < 0) || ((0 == got) && (0 < len))) {
+        return CWS_PRODUCER_ABORT;
+    }
+
+    src->offset += (uint64_t) got;
+    src->left -= (uint64_t) got;
+    *eom = (0 == src->left);
+
+    return (size_t) got;
+}
+
+
+/**
+ * The (*done) producer callback for cws_send_fd().  Frees the file source
+ * and reports the result with (*on_sent).
+ *
+ * @param user   the struct fd_source for the file
+ * @param priv   the curlws object that sent the message
+ * @param status the result of sending the message
+ */
+static void _fd_done(void *user, CWS *priv, CWScode status)
+{
+    struct fd_source *src = (struct fd_source *) user;
+    void *tag             = src->tag;
+
+    free(src);
+    cb_on_sent(priv, tag, status);
+}
+
+
 CWScode _send_stream(CWS *priv, int type, int info, const void *data, size_t len)
 {
     if (!priv || (!data && (0 < len))) {
@@ -413,6 +1080,10 @@ CWScode _send_stream(CWS *priv, int type, int info, const void *data, size_t len
         }
     }
 
+    if (send_is_full(priv)) {
+        return CWSE_SEND_QUEUE_FULL;
+    }
+
     if (CWS_FIRST & info) {
         info |= type;
     } else {
@@ -563,18 +1234,43 @@ static CURLcode _config_ws_workarounds(CWS *priv, const struct cws_config *confi
 
 static CURLcode _config_memorypool(CWS *priv, const struct cws_config *config)
 {
-    size_t max_payload_size;
+    long upload = UPLOAD_BUFFER_DEFAULT;
+    size_t payload;
+
+    if (config->upload_buffer_size) {
+        upload = config->upload_buffer_size;
+        if (upload < UPLOAD_BUFFER_MIN) {
+            upload = UPLOAD_BUFFER_MIN;
+        } else if (UPLOAD_BUFFER_MAX < upload) {
+            upload = UPLOAD_BUFFER_MAX;
+        }
+    }
 
-    priv->cfg.max_payload_size = 1024;
-    if (config->max_payload_size) {
-        priv->cfg.max_payload_size = config->max_payload_size;
+#if CURL_AT_LEAST_VERSION(0x07, 0x3e, 0x00)
+    if (CURLE_OK != curl_easy_setopt(priv->easy, CURLOPT_UPLOAD_BUFFERSIZE, upload)) {
+        upload = UPLOAD_BUFFER_MIN;
     }
+#else
+    /* Before curl 7.62.0 the upload buffer is fixed in size. */
+    upload = UPLOAD_BUFFER_MIN;
+#endif
 
-    /* The largest frame size, so allocate this amount. */
-    max_payload_size = priv->cfg.max_payload_size + WS_FRAME_HEADER_MAX;
+    /* Fill the upload buffer with each frame, header included, so large
+     * messages take few frames (and queue entries) and each is handed to
+     * curl in one pass. */
+    payload = (size_t) upload - WS_FRAME_HEADER_MAX;
+    if (payload < config->min_payload_size) {
+        payload = config->min_payload_size;
+    }
+    if (config->max_payload_size && (config->max_payload_size < payload)) {
+        payload = config->max_payload_size;
+    }
+    priv->cfg.max_payload_size = payload;
 
-    priv->mem_cfg.data_block_size    = send_get_memory_needed(max_payload_size);
-    priv->mem_cfg.control_block_size = send_get_memory_needed(WS_CTL_FRAME_MAX);
+    /* Data blocks are sized to the frame (the header is part of the queue
+     * entry itself), so start with the smallest and double from there. */
+    priv->mem_cfg.data_block_size    = send_get_memory_needed(WS_CTL_PAYLOAD_MAX);
+    priv->mem_cfg.control_block_size = send_get_memory_needed(WS_CTL_PAYLOAD_MAX);
 
     priv->mem = mem_init_pool(&priv->mem_cfg);
 
@@ -582,6 +1278,46 @@ static CURLcode _config_memorypool(CWS *priv, const struct cws_config *config)
 }
 
 
+static CURLcode _config_watermarks(CWS *priv, const struct cws_config *config)
+{
+    if (config->send_high_watermark) {
+        /* Invalid, the queue could never drain to the low watermark. */
+        if (config->send_high_watermark <= config->send_low_watermark) {
+            return ~CURLE_OK;
+        }
+
+        priv->cfg.send_high_watermark = config->send_high_watermark;
+        priv->cfg.send_low_watermark  = config->send_low_watermark;
+    }
+
+    return CURLE_OK;
+}
+
+
+static CURLcode _config_receive(CWS *priv, const struct cws_config *config)
+{
+    const char *dir = config->spill_dir;
+
+    priv->cfg.max_message_size = config->max_message_size;
+    priv->cfg.recv_buffer_keep = config->recv_buffer_keep;
+    priv->cfg.spill_threshold  = config->spill_threshold;
+
+    if (0 == priv->cfg.recv_buffer_keep) {
+        priv->cfg.recv_buffer_keep = RECV_BUFFER_KEEP_DEFAULT;
+    }
+
+    if (!dir) {
+        dir = SPILL_DIR_DEFAULT;
+    }
+    priv->cfg.spill_dir = cws_strdup(dir);
+    if (!priv->cfg.spill_dir) {
+        return ~CURLE_OK;
+    }
+
+    return CURLE_OK;
+}
+
+
 static CURLcode _config_ws_key(CWS *priv)
 {
     CURLcode rv         = ~CURLE_OK;
@@ -12,6 +12,7 @@
 #include "data_block_sender.h"
 #include "frame_senders.h"
 #include "internal.h"
+#include "send.h"
 
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
@@ -38,9 +39,28 @@
 /*----------------------------------------------------------------------------*/
 CWScode data_block_sender(CWS *priv, int options, const void *data, size_t len)
 {
-    const uint8_t *buffer = data;
+    struct cws_iov iov = {
+        .base = data,
+        .len  = len,
+    };
 
-    switch (options) {
+    if (!data) {
+        iov.len = 0;
+    }
+
+    return data_block_sender_iov(priv, options, &iov, 1);
+}
+
+
+CWScode data_block_sender_iov(CWS *priv, int options, const struct cws_iov *iov,
+                              size_t count)
+{
+    int keep    = options & (CWS_PRIO_MASK | CWS_REF);
+    size_t max  = priv->cfg.max_payload_size;
+    size_t len  = 0;
+    size_t skip = 0;
+
+    switch (options & ~(keep | CWS_WHOLE)) {
         case CWS_BINARY:
         case CWS_TEXT:
             break;
@@ -52,27 +72,54 @@ CWScode data_block_sender(CWS *priv, int options, const void *data, size_t len)
         return CWSE_CLOSED_CONNECTION;
     }
 
+    /* The whole message is queued even if it crosses the high watermark,
+     * so it is only checked before starting. */
+    if (send_is_full(priv)) {
+        return CWSE_SEND_QUEUE_FULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        len += iov[i].len;
+    }
+
+    /* A referenced payload doesn't need a pool block, so it can be sent as
+     * one frame of any size.  Frames spanning segments are copied. */
+    if (CWS_WHOLE & options) {
+        if (!(CWS_REF & options) || (1 < count)) {
+            return CWSE_INVALID_OPTIONS;
+        }
+        options &= ~CWS_WHOLE;
+        max = len;
+    }
+
     options |= CWS_FIRST;
-    if (!buffer || !len) {
+    if (!len) {
         options |= CWS_LAST;
         return frame_sender_data(priv, options, NULL, 0);
     }
 
-    while (priv->cfg.max_payload_size < len) {
+    /* The frames are cut from the segments as if they were one buffer. */
+    while (max < len) {
         CWScode rv;
 
-        rv = frame_sender_data(priv, options, buffer, priv->cfg.max_payload_size);
+        rv = frame_sender_data_iov(priv, options, iov, skip, max);
         if (CWSE_OK != rv) { /* Should only fail if we ran out of memory */
             return rv;
         }
 
-        options = CWS_CONT;
-        len -= priv->cfg.max_payload_size;
-        buffer += priv->cfg.max_payload_size;
+        options = CWS_CONT | keep;
+        len -= max;
+        skip += max;
+
+        /* Keep skip within the segment the next frame starts in. */
+        while (iov->len <= skip) {
+            skip -= iov->len;
+            iov++;
+        }
     }
 
     options |= CWS_LAST;
-    return frame_sender_data(priv, options, buffer, len);
+    return frame_sender_data_iov(priv, options, iov, skip, len);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -15,7 +15,10 @@
  * will split up the blob into more manageable sized chucks and send them.
  *
  * @param priv    the curlws object to sent data through
- * @param options only one of the following: CWS_TEXT or CWS_BINARY
+ * @param options only one of the following: CWS_TEXT or CWS_BINARY,
+ *                optionally with one of CWS_PRIO_HIGH or CWS_PRIO_BULK,
+ *                and optionally CWS_REF.  CWS_WHOLE (only with CWS_REF and
+ *                a single segment) sends the payload as one frame
  * @param data    the payload data to send (may be NULL)
  * @param len     the number of bytes in the payload (may be 0)
  *
@@ -23,8 +26,27 @@
  * @retval CWSE_OUT_OF_MEMORY
  * @retval CWSE_INTERNAL_ERROR
  * @retval CWSE_CLOSED_CONNECTION
+ * @retval CWSE_SEND_QUEUE_FULL
  * @retval CWSE_INVALID_OPTIONS
  */
 CWScode data_block_sender(CWS *priv, int options, const void *data, size_t len);
 
+
+/**
+ * Used to send an entire message made of several segments regardless of the
+ * size.  The message is split into frames as if the segments were one
+ * buffer, so a frame may span segments.
+ *
+ * @note The caller is responsible for the total length not overflowing.
+ *
+ * @param priv    the curlws object to sent data through
+ * @param options the same as data_block_sender()
+ * @param iov     the segments to send in order
+ * @param count   the number of segments
+ *
+ * @retval the same as data_block_sender()
+ */
+CWScode data_block_sender_iov(CWS *priv, int options, const struct cws_iov *iov,
+                              size_t count);
+
 #endif
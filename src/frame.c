@@ -83,17 +83,21 @@ int frame_decode(struct cws_frame *in, const void *buffer, size_t len, long *del
 }
 
 
-size_t frame_encode(const struct cws_frame *f, void *buf, size_t len)
+size_t frame_encode_header(const struct cws_frame *f, void *buf, size_t len)
 {
     size_t header_len;
-    uint8_t *mask          = NULL;
-    uint8_t *p             = NULL;
-    const uint8_t *payload = NULL;
-
-    /* Do a simple check to make sure we don't overwrite the buffer.  This
-     * doesn't need to be super accurate since we only need to account for
-     * the potential difference between a 6 byte and 14 byte header. */
-    if (len < (WS_FRAME_HEADER_MIN + WS_FRAME_HEADER_MASK) + f->payload_len) {
+    uint8_t *mask = NULL;
+    uint8_t *p    = NULL;
+
+    if (f->payload_len <= 125) {
+        header_len = 6;
+    } else if (f->payload_len <= UINT16_MAX) {
+        header_len = 8;
+    } else {
+        header_len = 14;
+    }
+
+    if (len < header_len) {
         return 0;
     }
 
@@ -101,15 +105,13 @@ size_t frame_encode(const struct cws_frame *f, void *buf, size_t len)
 
     p[0] = (f->fin ? 0x80 : 0) | (0x0f & f->opcode);
     if (f->payload_len <= 125) {
-        p[1]       = 0x80 | (uint8_t) (0x7f & f->payload_len);
-        mask       = &p[2];
-        header_len = 6;
+        p[1] = 0x80 | (uint8_t) (0x7f & f->payload_len);
+        mask = &p[2];
     } else if (f->payload_len <= UINT16_MAX) {
-        p[1]       = 0x80 | 126;
-        p[2]       = (uint8_t) (0x00ff & (f->payload_len >> 8));
-        p[3]       = (uint8_t) (0x00ff & f->payload_len);
-        mask       = &p[4];
-        header_len = 8;
+        p[1] = 0x80 | 126;
+        p[2] = (uint8_t) (0x00ff & (f->payload_len >> 8));
+        p[3] = (uint8_t) (0x00ff & f->payload_len);
+        mask = &p[4];
     } else {
         p[1] = 0x80 | 127;
         memset(&p[2], 0, 6); /* In case sizeof(size_t) is less than 8 bytes
@@ -126,27 +128,14 @@ size_t frame_encode(const struct cws_frame *f, void *buf, size_t len)
             p[7] = (uint8_t) (0x00ff & (f->payload_len >> 16));
         }
 
-        p[8]       = (uint8_t) (0x00ff & (f->payload_len >> 8));
-        p[9]       = (uint8_t) (0x00ff & f->payload_len);
-        mask       = &p[10];
-        header_len = 14;
-    }
-
-    /* Now that we know how large the header really is, check again. */
-    if (len < header_len + f->payload_len) {
-        return 0;
+        p[8] = (uint8_t) (0x00ff & (f->payload_len >> 8));
+        p[9] = (uint8_t) (0x00ff & f->payload_len);
+        mask = &p[10];
     }
 
     memcpy(mask, f->masking_key, 4);
 
-    p += header_len;
-    payload = (const uint8_t *) f->payload;
-
-    /* Mask the payload and write it to the buf */
-    for (size_t i = 0; i < f->payload_len; i++) {
-        p[i] = payload[i] ^ mask[0x3 & i];
-    }
-    return header_len + f->payload_len;
+    return header_len;
 }
 
 
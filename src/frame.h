@@ -25,13 +25,22 @@ struct cws_frame {
     uint8_t fin : 1;        /* 0/1 FIN bit from rfc6455, page 28 */
     uint8_t mask : 1;       /* 0/1 Mask bit from rfc6455, page 29 */
     uint8_t is_control : 1; /* 1 if the opcode is control, 0 otherwise */
-    uint8_t is_urgent : 1;  /* 1 if the opcode is an urgent frame */
+    uint8_t is_urgent : 1;  /* 1 if the frame goes ahead of its class */
     uint8_t opcode : 4;     /* 0-15 opcode from rfc6455, page 29 */
+    uint8_t is_ref : 1;     /* 1 if the payload outlives the frame, so it is
+                             * referenced instead of copied when queued */
+
+    int priority; /* The data frame class: CWS_PRIO_NORMAL/HIGH/BULK */
 
     uint8_t masking_key[4]; /* The 4 byte masking key to use on upstream msgs */
 
     uint64_t payload_len; /* The payload length pointed to by payload */
     const void *payload;  /* The payload (may be NULL) */
+
+    /* If not NULL, the payload is gathered from these segments instead,
+     * starting iov_skip bytes into the first segment. */
+    const struct cws_iov *iov;
+    size_t iov_skip;
 };
 
 
@@ -79,16 +88,16 @@ int frame_decode(struct cws_frame *f, const void *buf, size_t len, long *delta);
 
 
 /**
- * Takes a frame, payload and buffer (that MUST be larger than the frame plus
- * the payload) and output the WebSocket frame.
+ * Outputs only the WebSocket frame header (including the masking key) for
+ * the frame.  The payload is not touched.
  *
  * @param f    the frame to encode
- * @param buf  the buffer to write to
+ * @param buf  the buffer to write to (WS_FRAME_HEADER_MAX is always enough)
  * @param len  the size of the buffer
  *
  * @return the number of bytes written to buf, or 0 on error
  */
-size_t frame_encode(const struct cws_frame *f, void *buf, size_t len);
+size_t frame_encode_header(const struct cws_frame *f, void *buf, size_t len);
 
 
 /**
@@ -86,19 +86,42 @@ CWScode frame_sender_control(CWS *priv, int options, const void *data, size_t le
 
 
 CWScode frame_sender_data(CWS *priv, int options, const void *data, size_t len)
+{
+    struct cws_iov iov = {
+        .base = data,
+        .len  = len,
+    };
+
+    if (!data) {
+        iov.len = 0;
+    }
+
+    return frame_sender_data_iov(priv, options, &iov, 0, iov.len);
+}
+
+
+CWScode frame_sender_data_iov(CWS *priv, int options, const struct cws_iov *iov,
+                              size_t skip, size_t len)
 {
     struct cws_frame f = {
         .fin        = (CWS_LAST & options) ? 1 : 0,
         .mask       = 1,
         .is_control = 0,
     };
-    const int allowed = (CWS_NONCTRL_MASK | CWS_FIRST | CWS_LAST);
+    const int allowed = (CWS_NONCTRL_MASK | CWS_FIRST | CWS_LAST | CWS_PRIO_MASK | CWS_REF);
     int lastinfo      = priv->last_sent_data_frame_info;
 
     if (options != (options & allowed)) {
         return CWSE_INVALID_OPTIONS;
     }
 
+    if (CWS_PRIO_MASK == (options & CWS_PRIO_MASK)) {
+        return CWSE_INVALID_OPTIONS;
+    }
+
+    f.is_ref = (CWS_REF & options) ? 1 : 0;
+    options &= ~CWS_REF;
+
     switch (options & (CWS_CONT | CWS_BINARY | CWS_TEXT)) {
         case CWS_CONT:
             if (CWS_FIRST & options) {
@@ -135,13 +158,23 @@ CWScode frame_sender_data(CWS *priv, int options, const void *data, size_t len)
 
     priv->last_sent_data_frame_info = options;
 
-    if (!data || !len) {
-        data = NULL;
-        len  = 0;
+    if (len) {
+        /* Move past the segments that are already used up. */
+        while (iov->len <= skip) {
+            skip -= iov->len;
+            iov++;
+        }
+
+        if (len <= iov->len - skip) {
+            f.payload = &((const uint8_t *) iov->base)[skip];
+        } else {
+            f.iov      = iov;
+            f.iov_skip = skip;
+        }
     }
 
-    f.payload     = data;
     f.payload_len = len;
+    f.priority    = options & CWS_PRIO_MASK;
 
     cws_random(priv, f.masking_key, 4);
 
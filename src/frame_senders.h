@@ -18,6 +18,9 @@
 #define CWS_CTRL_MASK    (CWS_CLOSE | CWS_PING | CWS_PONG)
 #define CWS_NONCTRL_MASK (CWS_CONT | CWS_BINARY | CWS_TEXT)
 #define CWS_URGENT       0x04000000
+#define CWS_REF          0x08000000
+#define CWS_WHOLE        0x10000000
+#define CWS_PRIO_MASK    (CWS_PRIO_HIGH | CWS_PRIO_BULK)
 
 /**
  * Used to send a control frame.
@@ -50,6 +53,10 @@ CWScode frame_sender_control(CWS *priv, int options, const void *data, size_t le
  *                CWS_BINARY | CWS_FIRST | CWS_LAST
  *                CWS_TEXT   | CWS_FIRST
  *                CWS_TEXT   | CWS_FIRST | CWS_LAST
+ *                optionally with one of CWS_PRIO_HIGH or CWS_PRIO_BULK,
+ *                which must be the same for all the frames of a message,
+ *                and optionally CWS_REF if the payload is referenced
+ *                instead of copied
  *
  * @param data   the optional payload data to send
  * @param len    the number of bytes in the payload
@@ -62,4 +69,23 @@ CWScode frame_sender_control(CWS *priv, int options, const void *data, size_t le
  */
 CWScode frame_sender_data(CWS *priv, int options, const void *data, size_t len);
 
+
+/**
+ * Used to send a single data frame with the payload taken from a list of
+ * segments.  If the payload fits in one segment it is treated the same as
+ * frame_sender_data(), otherwise it is gathered from the segments when the
+ * frame is queued.
+ *
+ * @param priv    the curlws object to sent data through
+ * @param options the same as frame_sender_data()
+ * @param iov     the segments the payload starts in
+ * @param skip    the number of bytes into iov where the payload starts
+ *                (may be past the end of the first segments)
+ * @param len     the number of bytes in the payload
+ *
+ * @retval the same as frame_sender_data()
+ */
+CWScode frame_sender_data_iov(CWS *priv, int options, const struct cws_iov *iov,
+                              size_t skip, size_t len);
+
 #endif
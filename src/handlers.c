@@ -6,6 +6,7 @@
  */
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -16,7 +17,7 @@
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
 /*----------------------------------------------------------------------------*/
-/* none */
+#define STREAM_BUFFER_MIN 1024
 
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
@@ -33,6 +34,13 @@
 /*----------------------------------------------------------------------------*/
 static int _default_on_fragment(void *, CWS *, int, const void *, size_t);
 static int _default_on_ping(void *, CWS *, const void *, size_t);
+static size_t _expected_len(CWS *, int, size_t);
+static uint8_t *_stream_room(CWS *, size_t);
+static int _stream_append(CWS *, const void *, size_t);
+static void _stream_drop(CWS *);
+static void _stream_trim(CWS *);
+static int _stream_deliver(CWS *);
+static void _deliver(CWS *, int, const void *, size_t);
 
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
@@ -68,6 +76,24 @@ void populate_callbacks(struct callbacks *dest, const struct cws_config *src)
     if (src->on_close) {
         dest->on_close_fn = src->on_close;
     }
+    if (src->on_sent) {
+        dest->on_sent_fn = src->on_sent;
+    }
+    if (src->on_drain) {
+        dest->on_drain_fn = src->on_drain;
+    }
+    if (src->get_buffer) {
+        dest->get_buffer_fn = src->get_buffer;
+    }
+    if (src->on_spilled) {
+        dest->on_spilled_fn = src->on_spilled;
+    }
+
+    /* Like (*on_text) and (*on_binary), only used by the default
+     * (*on_fragment). */
+    if (src->on_messages && !src->on_fragment) {
+        dest->on_messages_fn = src->on_messages;
+    }
 }
 
 
@@ -79,39 +105,34 @@ static int _default_on_fragment(void *user, CWS *priv, int info, const void *buf
 
     IGNORE_UNUSED(user);
 
-    if (one_frame == (one_frame & info)) {
-        if (CWS_BINARY & info) {
-            cb_on_binary(priv, buffer, len);
-        } else {
-            cb_on_text(priv, buffer, len);
-        }
+    /* A whole message in curl's buffer is lent from there, unless the
+     * application wants a buffer it can keep. */
+    if ((one_frame == (one_frame & info)) && !priv->cb.get_buffer_fn) {
+        _deliver(priv, (CWS_BINARY | CWS_TEXT) & info, buffer, len);
     } else {
-        size_t prev_len;
         if (CWS_FIRST & info) {
             priv->stream_type       = (CWS_BINARY | CWS_TEXT) & info;
             priv->stream_buffer_len = 0;
+            priv->user_buffer       = cb_get_buffer(priv, _expected_len(priv, info, len),
+                                                    &priv->user_buffer_size);
         }
 
-        prev_len = priv->stream_buffer_len;
-        priv->stream_buffer_len += len;
-
-        if (0 < priv->stream_buffer_len) {
-            priv->stream_buffer = realloc(priv->stream_buffer, priv->stream_buffer_len);
-            memcpy(&((uint8_t *) priv->stream_buffer)[prev_len], buffer, len);
+        /* The rest of a message that failed is dropped. */
+        if (0 == priv->stream_type) {
+            return 0;
         }
 
-        if (CWS_LAST & info) {
-            if (CWS_BINARY & priv->stream_type) {
-                cb_on_binary(priv, priv->stream_buffer, priv->stream_buffer_len);
-            } else {
-                cb_on_text(priv, priv->stream_buffer, priv->stream_buffer_len);
-            }
+        if (0 < len) {
+            int rv = _stream_append(priv, buffer, len);
 
-            if (NULL != priv->stream_buffer) {
-                free(priv->stream_buffer);
+            if (rv) {
+                _stream_drop(priv);
+                return rv;
             }
-            priv->stream_buffer     = NULL;
-            priv->stream_buffer_len = 0;
+        }
+
+        if (CWS_LAST & info) {
+            return _stream_deliver(priv);
         }
     }
 
@@ -127,3 +148,229 @@ static int _default_on_ping(void *user, CWS *priv, const void *buffer, size_t le
 
     return 0;
 }
+
+
+/**
+ * Figures out how long the message starting with this fragment is.  The
+ * frame being received has the length of the rest of the payload, which is
+ * the rest of the message if it is the final frame.
+ *
+ * @param priv the handle receiving the message
+ * @param info the fragment's info
+ * @param len  the length of the fragment
+ *
+ * @return the length of the message, or 0 if it isn't known
+ */
+static size_t _expected_len(CWS *priv, int info, size_t len)
+{
+    const struct cws_frame *frame = priv->recv.frame;
+
+    if (CWS_LAST & info) {
+        return len;
+    }
+
+    if (frame && frame->fin && (frame->payload_len <= SIZE_MAX - len)) {
+        return len + (size_t) frame->payload_len;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Makes room for more bytes in the buffer the message is reassembled in.
+ * The library's buffer doubles in size so a message of many fragments is
+ * only copied a few times; the application's buffer can't grow.
+ *
+ * @param priv the handle with the buffer
+ * @param len  the number of bytes about to be added
+ *
+ * @return where to put the bytes, or NULL if they don't fit
+ */
+static uint8_t *_stream_room(CWS *priv, size_t len)
+{
+    size_t needed = priv->stream_buffer_len + len;
+    size_t size   = priv->stream_buffer_size;
+    void *larger;
+
+    if (needed < len) {
+        return NULL;
+    }
+
+    if (priv->user_buffer) {
+        if (priv->user_buffer_size < needed) {
+            return NULL;
+        }
+        return &((uint8_t *) priv->user_buffer)[priv->stream_buffer_len];
+    }
+
+    if (size < needed) {
+        if (size < STREAM_BUFFER_MIN) {
+            size = STREAM_BUFFER_MIN;
+        }
+        while (size < needed) {
+            size = (SIZE_MAX / 2 < size) ? needed : size * 2;
+        }
+
+        larger = realloc(priv->stream_buffer, size);
+        if (!larger) {
+            return NULL;
+        }
+
+        priv->stream_buffer      = larger;
+        priv->stream_buffer_size = size;
+    }
+
+    return &((uint8_t *) priv->stream_buffer)[priv->stream_buffer_len];
+}
+
+
+/**
+ * Adds a fragment to the message being reassembled, moving the message to a
+ * file once it grows past the spill threshold.
+ *
+ * @param priv   the handle receiving the message
+ * @param buffer the fragment
+ * @param len    the length of the fragment
+ *
+ * @return 0 on success, or the close code to use
+ */
+static int _stream_append(CWS *priv, const void *buffer, size_t len)
+{
+    struct spill *spill = &priv->spill;
+    size_t threshold    = priv->cfg.spill_threshold;
+    uint8_t *dest;
+
+    if (spill->open) {
+        return spill_write(spill, buffer, len) ? 0 : 1011;
+    }
+
+    if (!priv->user_buffer && threshold && (threshold - priv->stream_buffer_len < len)) {
+        if (!spill_open(spill, priv->cfg.spill_dir)
+            || !spill_write(spill, priv->stream_buffer, priv->stream_buffer_len)
+            || !spill_write(spill, buffer, len))
+        {
+            return 1011;
+        }
+        priv->stream_buffer_len = 0;
+
+        /* The rest of the message goes to the file, so memory used so far
+         * is released just as if the message had been delivered. */
+        _stream_trim(priv);
+        return 0;
+    }
+
+    dest = _stream_room(priv, len);
+    if (!dest) {
+        return 1009;
+    }
+    memcpy(dest, buffer, len);
+    priv->stream_buffer_len += len;
+
+    return 0;
+}
+
+
+/**
+ * Drops the message being reassembled and the rest of its fragments.
+ *
+ * @param priv the handle receiving the message
+ */
+static void _stream_drop(CWS *priv)
+{
+    priv->stream_type       = 0;
+    priv->stream_buffer_len = 0;
+    priv->user_buffer       = NULL;
+    spill_close(&priv->spill, NULL);
+}
+
+
+/**
+ * Delivers a reassembled message.  The application's buffer is handed back
+ * to it, while the library's buffer is kept for the next message unless it
+ * grew too big.  A spilled message is delivered from a read-only mapping of
+ * its file.
+ *
+ * @param priv the handle with the message
+ *
+ * @return 0 on success, or the close code to use
+ */
+static int _stream_deliver(CWS *priv)
+{
+    void *buf  = priv->user_buffer;
+    size_t len = priv->stream_buffer_len;
+
+    if (priv->spill.open) {
+        const void *map = spill_map(&priv->spill);
+
+        if (!map) {
+            _stream_drop(priv);
+            return 1011;
+        }
+
+        len = priv->spill.len;
+        if (priv->cb.on_spilled_fn) {
+            cb_on_spilled(priv, priv->stream_type, priv->spill.fd, map, len);
+        } else {
+            _deliver(priv, priv->stream_type, map, len);
+            cb_on_messages(priv);
+        }
+        spill_close(&priv->spill, map);
+
+        return 0;
+    }
+
+    priv->user_buffer       = NULL;
+    priv->stream_buffer_len = 0;
+
+    if (buf) {
+        _deliver(priv, priv->stream_type, buf, len);
+    } else {
+        _deliver(priv, priv->stream_type, (0 < len) ? priv->stream_buffer : NULL, len);
+
+        /* The library's buffer is reused by the next message. */
+        cb_on_messages(priv);
+    }
+
+    _stream_trim(priv);
+
+    return 0;
+}
+
+
+/**
+ * Frees the library's reassembly buffer if it is larger than the
+ * configured recv_buffer_keep, so one large message doesn't hold on to
+ * memory for the life of the connection.
+ *
+ * @param priv the handle receiving messages
+ */
+static void _stream_trim(CWS *priv)
+{
+    if (priv->cfg.recv_buffer_keep < priv->stream_buffer_size) {
+        free(priv->stream_buffer);
+        priv->stream_buffer      = NULL;
+        priv->stream_buffer_size = 0;
+    }
+}
+
+
+/**
+ * Passes a complete message to (*on_text) or (*on_binary), or adds it to
+ * the messages for (*on_messages).
+ *
+ * @param priv the handle with the message
+ * @param type CWS_TEXT or CWS_BINARY
+ * @param buf  the message
+ * @param len  the length of the message
+ */
+static void _deliver(CWS *priv, int type, const void *buf, size_t len)
+{
+    if (priv->cb.on_messages_fn) {
+        cb_add_message(priv, type, buf, len);
+    } else if (CWS_BINARY & type) {
+        cb_on_binary(priv, buf, len);
+    } else {
+        cb_on_text(priv, buf, len);
+    }
+}
@@ -14,6 +14,7 @@
 
 #include "frame.h"
 #include "memory.h"
+#include "spill.h"
 #include "utf8.h"
 #include "ws.h"
 
@@ -29,6 +30,9 @@
 #define READY_TO_CLOSE(x) \
     ((CLOSE_SENT | CLOSE_RECEIVED) == ((CLOSED | CLOSE_SENT | CLOSE_RECEIVED) & x))
 
+/* The most messages passed to (*on_messages) at once. */
+#define RECV_BATCH_MAX 64
+
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
@@ -40,9 +44,26 @@ struct cfg_set {
     /* The user provided data. */
     void *user;
 
-    /* The maximum payload size. */
+    /* The payload size messages are fragmented into, based on curl's upload
+     * buffer size and bounded by the configured limits. */
     size_t max_payload_size;
 
+    /* The queued bytes limits (see struct cws_config). */
+    size_t send_high_watermark;
+    size_t send_low_watermark;
+
+    /* The PING rate limit (see struct cws_config). */
+    uint32_t max_ping_rate;
+
+    /* The most payload bytes a control frame may wait behind. */
+    size_t max_control_delay;
+
+    /* The received message limits (see struct cws_config). */
+    size_t max_message_size;
+    size_t recv_buffer_keep;
+    size_t spill_threshold;
+    char *spill_dir;
+
     /* The verbosity of the logging. */
     int verbose;
 
@@ -65,6 +86,11 @@ struct callbacks {
     int (*on_ping_fn)(void *, CWS *, const void *, size_t);
     int (*on_pong_fn)(void *, CWS *, const void *, size_t);
     int (*on_close_fn)(void *, CWS *, int, const char *, size_t);
+    void (*on_sent_fn)(void *, CWS *, void *, CWScode);
+    void (*on_drain_fn)(void *, CWS *);
+    void *(*get_buffer_fn)(void *, CWS *, size_t, size_t *);
+    int (*on_spilled_fn)(void *, CWS *, int, int, const void *, size_t);
+    int (*on_messages_fn)(void *, CWS *, const struct cws_message *, size_t);
 };
 
 struct recv {
@@ -72,11 +98,8 @@ struct recv {
     int stream_type;
     int fragment_info;
 
-    struct utf8_buffer {
-        char buf[MAX_UTF_BYTES];
-        size_t used;
-        size_t needed;
-    } utf8;
+    /* The UTF-8 validator state between the fragments of a text stream. */
+    uint8_t utf8;
 
     /* If the decoded frame is valid, it is not NULL. */
     struct cws_frame *frame;
@@ -100,6 +123,105 @@ struct recv {
         size_t used;
         size_t needed;
     } control;
+
+    /* The payload bytes in the frames of the current data message so far. */
+    uint64_t msg_len;
+
+    /* The complete messages waiting to be passed to (*on_messages). */
+    struct batch {
+        struct cws_message msgs[RECV_BATCH_MAX];
+        size_t count;
+    } batch;
+
+    /* The rest of curl's buffer when receiving was paused part way through
+     * it.  It is processed when receiving resumes. */
+    struct pending {
+        char *buf;
+        size_t len;
+    } pending;
+
+    /* Set while received data is being processed, so pausing or resuming
+     * from a callback only changes pause_flags. */
+    bool receiving;
+
+    /* The PINGs received in the current one second window. */
+    struct ping_window {
+        uint64_t start;
+        uint32_t count;
+    } pings;
+};
+
+/* The send queue classes, listed in the order they are drained. */
+enum send_class {
+    SEND_CLASS_CONTROL = 0,
+    SEND_CLASS_HIGH,
+    SEND_CLASS_NORMAL,
+    SEND_CLASS_BULK,
+    SEND_CLASS_COUNT
+};
+
+struct send {
+    /* The frame presently being handed to curl.  Once a frame has started
+     * it is never interrupted, so it is removed from the class queues. */
+    struct cws_buf_queue *active;
+
+    /* The (non-urgent) close frame is only sent once nothing else is left
+     * that can be sent. */
+    struct cws_buf_queue *close;
+
+    /* A data message that has been partly sent must be completed before
+     * any other data message is started.  Control frames may still be sent
+     * between the fragments. */
+    bool data_in_progress;
+    int data_class;
+
+    /* The handle of the data message in progress.  Its next frame may not
+     * be at the head of its class yet, so it is recorded here. */
+    uint64_t started_msg_id;
+
+    /* Where the message being queued by send_msg_begin() starts, so it can
+     * be withdrawn if it can't be queued completely, and the handle and
+     * deadline given to each of its frames. */
+    struct send_mark {
+        bool open;
+        int class_idx;
+        struct cws_buf_queue *tail;
+        uint64_t msg_id;
+        uint64_t deadline;
+        uint64_t key;
+    } mark;
+
+    /* The last message handle given out. */
+    uint64_t last_msg_id;
+
+    /* The per class queues, appended to in O(1). */
+    struct send_queue {
+        struct cws_buf_queue *head;
+        struct cws_buf_queue *tail;
+    } q[SEND_CLASS_COUNT];
+
+    /* While a batch is open curl is not woken up for each queued frame.
+     * deferred counts the wake ups that were held back. */
+    struct send_batch {
+        int depth;
+        uint64_t deferred;
+    } batch;
+
+    /* While corked, queued frames are held back and curl is left paused so
+     * they are written together.  If max_usec is set, the held frames are
+     * released (open) once the first of them has waited that long. */
+    struct send_cork {
+        bool on;
+        bool open;
+        uint32_t max_usec;
+        uint64_t deadline;
+    } cork;
+
+    /* Set when the queued bytes reach the high watermark, cleared (and the
+     * user told) when they fall to the low watermark. */
+    bool above_high;
+
+    struct cws_send_stats stats;
 };
 
 struct header_map {
@@ -112,6 +234,16 @@ struct header_map {
     char *ws_protocols_received;
 };
 
+/* The xoshiro256** state used for mask keys and the bytes left over from the
+ * last batch it produced. */
+struct rng {
+    uint64_t s[4];
+    uint8_t batch[32];
+    size_t left;
+};
+
+struct group_link;
+
 struct cws_object {
     /* Configured values that shouldn't change after they are set. */
     struct cfg_set cfg;
@@ -136,16 +268,27 @@ struct cws_object {
     /* The details about the last data frame queued to send. */
     int last_sent_data_frame_info;
 
-    /* The outgoing queue of bytes to send. */
-    struct cws_buf_queue *send;
+    /* The outgoing queues of bytes to send. */
+    struct send send;
 
     /* The structure needed to deal with the incoming data stream */
     struct recv recv;
 
+    /* The message being reassembled by the default (*on_fragment). */
     int stream_type;
     size_t stream_buffer_len;
+    size_t stream_buffer_size;
     void *stream_buffer;
 
+    /* The application's buffer (see (*get_buffer)) the message is being
+     * reassembled in instead of stream_buffer, if any. */
+    size_t user_buffer_size;
+    void *user_buffer;
+
+    /* The file the message is being reassembled in once it has grown past
+     * cfg.spill_threshold. */
+    struct spill spill;
+
     /* Connection State flags */
     uint8_t dispatching;
     int pause_flags;
@@ -154,6 +297,13 @@ struct cws_object {
     struct header_map header_state;
 
     int close_state;
+
+    /* The broadcast groups this handle is in. */
+    struct group_link *groups;
+
+    /* The handle's own random generator, so handles on different threads
+     * never share state. */
+    struct rng rng;
 };
 
 /*----------------------------------------------------------------------------*/
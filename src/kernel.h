@@ -0,0 +1,45 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef __KERNEL_H__
+#define __KERNEL_H__
+
+#include <stddef.h>
+
+/* Any function pointer type converts to this one and back. */
+typedef void (*kernel_fn)(void);
+
+
+/**
+ * Returns the kernel cached in slot, calling select to pick one the first
+ * time.  Threads may race to fill the slot; they all store the same value,
+ * and the atomic accesses make that race well defined.
+ *
+ * @note Without the GCC/clang atomics the kernels are never CPU specific,
+ *       so select is simply called each time and nothing is cached.
+ *
+ * @param slot   the cached kernel, NULL until one is picked
+ * @param select picks the kernel for the running CPU
+ *
+ * @return the kernel to call
+ */
+static inline kernel_fn kernel_get(kernel_fn *slot, kernel_fn (*select)(void))
+{
+#if defined(__GNUC__) || defined(__clang__)
+    kernel_fn fn = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    if (NULL == fn) {
+        fn = (*select)();
+        __atomic_store_n(slot, fn, __ATOMIC_RELEASE);
+    }
+
+    return fn;
+#else
+    (void) slot;
+    return (*select)();
+#endif
+}
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "mask.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "kernel.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+
+/* The SIMD kernels are only built where the compiler lets us enable the
+ * instruction set per function, so the library itself does not need to be
+ * built with -mavx2. */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MASK_X86 1
+#include <immintrin.h>
+#else
+#define MASK_X86 0
+#endif
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+typedef void (*mask_fn)(uint8_t *, const uint8_t *, size_t, const uint8_t *, size_t);
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+
+/* The selected kernel, see kernel_get(). */
+static kernel_fn __kernel = NULL;
+
+/*----------------------------------------------------------------------------*/
+/*                             Function Prototypes                            */
+/*----------------------------------------------------------------------------*/
+static void _mask_bytes(uint8_t *, const uint8_t *, size_t, const uint8_t *, size_t);
+static void _mask_word(uint8_t *, const uint8_t *, size_t, const uint8_t *, size_t);
+#if MASK_X86
+static void _mask_sse2(uint8_t *, const uint8_t *, size_t, const uint8_t *, size_t);
+static void _mask_avx2(uint8_t *, const uint8_t *, size_t, const uint8_t *, size_t);
+#endif
+static kernel_fn _mask_select(void);
+static size_t _align_head(const uint8_t *, size_t, size_t);
+static void _rotate_key(uint8_t *, size_t, const uint8_t *, size_t);
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+void mask_copy(void *dst, const void *src, size_t len, const uint8_t key[4],
+               size_t offset)
+{
+    mask_fn fn = (mask_fn) kernel_get(&__kernel, _mask_select);
+
+    (*fn)((uint8_t *) dst, (const uint8_t *) src, len, key, offset);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+
+/* Picks the widest kernel the running CPU supports. */
+static kernel_fn _mask_select(void)
+{
+#if MASK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return (kernel_fn) _mask_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return (kernel_fn) _mask_sse2;
+    }
+#endif
+    return (kernel_fn) _mask_word;
+}
+
+
+/* Returns the number of bytes to handle one at a time so the destination
+ * is aligned to the width (a power of 2) of the kernel. */
+static size_t _align_head(const uint8_t *dst, size_t width, size_t len)
+{
+    size_t head = (width - ((uintptr_t) dst & (width - 1))) & (width - 1);
+
+    return (head < len) ? head : len;
+}
+
+
+/* Fills out with len bytes of the key, starting at the payload offset. */
+static void _rotate_key(uint8_t *out, size_t len, const uint8_t *key, size_t offset)
+{
+    for (size_t i = 0; i < len; i++) {
+        out[i] = key[0x3 & (offset + i)];
+    }
+}
+
+
+/* The reference kernel; also used for the unaligned heads and tails. */
+static void _mask_bytes(uint8_t *dst, const uint8_t *src, size_t len,
+                        const uint8_t *key, size_t offset)
+{
+    for (size_t i = 0; i < len; i++) {
+        dst[i] = src[i] ^ key[0x3 & (offset + i)];
+    }
+}
+
+
+/* The portable kernel, 8 bytes at a time. */
+static void _mask_word(uint8_t *dst, const uint8_t *src, size_t len,
+                       const uint8_t *key, size_t offset)
+{
+    uint8_t k[sizeof(uint64_t)];
+    uint64_t kw, w;
+    size_t i;
+
+    /* Not worth the alignment work for short payloads. */
+    if (len < 2 * sizeof(uint64_t)) {
+        _mask_bytes(dst, src, len, key, offset);
+        return;
+    }
+
+    i = _align_head(dst, sizeof(uint64_t), len);
+    _mask_bytes(dst, src, i, key, offset);
+
+    _rotate_key(k, sizeof(k), key, offset + i);
+    memcpy(&kw, k, sizeof(kw));
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        memcpy(&w, &src[i], sizeof(w));
+        w ^= kw;
+        memcpy(&dst[i], &w, sizeof(w));
+    }
+
+    _mask_bytes(&dst[i], &src[i], len - i, key, offset + i);
+}
+
+
+#if MASK_X86
+__attribute__((target("sse2"))) static void _mask_sse2(uint8_t *dst, const uint8_t *src, size_t len,
+                                                       const uint8_t *key, size_t offset)
+{
+    uint8_t k[sizeof(__m128i)];
+    __m128i kv;
+    size_t i;
+
+    if (len < 2 * sizeof(__m128i)) {
+        _mask_word(dst, src, len, key, offset);
+        return;
+    }
+
+    i = _align_head(dst, sizeof(__m128i), len);
+    _mask_bytes(dst, src, i, key, offset);
+
+    _rotate_key(k, sizeof(k), key, offset + i);
+    kv = _mm_loadu_si128((const __m128i *) k);
+
+    for (; i + 2 * sizeof(__m128i) <= len; i += 2 * sizeof(__m128i)) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &src[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &src[i + sizeof(__m128i)]);
+        _mm_store_si128((__m128i *) &dst[i], _mm_xor_si128(a, kv));
+        _mm_store_si128((__m128i *) &dst[i + sizeof(__m128i)], _mm_xor_si128(b, kv));
+    }
+    for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &src[i]);
+        _mm_store_si128((__m128i *) &dst[i], _mm_xor_si128(a, kv));
+    }
+
+    _mask_bytes(&dst[i], &src[i], len - i, key, offset + i);
+}
+
+
+__attribute__((target("avx2"))) static void _mask_avx2(uint8_t *dst, const uint8_t *src, size_t len,
+                                                       const uint8_t *key, size_t offset)
+{
+    uint8_t k[sizeof(__m256i)];
+    __m256i kv;
+    size_t i;
+
+    if (len < 2 * sizeof(__m256i)) {
+        _mask_sse2(dst, src, len, key, offset);
+        return;
+    }
+
+    i = _align_head(dst, sizeof(__m256i), len);
+    _mask_bytes(dst, src, i, key, offset);
+
+    _rotate_key(k, sizeof(k), key, offset + i);
+    kv = _mm256_loadu_si256((const __m256i *) k);
+
+    for (; i + 2 * sizeof(__m256i) <= len; i += 2 * sizeof(__m256i)) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &src[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *) &src[i + sizeof(__m256i)]);
+        _mm256_store_si256((__m256i *) &dst[i], _mm256_xor_si256(a, kv));
+        _mm256_store_si256((__m256i *) &dst[i + sizeof(__m256i)], _mm256_xor_si256(b, kv));
+    }
+    for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &src[i]);
+        _mm256_store_si256((__m256i *) &dst[i], _mm256_xor_si256(a, kv));
+    }
+
+    _mask_word(&dst[i], &src[i], len - i, key, offset + i);
+}
+#endif
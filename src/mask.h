@@ -0,0 +1,30 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef __MASK_H__
+#define __MASK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Copies the payload from src to dst while applying the WebSocket masking
+ * key (rfc6455, section 5.3).  The fastest kernel the CPU supports is picked
+ * the first time this is called.
+ *
+ * @note src and dst may be the same buffer, but must not otherwise overlap.
+ *
+ * @param dst    the buffer to write the masked bytes to
+ * @param src    the bytes to mask
+ * @param len    the number of bytes to mask
+ * @param key    the 4 byte masking key
+ * @param offset the offset into the payload of src[0], so a payload can be
+ *               masked in several pieces
+ */
+void mask_copy(void *dst, const void *src, size_t len, const uint8_t key[4],
+               size_t offset);
+
+#endif
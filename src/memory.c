@@ -12,7 +12,9 @@
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
 /*----------------------------------------------------------------------------*/
-/* none */
+
+/* The number of data block sizes, each twice the size of the one before. */
+#define MEM_DATA_CLASS_COUNT 24
 
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
@@ -34,7 +36,7 @@ struct mem_block_pool {
 
 struct mem_pool {
     struct mem_block_pool ctrl;
-    struct mem_block_pool data;
+    struct mem_block_pool data[MEM_DATA_CLASS_COUNT];
 };
 
 /*----------------------------------------------------------------------------*/
@@ -46,6 +48,7 @@ struct mem_pool {
 /*                             Function Prototypes                            */
 /*----------------------------------------------------------------------------*/
 static void *_mem_alloc(struct mem_block_pool *);
+static void _mem_cleanup(struct mem_block_pool *);
 
 
 /*----------------------------------------------------------------------------*/
@@ -61,13 +64,20 @@ pool_t *mem_init_pool(const struct mem_pool_config *cfg)
 
     pool = (pool_t *) malloc(sizeof(pool_t));
     if (pool) {
+        size_t block_size = cfg->data_block_size;
+
         pool->ctrl.block_size = cfg->control_block_size;
         pool->ctrl.free       = NULL;
         pool->ctrl.active     = NULL;
 
-        pool->data.block_size = cfg->data_block_size;
-        pool->data.free       = NULL;
-        pool->data.active     = NULL;
+        for (int i = 0; i < MEM_DATA_CLASS_COUNT; i++) {
+            pool->data[i].block_size = block_size;
+            pool->data[i].free       = NULL;
+            pool->data[i].active     = NULL;
+            if (block_size <= SIZE_MAX / 2) {
+                block_size *= 2;
+            }
+        }
     }
 
     return pool;
@@ -76,30 +86,14 @@ pool_t *mem_init_pool(const struct mem_pool_config *cfg)
 
 void mem_cleanup_pool(pool_t *pool)
 {
-    struct mem_block *p;
-
     if (!pool) {
         return;
     }
 
-    while ((p = pool->ctrl.active) != NULL) {
-        pool->ctrl.active = p->next;
-        free(p);
-    }
+    _mem_cleanup(&pool->ctrl);
 
-    while ((p = pool->ctrl.free) != NULL) {
-        pool->ctrl.free = p->next;
-        free(p);
-    }
-
-    while ((p = pool->data.active) != NULL) {
-        pool->data.active = p->next;
-        free(p);
-    }
-
-    while ((p = pool->data.free) != NULL) {
-        pool->data.free = p->next;
-        free(p);
+    for (int i = 0; i < MEM_DATA_CLASS_COUNT; i++) {
+        _mem_cleanup(&pool->data[i]);
     }
 
     free(pool);
@@ -112,9 +106,15 @@ void *mem_alloc_ctrl(pool_t *pool)
 }
 
 
-void *mem_alloc_data(pool_t *pool)
+void *mem_alloc_data(pool_t *pool, size_t size)
 {
-    return _mem_alloc(&pool->data);
+    for (int i = 0; i < MEM_DATA_CLASS_COUNT; i++) {
+        if (size <= pool->data[i].block_size) {
+            return _mem_alloc(&pool->data[i]);
+        }
+    }
+
+    return NULL;
 }
 
 
@@ -196,3 +196,24 @@ static void *_mem_alloc(struct mem_block_pool *pool)
 
     return (void *) &p->data[0];
 }
+
+
+/**
+ * Frees all the blocks of the smaller block pool struct, in use or not.
+ *
+ * @param pool the pool to clean up
+ */
+static void _mem_cleanup(struct mem_block_pool *pool)
+{
+    struct mem_block *p;
+
+    while ((p = pool->active) != NULL) {
+        pool->active = p->next;
+        free(p);
+    }
+
+    while ((p = pool->free) != NULL) {
+        pool->free = p->next;
+        free(p);
+    }
+}
@@ -17,8 +17,9 @@ struct mem_pool_config {
      * be this size (or larger) when returned. */
     size_t control_block_size;
 
-    /* The maximum data block size (all inclusive).  All data blocks will
-     * be this size (or larger) when returned. */
+    /* The smallest data block size (all inclusive).  Data blocks are sized
+     * to what is asked for, rounded up to this size doubled as many times as
+     * needed, so blocks of a size can be reused. */
     size_t data_block_size;
 };
 
@@ -58,14 +59,15 @@ void *mem_alloc_ctrl(pool_t *pool);
 
 
 /**
- * Allocates a control buffer of the size specified by the control_block_size
- * from the specified pool.
+ * Allocates a data buffer of at least the specified size from the specified
+ * pool.
  *
  * @param pool the pool to allocate from
+ * @param size the number of bytes needed
  *
  * @return the memory block, or NULL on error.
  */
-void *mem_alloc_data(pool_t *pool);
+void *mem_alloc_data(pool_t *pool, size_t size);
 
 
 /**
@@ -10,7 +10,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/random.h>
+#include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -34,31 +36,63 @@
 /*----------------------------------------------------------------------------*/
 /*                             Function Prototypes                            */
 /*----------------------------------------------------------------------------*/
-/* none */
+static uint64_t _splitmix64(uint64_t *);
+static uint64_t _rotl(uint64_t, int);
+static void _refill(struct rng *);
 
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
 /*----------------------------------------------------------------------------*/
-void cws_random(CWS *priv, void *buffer, size_t len)
+void cws_random_seed(CWS *priv, uint64_t seed)
 {
-    uint8_t *bytes    = buffer;
-    static int seeded = 0;
+    struct rng *rng    = &priv->rng;
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 0 };
 
-    IGNORE_UNUSED(priv);
+    rng->left = 0;
 
-    if (0 == seeded) {
-        struct timespec ts;
+    if (0 == seed) {
+        ssize_t got = getrandom(rng->s, sizeof(rng->s), GRND_NONBLOCK);
 
-        if (0 == clock_gettime(CLOCK_MONOTONIC, &ts)) {
-            srandom(((int) ts.tv_nsec) ^ ((int) ts.tv_sec));
-            seeded = 1;
+        if (sizeof(rng->s) == (size_t) got) {
+            if (rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3]) {
+                return;
+            }
         }
+
+        /* No entropy yet (early boot) so fall back to something that at
+         * least differs between handles and runs. */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        seed = ((uint64_t) ts.tv_sec << 32) ^ (uint64_t) ts.tv_nsec;
+        seed ^= (uint64_t) (uintptr_t) priv;
+    }
+
+    /* Expanding the seed with splitmix64 never gives an all zero state. */
+    for (size_t i = 0; i < 4; i++) {
+        rng->s[i] = _splitmix64(&seed);
     }
+}
+
+
+void cws_random(CWS *priv, void *buffer, size_t len)
+{
+    struct rng *rng = &priv->rng;
+    uint8_t *bytes  = buffer;
 
     /* Note that this does NOT need to be a crypto level randomization function
-     * but is simply used to prevent intermediary caches from causing issues. */
-    for (size_t i = 0; i < len; i++) {
-        bytes[i] = (0x0ff & random());
+     * but is simply used to prevent intermediary caches from causing issues.
+     * The keys are made in batches since most calls want just 4 bytes. */
+    while (len) {
+        size_t n;
+
+        if (0 == rng->left) {
+            _refill(rng);
+        }
+
+        n = (len < rng->left) ? len : rng->left;
+        memcpy(bytes, &rng->batch[sizeof(rng->batch) - rng->left], n);
+        rng->left -= n;
+        bytes += n;
+        len -= n;
     }
 }
 
@@ -66,4 +100,57 @@ void cws_random(CWS *priv, void *buffer, size_t len)
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
-/* none */
+
+
+/**
+ * The splitmix64 generator, used to expand a seed into the xoshiro state.
+ *
+ * @param x the generator state to advance
+ *
+ * @return the next value
+ */
+static uint64_t _splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+    return z ^ (z >> 31);
+}
+
+
+/**
+ * Rotates a value left by k bits (0 < k < 64).
+ */
+static uint64_t _rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+
+/**
+ * Refills the batch of random bytes from xoshiro256**.
+ *
+ * @param rng the generator to refill
+ */
+static void _refill(struct rng *rng)
+{
+    uint64_t *s = rng->s;
+
+    for (size_t i = 0; i < sizeof(rng->batch); i += sizeof(uint64_t)) {
+        uint64_t out = _rotl(s[1] * 5, 7) * 9;
+        uint64_t t   = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = _rotl(s[3], 45);
+
+        memcpy(&rng->batch[i], &out, sizeof(out));
+    }
+
+    rng->left = sizeof(rng->batch);
+}
@@ -11,6 +11,15 @@
 
 #include "internal.h"
 
+/**
+ * Seeds the handle's random generator.
+ *
+ * @param priv the websocket object to seed
+ * @param seed the seed to use, or 0 to seed from getrandom()
+ */
+void cws_random_seed(CWS *priv, uint64_t seed);
+
+
 /**
  * Fill the 'buffer' of length 'len' bytes with random data & return.
  *
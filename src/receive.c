@@ -7,13 +7,16 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <curl/curl.h>
 
 #include "cb.h"
 #include "receive.h"
+#include "send.h"
 #include "utf8.h"
+#include "utils.h"
 #include "verbose.h"
 #include "ws.h"
 
@@ -36,8 +39,14 @@
 /*                             Function Prototypes                            */
 /*----------------------------------------------------------------------------*/
 static size_t _receive_cb(const char *, size_t, size_t, void *);
+static void _process_buffer(CWS *, const char *, size_t);
+static void _keep(CWS *, const char *, size_t);
 static void _cws_process_frame(CWS *, const char **, size_t *);
 static void _error_close(CWS *priv, int, const char *, size_t);
+static bool _ping_flood(CWS *);
+static bool _too_big(CWS *, const struct cws_frame *);
+static bool _batchable(CWS *);
+static void _flush_messages(CWS *);
 static inline size_t _min_size_t(size_t, size_t);
 
 /*----------------------------------------------------------------------------*/
@@ -53,6 +62,69 @@ CURLcode receive_init(CWS *priv)
     return rv;
 }
 
+
+void receive_pause(CWS *priv)
+{
+    if (CURLPAUSE_RECV & priv->pause_flags) {
+        return;
+    }
+
+    priv->pause_flags |= CURLPAUSE_RECV;
+    verbose(priv, "[ websocket pause receiving ]\n");
+
+    /* Inside _receive_cb() curl is paused once the buffer is put aside. */
+    if (!priv->recv.receiving) {
+        curl_easy_pause(priv->easy, priv->pause_flags);
+    }
+}
+
+
+void receive_resume(CWS *priv)
+{
+    struct pending *p = &priv->recv.pending;
+
+    if (!(CURLPAUSE_RECV & priv->pause_flags)) {
+        return;
+    }
+
+    priv->pause_flags &= ~CURLPAUSE_RECV;
+    verbose(priv, "[ websocket resume receiving ]\n");
+
+    /* The loop processing the data carries on by itself. */
+    if (priv->recv.receiving) {
+        return;
+    }
+
+    if (p->buf) {
+        char *buf  = p->buf;
+        size_t len = p->len;
+
+        p->buf = NULL;
+        p->len = 0;
+
+        verbose(priv, "< websocket bytes resumed: %zu\n", len);
+        if (!(CLOSE_RECEIVED & priv->close_state)) {
+            _process_buffer(priv, buf, len);
+        }
+        free(buf);
+    }
+
+    /* A callback may have paused again, keeping the rest of the data. */
+    if (!(CURLPAUSE_RECV & priv->pause_flags)) {
+        curl_easy_pause(priv->easy, priv->pause_flags);
+    }
+}
+
+
+void receive_destroy(CWS *priv)
+{
+    if (priv->recv.pending.buf) {
+        free(priv->recv.pending.buf);
+        priv->recv.pending.buf = NULL;
+        priv->recv.pending.len = 0;
+    }
+}
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
@@ -83,6 +155,39 @@ static size_t _receive_cb(const char *buffer, size_t count, size_t nitems, void
         return len;
     }
 
+    /* curl holds on to the data and hands it over again once unpaused. */
+    if (CURLPAUSE_RECV & priv->pause_flags) {
+        verbose(priv, "< websocket bytes refused while paused\n");
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    _process_buffer(priv, buffer, len);
+
+    if (CURLPAUSE_RECV & priv->pause_flags) {
+        curl_easy_pause(priv->easy, priv->pause_flags);
+    }
+
+    /* There is no timer, so use the traffic to release corked frames that
+     * have waited long enough. */
+    send_cork_check(priv);
+
+    verbose(priv, "< websocket bytes processed: %zu\n", (count * nitems));
+    return count * nitems;
+}
+
+
+/**
+ * Processes the frames in a buffer, stopping early if a callback pauses
+ * receiving.
+ *
+ * @param priv   the handle receiving the data
+ * @param buffer the received bytes
+ * @param len    the number of bytes in the buffer
+ */
+static void _process_buffer(CWS *priv, const char *buffer, size_t len)
+{
+    priv->recv.receiving = true;
+
     while (len > 0) {
         size_t prev_len = len;
 
@@ -92,10 +197,44 @@ static size_t _receive_cb(const char *buffer, size_t count, size_t nitems, void
         if ((len == prev_len) || (CLOSE_RECEIVED & priv->close_state)) {
             break;
         }
+
+        if ((0 < len) && (CURLPAUSE_RECV & priv->pause_flags)) {
+            _keep(priv, buffer, len);
+            break;
+        }
     }
 
-    verbose(priv, "< websocket bytes processed: %zu\n", (count * nitems));
-    return count * nitems;
+    /* The messages point into the buffer, so they are delivered before
+     * it is returned. */
+    _flush_messages(priv);
+
+    priv->recv.receiving = false;
+}
+
+
+/**
+ * Keeps a copy of the bytes left in a buffer when receiving was paused.
+ * Without them the stream can't be followed, so the connection is closed if
+ * they can't be kept.
+ *
+ * @param priv   the handle receiving the data
+ * @param buffer the bytes not processed yet
+ * @param len    the number of bytes left
+ */
+static void _keep(CWS *priv, const char *buffer, size_t len)
+{
+    struct pending *p = &priv->recv.pending;
+
+    p->buf = (char *) malloc(len);
+    if (!p->buf) {
+        _error_close(priv, 1011, NULL, 0);
+        return;
+    }
+
+    memcpy(p->buf, buffer, len);
+    p->len = len;
+
+    verbose(priv, "< websocket bytes kept while paused: %zu\n", len);
 }
 
 
@@ -167,33 +306,51 @@ static struct cws_frame *_process_frame_header(CWS *priv, const char **buf, size
     long delta;
     struct cws_frame *frame;
 
-    if (0 == h->needed) {
-        h->needed = WS_FRAME_HEADER_MIN;
-    }
+    frame = &r->_frame;
+    delta = 0;
 
-    min = _min_size_t(h->needed, _len);
+    if (0 == h->used) {
+        /* Nearly always the whole header is in curl's buffer, so decode it
+         * where it is instead of collecting it first. */
+        if (frame_decode(frame, buffer, _len, &delta)) {
+            _error_close(priv, 1002, NULL, 0);
+            return NULL;
+        }
 
-    memcpy(&h->buf[h->used], buffer, min);
-    h->used += min;
-    h->needed -= min;
-    _len -= min;
-    buffer += min;
+        /* The header spans curl buffers, so keep what there is. */
+        if (delta < 0) {
+            memcpy(h->buf, buffer, _len);
+            h->used   = _len;
+            h->needed = 0 - delta;
+            *buf      = buffer + _len;
+            *len      = 0;
+            return NULL;
+        }
 
-    frame = &r->_frame;
+        buffer += delta;
+        _len -= (size_t) delta;
+    } else {
+        min = _min_size_t(h->needed, _len);
 
-    delta = 0;
-    if (frame_decode(frame, h->buf, h->used, &delta)) {
-        _error_close(priv, 1002, NULL, 0);
-        return NULL;
-    }
+        memcpy(&h->buf[h->used], buffer, min);
+        h->used += min;
+        h->needed -= min;
+        _len -= min;
+        buffer += min;
 
-    /* We need more data for a complete header */
-    if (delta < 0) {
-        /* Delta is the number of bytes need * -1 */
-        h->needed = 0 - delta;
-        *buf      = buffer;
-        *len      = _len;
-        return NULL;
+        if (frame_decode(frame, h->buf, h->used, &delta)) {
+            _error_close(priv, 1002, NULL, 0);
+            return NULL;
+        }
+
+        /* We need more data for a complete header */
+        if (delta < 0) {
+            /* Delta is the number of bytes need * -1 */
+            h->needed = 0 - delta;
+            *buf      = buffer;
+            *len      = _len;
+            return NULL;
+        }
     }
 
     if (0 != frame_validate(frame, FRAME_DIR_S2C)) {
@@ -231,10 +388,17 @@ static void _process_control_frame(CWS *priv, const char **buf, size_t *len)
     }
 
     if (r->control.used == r->frame->payload_len) {
+        /* The messages received before the control frame come first. */
+        _flush_messages(priv);
+
         if (WS_OPCODE_PING == r->frame->opcode) {
-            priv->dispatching++;
-            cb_on_ping(priv, r->control.buf, r->control.used);
-            priv->dispatching--;
+            if (_ping_flood(priv)) {
+                _error_close(priv, 1008, "ping rate exceeded", SIZE_MAX);
+            } else {
+                priv->dispatching++;
+                cb_on_ping(priv, r->control.buf, r->control.used);
+                priv->dispatching--;
+            }
             r->frame = NULL;
         } else if (WS_OPCODE_PONG == priv->recv.frame->opcode) {
             priv->dispatching++;
@@ -258,79 +422,22 @@ static void _process_control_frame(CWS *priv, const char **buf, size_t *len)
     *buf = buffer;
 }
 
-static int _process_text_stream(CWS *priv, const char *buf, size_t len,
-                                const char **buf_to_send, size_t *len_to_send)
+static int _process_text_stream(CWS *priv, const char *buf, size_t len)
 {
     struct recv *r = &priv->recv;
 
-    *len_to_send = len;
-    if (0 < r->utf8.needed) {
-        len = _min_size_t(r->utf8.needed, len);
-        memcpy(&r->utf8.buf[r->utf8.used], buf, len);
-        r->utf8.used += len;
-        r->utf8.needed -= len;
-
-        if (0 != r->utf8.needed) {
-            /* Fail as soon as we find a UTF8 sequence that isn't valid vs.
-             * waiting for the entire character.  This makes us autobahn
-             * compliant. */
-            if (false == utf8_maybe_valid(r->utf8.buf, r->utf8.used)) {
-                _error_close(priv, 1007, NULL, 0);
-                return -1;
-            }
-
-            *buf_to_send = NULL;
-            *len_to_send = 0;
-        } else {
-            size_t valid;
-
-            valid = r->utf8.used;
-            if ((0 != utf8_validate(r->utf8.buf, &valid)) || (r->utf8.used != valid))
-            {
-                _error_close(priv, 1007, NULL, 0);
-                return -1;
-            }
-
-            /* Consume the utf8 buffer as well as the characters that came in
-             * this call and get ready for the next block of data. */
-            *buf_to_send = r->utf8.buf;
-            *len_to_send = r->utf8.used;
-            r->utf8.used = 0;
-        }
-    } else {
-        size_t valid;
-
-        valid = len;
-        /* This code block handles the cases where there are no outstanding UTF8
-         * bytes needed to complete a character at the start.  There could be
-         * incomplete UTF8 characters at the end. */
-        if (0 != utf8_validate(*buf_to_send, &valid)) {
-            _error_close(priv, 1007, NULL, 0);
-            return -1;
-        }
-
-        /* Below moves any extra bytes we have that are probably incomplete UTF8
-         * characters into the buffer set aside to deal with that. */
-        if (valid < len) {
-            size_t left = len - valid;
-
-            /* If this is the last buffer of the last frame and we have extra
-             * characters, then we have a problem and must close error out. */
-            if ((r->frame->fin) && (r->frame->payload_len <= len)) {
-                _error_close(priv, 1007, NULL, 0);
-                return -1;
-            }
-
-            memcpy(r->utf8.buf, &buf[valid], left);
-            r->utf8.used = left;
-
-            /* The first byte of a UTF8 character is enough to determine the
-             * length needed for the complete character. */
-            r->utf8.needed = utf8_get_size(r->utf8.buf[0]);
-            r->utf8.needed -= left;
+    /* Fail as soon as a byte can't be part of valid UTF8 vs. waiting for the
+     * entire character.  This makes us autobahn compliant. */
+    if (0 != utf8_stream(&r->utf8, buf, len)) {
+        _error_close(priv, 1007, NULL, 0);
+        return -1;
+    }
 
-            *len_to_send = valid;
-        }
+    /* If this is the last buffer of the last frame, it can't end part way
+     * through a character. */
+    if ((r->frame->fin) && (r->frame->payload_len <= len) && (UTF8_ACCEPT != r->utf8)) {
+        _error_close(priv, 1007, NULL, 0);
+        return -1;
     }
 
     return 0;
@@ -359,7 +466,11 @@ static void _send_data_frame(CWS *priv, const char *buffer, size_t len)
      * as well as it cuts down on sending a bunch of useless empty buffers. */
     if ((0 < len) || ((CWS_FIRST | CWS_LAST) & r->fragment_info)) {
         priv->dispatching++;
-        cb_on_fragment(priv, r->fragment_info, buffer, len);
+        if (_batchable(priv)) {
+            cb_add_message(priv, (CWS_BINARY | CWS_TEXT) & r->fragment_info, buffer, len);
+        } else {
+            cb_on_fragment(priv, r->fragment_info, buffer, len);
+        }
         priv->dispatching--;
     }
 
@@ -391,22 +502,17 @@ static void _send_data_frame(CWS *priv, const char *buffer, size_t len)
  */
 static void _process_data_frame(CWS *priv, const char **buf, size_t *len)
 {
-    struct recv *r          = &priv->recv;
-    const char *buf_to_send = *buf;
-    size_t min              = _min_size_t(r->frame->payload_len, *len);
-    size_t len_to_send      = min;
+    struct recv *r = &priv->recv;
+    size_t min     = _min_size_t(r->frame->payload_len, *len);
 
     if (CWS_TEXT == r->stream_type) {
-        int rv;
-
-        rv = _process_text_stream(priv, *buf, min, &buf_to_send, &len_to_send);
-        if (rv < 0) {
+        if (_process_text_stream(priv, *buf, min) < 0) {
             return;
         }
     }
     r->frame->payload_len -= min;
 
-    _send_data_frame(priv, buf_to_send, len_to_send);
+    _send_data_frame(priv, *buf, min);
 
     *buf += min;
     *len -= min;
@@ -430,6 +536,7 @@ static void _cws_process_frame(CWS *priv, const char **buffer, size_t *len)
             } else if ((0 == r->fragment_info) && (WS_OPCODE_TEXT == frame->opcode)) {
                 r->stream_type   = CWS_TEXT;
                 r->fragment_info = CWS_FIRST | CWS_TEXT;
+                r->utf8          = UTF8_ACCEPT;
             } else if ((0 != r->stream_type) && (WS_OPCODE_CONTINUATION == frame->opcode)) {
                 r->fragment_info &= ~CWS_NONCTRL_MASK;
                 r->fragment_info |= CWS_CONT;
@@ -437,6 +544,10 @@ static void _cws_process_frame(CWS *priv, const char **buffer, size_t *len)
                 _error_close(priv, 1002, NULL, 0);
                 return;
             }
+
+            if (_too_big(priv, frame)) {
+                return;
+            }
         }
         priv->recv.frame = frame;
     }
@@ -472,6 +583,94 @@ static void _error_close(CWS *priv, int code, const char *reason, size_t len)
 }
 
 
+/**
+ * Tells if the data about to be dispatched is a whole message that can go
+ * straight to (*on_messages) without passing through (*on_fragment).
+ *
+ * @param priv the handle receiving the data
+ *
+ * @return true if the message can be added to the batch
+ */
+static bool _batchable(CWS *priv)
+{
+    int one_frame = (CWS_FIRST | CWS_LAST);
+
+    return (one_frame == (one_frame & priv->recv.fragment_info)) && priv->cb.on_messages_fn
+           && !priv->cb.get_buffer_fn;
+}
+
+
+/**
+ * Delivers the messages waiting for (*on_messages), if any.
+ *
+ * @param priv the handle receiving the data
+ */
+static void _flush_messages(CWS *priv)
+{
+    if (0 < priv->recv.batch.count) {
+        priv->dispatching++;
+        cb_on_messages(priv);
+        priv->dispatching--;
+    }
+}
+
+
+/**
+ * Adds a data frame to the size of the message it is part of and closes the
+ * connection with 1009 if that makes the message larger than allowed.
+ *
+ * @param priv  the handle receiving the frame
+ * @param frame the data frame header just decoded
+ *
+ * @return true if the message is too big and the connection was closed
+ */
+static bool _too_big(CWS *priv, const struct cws_frame *frame)
+{
+    struct recv *r = &priv->recv;
+    size_t max     = priv->cfg.max_message_size;
+
+    if (WS_OPCODE_CONTINUATION != frame->opcode) {
+        r->msg_len = 0;
+    }
+
+    if (max && (max - r->msg_len < frame->payload_len)) {
+        _error_close(priv, 1009, NULL, 0);
+        return true;
+    }
+    r->msg_len += frame->payload_len;
+
+    return false;
+}
+
+
+/**
+ * Counts a PING against the configured rate limit.
+ *
+ * @param priv the curlws object of reference
+ *
+ * @return true if the server has sent too many PINGs, false otherwise
+ */
+static bool _ping_flood(CWS *priv)
+{
+    struct ping_window *w = &priv->recv.pings;
+    uint64_t now;
+
+    if (!priv->cfg.max_ping_rate) {
+        return false;
+    }
+
+    now = cws_now_usec();
+    if ((0 == w->count) || (1000000 <= now - w->start)) {
+        w->start = now;
+        w->count = 0;
+    }
+
+    w->count++;
+
+    return (priv->cfg.max_ping_rate < w->count);
+}
+
+
 static inline size_t _min_size_t(size_t a, size_t b)
 {
     return (a < b) ? a : b;
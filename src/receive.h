@@ -18,4 +18,34 @@
  */
 CURLcode receive_init(CWS *priv);
 
+
+/**
+ * Stops delivering received data until receive_resume() is called.  curl
+ * stops reading from the socket, so TCP flow control eventually holds the
+ * server back.
+ *
+ * @note If called from a callback while a buffer from curl is being
+ *       processed, the rest of that buffer is kept until resuming.
+ *
+ * @param priv the curlws object to pause
+ */
+void receive_pause(CWS *priv);
+
+
+/**
+ * Delivers the data kept when receiving was paused and lets curl read from
+ * the socket again.
+ *
+ * @param priv the curlws object to resume
+ */
+void receive_resume(CWS *priv);
+
+
+/**
+ * Frees the data kept while receiving was paused.
+ *
+ * @param priv the curlws object being destroyed
+ */
+void receive_destroy(CWS *priv);
+
 #endif
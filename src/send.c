@@ -13,9 +13,14 @@
 
 #include <curl/curl.h>
 
+#include "broadcast.h"
+#include "cb.h"
 #include "frame.h"
 #include "internal.h"
+#include "mask.h"
+#include "random.h"
 #include "send.h"
+#include "utils.h"
 #include "verbose.h"
 
 /*----------------------------------------------------------------------------*/
@@ -32,11 +37,51 @@
 /*                            File Scoped Variables                           */
 /*----------------------------------------------------------------------------*/
 struct cws_buf_queue {
-    struct cws_buf_queue *prev;
     struct cws_buf_queue *next;
+    int class_idx;
     bool is_close_frame;
-    size_t len;
-    size_t written;
+    bool is_pong;
+    bool is_data_frame;
+    bool fin;
+
+    /* Set on the last frame of a cws_send_ref() message. */
+    bool has_tag;
+    void *tag;
+
+    /* Set on the last frame of a cws_send_prepared() message. */
+    struct cws_prepared *prepared;
+
+    /* The message handle (0 if none) and the time after which the message
+     * is dropped instead of started (0 if never), the same for each frame
+     * of the message. */
+    uint64_t msg_id;
+    uint64_t deadline;
+
+    /* The conflation key of the message (0 if none). */
+    uint64_t key;
+
+    /* Set for the queue entry of a cws_send_producer() message, which stays
+     * at the head of its class and makes a frame each time one is needed. */
+    bool is_producer;
+    bool started;
+    int opcode;
+    struct cws_producer producer;
+
+    /* The header is kept apart from the payload so the payload can be masked
+     * as it is copied into the buffer curl provides. */
+    size_t header_len;
+    uint8_t header[WS_FRAME_HEADER_MAX];
+    uint8_t masking_key[4];
+
+    /* Points to buffer (below) or to memory that outlives the frame. */
+    const uint8_t *payload;
+    size_t payload_len;
+
+    /* The payload bytes after payload_len left for later frames when the
+     * frame is cut to keep control frames from waiting behind it. */
+    size_t rest;
+
+    /* The number of header and payload bytes sent so far. */
     size_t sent;
     uint8_t buffer[];
 };
@@ -45,6 +90,24 @@ struct cws_buf_queue {
 /*                             Function Prototypes                            */
 /*----------------------------------------------------------------------------*/
 static size_t _send_cb(char *, size_t, size_t, void *);
+static int _get_class(const struct cws_frame *);
+static void _enqueue(struct send *, struct cws_buf_queue *, bool);
+static struct cws_buf_queue *_dequeue(CWS *);
+static struct cws_buf_queue *_next_frame(CWS *);
+static size_t _copy_out(struct cws_buf_queue *, uint8_t *, size_t);
+static int _get_prio_class(int);
+static void _release(CWS *, struct cws_buf_queue *, CWScode);
+static void _gather(uint8_t *, const struct cws_iov *, size_t, size_t);
+static void _wake(CWS *);
+static bool _has_pending(const struct send *);
+static bool _is_held(CWS *);
+static void _check_drained(CWS *);
+static void _drop_msg(CWS *, struct send_queue *, struct cws_buf_queue *, CWScode);
+static void _conflate(CWS *);
+static bool _produce(CWS *, struct send_queue *, struct cws_buf_queue **);
+static bool _coalesce_pong(CWS *, const struct cws_frame *);
+static void _cut(CWS *, struct cws_buf_queue *, size_t);
+static void _requeue_rest(CWS *, struct cws_buf_queue *);
 
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
@@ -63,12 +126,31 @@ CURLcode send_init(CWS *priv)
 
 void send_destroy(CWS *priv)
 {
-    while (priv->send) {
-        struct cws_buf_queue *tmp;
+    struct send q = priv->send;
+    struct cws_buf_queue *tmp;
+
+    /* Detach the queues first since releasing a frame may call the user.
+     * The batch & cork state and statistics outlive the queues. */
+    memset(&priv->send, 0, sizeof(struct send));
+    priv->send.batch       = q.batch;
+    priv->send.cork        = q.cork;
+    priv->send.stats       = q.stats;
+    priv->send.last_msg_id = q.last_msg_id;
+
+    if (q.active) {
+        _release(priv, q.active, CWSE_CLOSED_CONNECTION);
+    }
+
+    if (q.close) {
+        _release(priv, q.close, CWSE_CLOSED_CONNECTION);
+    }
 
-        tmp = priv->send->next;
-        mem_free(priv->send);
-        priv->send = tmp;
+    for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+        while (q.q[i].head) {
+            tmp = q.q[i].head->next;
+            _release(priv, q.q[i].head, CWSE_CLOSED_CONNECTION);
+            q.q[i].head = tmp;
+        }
     }
 }
 
@@ -83,13 +165,24 @@ CWScode send_frame(CWS *priv, const struct cws_frame *f)
 {
     struct cws_buf_queue *buf;
     size_t buffer_size;
+    bool is_ref = f->is_ref && f->payload && !f->iov;
 
-    if (f->is_control) {
+    if ((WS_OPCODE_PONG == f->opcode) && _coalesce_pong(priv, f)) {
+        return CWSE_OK;
+    }
+
+    /* Referenced payloads only need room for the header.  Gathered payloads
+     * are always copied. */
+    if (f->is_control || is_ref) {
         buf         = (struct cws_buf_queue *) mem_alloc_ctrl(priv->mem);
-        buffer_size = WS_CTL_FRAME_MAX;
+        buffer_size = WS_CTL_PAYLOAD_MAX;
     } else {
-        buf         = (struct cws_buf_queue *) mem_alloc_data(priv->mem);
-        buffer_size = priv->cfg.max_payload_size + WS_FRAME_HEADER_MAX;
+        buffer_size = priv->cfg.max_payload_size;
+        if (buffer_size < (size_t) f->payload_len) {
+            return CWSE_APP_DATA_LENGTH_TOO_LONG;
+        }
+        buf = (struct cws_buf_queue *) mem_alloc_data(priv->mem,
+                                                      send_get_memory_needed((size_t) f->payload_len));
     }
 
     if (!buf) {
@@ -97,56 +190,295 @@ CWScode send_frame(CWS *priv, const struct cws_frame *f)
     }
 
     memset(buf, 0, sizeof(struct cws_buf_queue));
-    buf->len = buffer_size;
 
-    buf->written = frame_encode(f, buf->buffer, buffer_size);
+    buf->header_len  = frame_encode_header(f, buf->header, sizeof(buf->header));
+    buf->payload_len = (size_t) f->payload_len;
+    memcpy(buf->masking_key, f->masking_key, sizeof(buf->masking_key));
+
+    if (is_ref) {
+        buf->payload = (const uint8_t *) f->payload;
+    } else {
+        /* The caller's buffer is gone after this call, so it must be copied,
+         * but the masking waits until the bytes are handed to curl. */
+        if (buffer_size < buf->payload_len) {
+            mem_free(buf);
+            return CWSE_APP_DATA_LENGTH_TOO_LONG;
+        }
+        if (f->iov) {
+            _gather(buf->buffer, f->iov, f->iov_skip, buf->payload_len);
+        } else if (buf->payload_len) {
+            memcpy(buf->buffer, f->payload, buf->payload_len);
+        }
+        buf->payload = buf->buffer;
+    }
+
+    buf->class_idx     = _get_class(f);
+    buf->is_data_frame = !f->is_control;
+    buf->fin           = f->fin;
+
+    if (priv->send.mark.open && buf->is_data_frame) {
+        buf->msg_id   = priv->send.mark.msg_id;
+        buf->deadline = priv->send.mark.deadline;
+        buf->key      = priv->send.mark.key;
+    }
+
+    priv->send.stats.queued_frames++;
+    priv->send.stats.queued_bytes += buf->header_len + buf->payload_len;
+    if (priv->cfg.send_high_watermark
+        && (priv->cfg.send_high_watermark <= priv->send.stats.queued_bytes))
+    {
+        priv->send.above_high = true;
+    }
 
     /* We need to handle closes specially, so mark the packet. */
     if (WS_OPCODE_CLOSE == f->opcode) {
         buf->is_close_frame = true;
     }
+    buf->is_pong = (WS_OPCODE_PONG == f->opcode);
 
     /* Queue the buffer and start sending if not already. */
-    if (NULL == priv->send) {
-        priv->send = buf;
+    if (buf->is_close_frame && !f->is_urgent) {
+        priv->send.close = buf;
     } else {
-        struct cws_buf_queue *qP = priv->send;
-
-        if (f->is_urgent) {
-            if (0 < qP->sent) {
-                /* This frame is partially sent.  Add the urgent frame next. */
-                buf->next = qP->next;
-                buf->prev = qP;
-                qP->next  = buf;
-            } else {
-                /* Nothing sent.  Insert the urgent frame before the next frame. */
-                priv->send = buf;
-                buf->next  = qP;
-                qP->prev   = buf;
-            }
-        } else {
-            while (qP->next) {
-                qP = qP->next;
-            }
-            buf->prev = qP;
-            qP->next  = buf;
-        }
+        _enqueue(&priv->send, buf, f->is_urgent);
+    }
+
+    /* Closing the connection flushes everything, otherwise the first frame
+     * held by the cork starts the clock. */
+    if (buf->is_close_frame) {
+        priv->send.cork.on = false;
+    } else if (priv->send.cork.on && priv->send.cork.max_usec && !priv->send.cork.deadline) {
+        priv->send.cork.deadline = cws_now_usec() + priv->send.cork.max_usec;
     }
 
     verbose(priv, "[ websocket frame queued opcode: %s payload len: %zd ]\n",
             frame_opcode_to_string(f), f->payload_len);
 
     /* Start the sending process from curl */
-    if (priv->pause_flags & CURLPAUSE_SEND) {
+    _wake(priv);
+
+    return CWSE_OK;
+}
+
+
+CWScode send_producer(CWS *priv, int type, int priority, const struct cws_producer *producer)
+{
+    struct cws_buf_queue *buf;
+
+    buf = (struct cws_buf_queue *) mem_alloc_ctrl(priv->mem);
+    if (!buf) {
+        return CWSE_OUT_OF_MEMORY;
+    }
+
+    memset(buf, 0, sizeof(struct cws_buf_queue));
+
+    buf->is_producer = true;
+    buf->producer    = *producer;
+    buf->opcode      = (CWS_TEXT == type) ? WS_OPCODE_TEXT : WS_OPCODE_BINARY;
+    buf->class_idx   = _get_prio_class(priority);
+
+    if (priv->send.mark.open) {
+        buf->msg_id   = priv->send.mark.msg_id;
+        buf->deadline = priv->send.mark.deadline;
+        buf->key      = priv->send.mark.key;
+    }
+
+    priv->send.stats.queued_frames++;
+    _enqueue(&priv->send, buf, false);
+
+    verbose(priv, "[ websocket producer queued ]\n");
+
+    _wake(priv);
+
+    return CWSE_OK;
+}
+
+
+void send_producer_ready(CWS *priv)
+{
+    _wake(priv);
+}
+
 
-        priv->pause_flags &= ~CURLPAUSE_SEND;
-        curl_easy_pause(priv->easy, priv->pause_flags);
+void send_batch_begin(CWS *priv)
+{
+    priv->send.batch.depth++;
+}
+
+
+CWScode send_batch_commit(CWS *priv)
+{
+    struct send_batch *b = &priv->send.batch;
+
+    if (b->depth < 1) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
 
-        verbose(priv, "[ websocket unpause sending ]\n");
+    b->depth--;
+    if ((0 == b->depth) && (0 < b->deferred)) {
+        priv->send.stats.unpauses_saved += b->deferred - 1;
+        b->deferred = 0;
+        _wake(priv);
     }
+
     return CWSE_OK;
 }
 
+
+bool send_is_full(CWS *priv)
+{
+    return priv->send.above_high;
+}
+
+
+void send_get_stats(CWS *priv, struct cws_send_stats *stats)
+{
+    *stats = priv->send.stats;
+}
+
+
+void send_cork(CWS *priv, uint32_t max_usec)
+{
+    struct send_cork *c = &priv->send.cork;
+
+    c->on       = true;
+    c->open     = false;
+    c->max_usec = max_usec;
+    c->deadline = 0;
+
+    if (max_usec && _has_pending(&priv->send)) {
+        c->deadline = cws_now_usec() + max_usec;
+    }
+}
+
+
+void send_uncork(CWS *priv)
+{
+    memset(&priv->send.cork, 0, sizeof(struct send_cork));
+
+    if (_has_pending(&priv->send)) {
+        _wake(priv);
+    }
+}
+
+
+void send_cork_check(CWS *priv)
+{
+    if (priv->send.cork.on && (0 == priv->send.batch.depth) && _has_pending(&priv->send)) {
+        _wake(priv);
+    }
+}
+
+
+uint64_t send_msg_begin(CWS *priv, int priority, uint32_t ttl_usec, uint64_t key)
+{
+    struct send *q = &priv->send;
+
+    q->mark.open      = true;
+    q->mark.class_idx = _get_prio_class(priority);
+    q->mark.tail      = q->q[q->mark.class_idx].tail;
+    q->mark.msg_id    = ++q->last_msg_id;
+    q->mark.deadline  = 0;
+    q->mark.key       = key;
+
+    if (ttl_usec) {
+        q->mark.deadline = cws_now_usec() + ttl_usec;
+    }
+
+    return q->mark.msg_id;
+}
+
+
+void send_msg_commit(CWS *priv, bool has_tag, void *tag)
+{
+    struct send *q            = &priv->send;
+    struct cws_buf_queue *fin = q->q[q->mark.class_idx].tail;
+
+    if (has_tag && fin && (fin != q->mark.tail)) {
+        fin->has_tag = true;
+        fin->tag     = tag;
+    }
+
+    _conflate(priv);
+
+    q->mark.open = false;
+    q->mark.tail = NULL;
+}
+
+
+void send_msg_hold(CWS *priv, struct cws_prepared *msg)
+{
+    struct send *q            = &priv->send;
+    struct cws_buf_queue *fin = q->q[q->mark.class_idx].tail;
+
+    if (fin && (fin != q->mark.tail)) {
+        prepared_ref(msg);
+        fin->prepared = msg;
+    }
+}
+
+
+CWScode send_msg_cancel(CWS *priv, uint64_t msg_id)
+{
+    struct send *q = &priv->send;
+
+    /* Frames without a handle have an id of 0. */
+    if (0 == msg_id) {
+        return CWSE_MSG_NOT_QUEUED;
+    }
+
+    for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+        struct send_queue *c       = &q->q[i];
+        struct cws_buf_queue *prev = NULL;
+
+        for (struct cws_buf_queue *buf = c->head; buf; buf = buf->next) {
+            if (msg_id == buf->msg_id) {
+                /* The rest of a started message must still be sent. */
+                if (q->data_in_progress && (q->started_msg_id == msg_id)) {
+                    return CWSE_MSG_NOT_QUEUED;
+                }
+
+                q->stats.msgs_cancelled++;
+                _drop_msg(priv, c, prev, CWSE_MSG_DROPPED);
+                return CWSE_OK;
+            }
+            prev = buf;
+        }
+    }
+
+    return CWSE_MSG_NOT_QUEUED;
+}
+
+
+void send_msg_abort(CWS *priv)
+{
+    struct send *q       = &priv->send;
+    struct send_queue *c = &q->q[q->mark.class_idx];
+    struct cws_buf_queue *buf;
+
+    /* Nothing can be sent while the message is being queued, so all of its
+     * frames are still after the mark. */
+    if (q->mark.tail) {
+        buf                = q->mark.tail->next;
+        q->mark.tail->next = NULL;
+        c->tail            = q->mark.tail;
+    } else {
+        buf     = c->head;
+        c->head = NULL;
+        c->tail = NULL;
+    }
+
+    /* The frames are not tagged yet, so nobody is told. */
+    while (buf) {
+        struct cws_buf_queue *tmp = buf->next;
+        _release(priv, buf, CWSE_OK);
+        buf = tmp;
+    }
+
+    q->mark.open = false;
+    q->mark.tail = NULL;
+}
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
@@ -163,50 +495,47 @@ CWScode send_frame(CWS *priv, const struct cws_frame *f)
  */
 static size_t _fill_outgoing_buffer(CWS *priv, char *buffer, size_t len)
 {
-    size_t data_to_send;
+    struct cws_buf_queue *buf;
     size_t sent = 0;
 
-    data_to_send = priv->send->written - priv->send->sent;
-
     /* Fill up the buffer with whatever frames we have queued. */
-    while ((0 < len) && (0 < data_to_send)) {
-        const uint8_t *p;
-        size_t lesser = len;
-        p             = &priv->send->buffer[priv->send->sent];
+    while ((0 < len) && (NULL != (buf = _next_frame(priv)))) {
+        size_t lesser;
 
-        if (data_to_send < lesser) {
-            lesser = data_to_send;
+        if (buf->is_data_frame && !buf->sent && !buf->rest) {
+            _cut(priv, buf, len);
         }
-        memcpy(buffer, p, lesser);
+
+        lesser = _copy_out(buf, (uint8_t *) buffer, len);
 
         buffer += lesser;
         sent += lesser;
         len -= lesser;
-        data_to_send -= lesser;
-        priv->send->sent += lesser;
+        priv->send.stats.queued_bytes -= lesser;
 
         /* If we've sent a buffer, recycle it. */
-        if (priv->send->sent == priv->send->written) {
-            struct cws_buf_queue *tmp = priv->send;
-            bool is_close             = tmp->is_close_frame;
-
-            priv->send = priv->send->next;
-            if (priv->send) {
-                priv->send->prev = NULL;
-                data_to_send += priv->send->written;
+        if (buf->sent == buf->header_len + buf->payload_len) {
+            bool is_close = buf->is_close_frame;
+
+            priv->send.active = NULL;
+            if (buf->rest) {
+                _requeue_rest(priv, buf);
+                continue;
             }
-            mem_free(tmp);
+            _release(priv, buf, CWSE_OK);
 
             /* Don't send any more data after we send a close frame. */
             if (is_close) {
                 priv->close_state |= CLOSE_SENT;
                 verbose_close(priv);
-                data_to_send = 0;
                 send_destroy(priv);
+                return sent;
             }
         }
     }
 
+    _check_drained(priv);
+
     return sent;
 }
 
@@ -232,7 +561,19 @@ static size_t _send_cb(char *buffer, size_t count, size_t n, void *data)
         return len;
     }
 
-    if (NULL == priv->send) {
+    if (_is_held(priv)) {
+        priv->pause_flags |= CURLPAUSE_SEND;
+
+        verbose(priv, "> websocket sending corked\n");
+
+        return CURL_READFUNC_PAUSE;
+    }
+
+    if (NULL == _next_frame(priv)) {
+        /* Everything held by the cork has been sent. */
+        priv->send.cork.open     = false;
+        priv->send.cork.deadline = 0;
+
         /* When the connection is closed, we should return 0 to tell curl to
          * shut down the connection. */
         if (READY_TO_CLOSE(priv->close_state)) {
@@ -255,3 +596,674 @@ static size_t _send_cb(char *buffer, size_t count, size_t n, void *data)
 
     return sent;
 }
+
+
+/**
+ * Determines which class queue a frame belongs in.
+ *
+ * @param f the frame to inspect
+ *
+ * @return the class of the frame
+ */
+static int _get_class(const struct cws_frame *f)
+{
+    if (f->is_control) {
+        return SEND_CLASS_CONTROL;
+    }
+
+    return _get_prio_class(f->priority);
+}
+
+
+/**
+ * Determines which class queue a data frame priority maps to.
+ *
+ * @param priority the CWS_PRIO_* value of the frame
+ *
+ * @return the class of the frame
+ */
+static int _get_prio_class(int priority)
+{
+    switch (priority) {
+        case CWS_PRIO_HIGH:
+            return SEND_CLASS_HIGH;
+        case CWS_PRIO_BULK:
+            return SEND_CLASS_BULK;
+        default:
+            break;
+    }
+
+    return SEND_CLASS_NORMAL;
+}
+
+
+/**
+ * Adds a buffer to the queue for its class.
+ *
+ * @param q      the send queues to add to
+ * @param buf    the buffer to add
+ * @param urgent if the buffer goes to the front of the class instead of the
+ *               end of the class
+ */
+static void _enqueue(struct send *q, struct cws_buf_queue *buf, bool urgent)
+{
+    struct send_queue *c = &q->q[buf->class_idx];
+
+    if (NULL == c->head) {
+        c->head = buf;
+        c->tail = buf;
+    } else if (urgent) {
+        buf->next = c->head;
+        c->head   = buf;
+    } else {
+        c->tail->next = buf;
+        c->tail       = buf;
+    }
+}
+
+
+/**
+ * Removes the next frame that may be sent from the class queues.
+ *
+ * @note Control frames may be sent between fragments, but once a data message
+ *       has been started, only that class may provide data frames until the
+ *       message is complete.
+ *
+ * @note Messages past their deadline are dropped here, before they start.
+ *
+ * @param priv the curlws object of reference
+ *
+ * @return the frame to send or NULL if there is nothing that may be sent
+ */
+static struct cws_buf_queue *_dequeue(CWS *priv)
+{
+    struct send *q            = &priv->send;
+    struct cws_buf_queue *buf = NULL;
+    uint64_t now              = 0;
+
+    for (int i = 0; (NULL == buf) && (i < SEND_CLASS_COUNT); i++) {
+        struct send_queue *c = &q->q[i];
+
+        if ((SEND_CLASS_CONTROL != i) && q->data_in_progress && (q->data_class != i)) {
+            continue;
+        }
+
+        while (!q->data_in_progress && c->head && c->head->deadline) {
+            if (0 == now) {
+                now = cws_now_usec();
+            }
+            if (now < c->head->deadline) {
+                break;
+            }
+            q->stats.msgs_expired++;
+            _drop_msg(priv, c, NULL, CWSE_MSG_DROPPED);
+        }
+
+        if (c->head && c->head->is_producer) {
+            if (!_produce(priv, c, &buf)) {
+                /* The producer gave up, which changed the queues. */
+                return _dequeue(priv);
+            }
+            continue;
+        }
+
+        buf = c->head;
+        if (buf) {
+            c->head = buf->next;
+            if (NULL == c->head) {
+                c->tail = NULL;
+            }
+            buf->next = NULL;
+        }
+    }
+
+    if (buf) {
+        if (buf->is_data_frame) {
+            q->data_in_progress = !buf->fin;
+            q->data_class       = buf->class_idx;
+            q->started_msg_id   = (buf->fin) ? 0 : buf->msg_id;
+        }
+    } else {
+        /* Messages waiting behind one that is still being streamed must be
+         * sent before the close frame. */
+        for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+            if (q->q[i].head) {
+                return NULL;
+            }
+        }
+
+        /* Nothing else is queued, so it's time for the close frame. */
+        buf      = q->close;
+        q->close = NULL;
+    }
+
+    return buf;
+}
+
+
+/**
+ * Returns the frame being sent, starting the next frame if needed.
+ *
+ * @param priv the curlws object of reference
+ *
+ * @return the frame to send or NULL if there is nothing that may be sent
+ */
+static struct cws_buf_queue *_next_frame(CWS *priv)
+{
+    if (NULL == priv->send.active) {
+        priv->send.active = _dequeue(priv);
+    }
+
+    return priv->send.active;
+}
+
+
+/**
+ * Copies as much of the frame as fits into the outgoing buffer, masking the
+ * payload on the way.
+ *
+ * @param buf the frame to send
+ * @param out the buffer to fill
+ * @param len the number of bytes available in the buffer
+ *
+ * @return the number of bytes written into the buffer
+ */
+static size_t _copy_out(struct cws_buf_queue *buf, uint8_t *out, size_t len)
+{
+    size_t total = 0;
+
+    if (buf->sent < buf->header_len) {
+        size_t lesser = buf->header_len - buf->sent;
+
+        if (len < lesser) {
+            lesser = len;
+        }
+        memcpy(out, &buf->header[buf->sent], lesser);
+
+        out += lesser;
+        len -= lesser;
+        total += lesser;
+        buf->sent += lesser;
+    }
+
+    if (buf->header_len <= buf->sent) {
+        size_t offset = buf->sent - buf->header_len;
+        size_t lesser = buf->payload_len - offset;
+
+        if (len < lesser) {
+            lesser = len;
+        }
+        mask_copy(out, &buf->payload[offset], lesser, buf->masking_key, offset);
+
+        total += lesser;
+        buf->sent += lesser;
+    }
+
+    return total;
+}
+
+
+/**
+ * Frees a frame, first telling the user the payload is no longer referenced
+ * if it is the end of a cws_send_ref() message.
+ *
+ * @param priv   the curlws object of reference
+ * @param buf    the frame to free
+ * @param status the status to report
+ */
+static void _release(CWS *priv, struct cws_buf_queue *buf, CWScode status)
+{
+    bool has_tag                  = buf->has_tag;
+    void *tag                     = buf->tag;
+    bool is_prod                  = buf->is_producer;
+    struct cws_producer producer  = buf->producer;
+    struct cws_prepared *prepared = buf->prepared;
+
+    priv->send.stats.queued_frames--;
+    priv->send.stats.queued_bytes -= buf->header_len + buf->payload_len + buf->rest - buf->sent;
+
+    mem_free(buf);
+
+    if (prepared) {
+        prepared_unref(prepared);
+    }
+
+    /* The callback may try to destroy the handle while curl is still in
+     * the middle of using it. */
+    if (has_tag) {
+        priv->dispatching++;
+        cb_on_sent(priv, tag, status);
+        priv->dispatching--;
+    }
+
+    if (is_prod && producer.done) {
+        priv->dispatching++;
+        producer.done(producer.user, priv, status);
+        priv->dispatching--;
+    }
+}
+
+
+/**
+ * Copies len bytes from the segments into a single buffer.
+ *
+ * @param dst  the buffer to fill
+ * @param iov  the segments to copy from
+ * @param skip the number of bytes of the first segment to skip
+ * @param len  the number of bytes to copy
+ */
+static void _gather(uint8_t *dst, const struct cws_iov *iov, size_t skip, size_t len)
+{
+    while (len) {
+        size_t lesser = iov->len - skip;
+
+        if (len < lesser) {
+            lesser = len;
+        }
+        if (lesser) {
+            memcpy(dst, &((const uint8_t *) iov->base)[skip], lesser);
+        }
+
+        dst += lesser;
+        len -= lesser;
+        skip = 0;
+        iov++;
+    }
+}
+
+
+/**
+ * Wakes up curl if it is waiting for data to send, unless a batch is open or
+ * the frames are held by the cork.
+ *
+ * @param priv the curlws object of reference
+ */
+static void _wake(CWS *priv)
+{
+    if (!(priv->pause_flags & CURLPAUSE_SEND) || _is_held(priv)) {
+        return;
+    }
+
+    if (0 < priv->send.batch.depth) {
+        priv->send.batch.deferred++;
+        return;
+    }
+
+    priv->pause_flags &= ~CURLPAUSE_SEND;
+    priv->send.stats.unpauses++;
+    curl_easy_pause(priv->easy, priv->pause_flags);
+
+    verbose(priv, "[ websocket unpause sending ]\n");
+}
+
+
+/**
+ * Determines if there are any frames left to send.
+ *
+ * @param q the send queues to inspect
+ *
+ * @return true if there are frames to send, false otherwise
+ */
+static bool _has_pending(const struct send *q)
+{
+    if (q->active || q->close) {
+        return true;
+    }
+
+    for (int i = 0; i < SEND_CLASS_COUNT; i++) {
+        if (q->q[i].head) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Determines if the cork is holding back the queued frames, releasing them
+ * if they have waited long enough.
+ *
+ * @param priv the curlws object of reference
+ *
+ * @return true if the frames must not be sent yet, false otherwise
+ */
+static bool _is_held(CWS *priv)
+{
+    struct send_cork *c = &priv->send.cork;
+
+    if (!c->on || c->open) {
+        return false;
+    }
+
+    if (c->deadline && (c->deadline <= cws_now_usec())) {
+        c->open = true;
+        verbose(priv, "[ websocket cork deadline reached ]\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Tells the user once the queue has drained to the low watermark after
+ * reaching the high watermark.
+ *
+ * @param priv the curlws object of reference
+ */
+static void _check_drained(CWS *priv)
+{
+    if (priv->send.above_high && (priv->send.stats.queued_bytes <= priv->cfg.send_low_watermark)) {
+        priv->send.above_high = false;
+        priv->dispatching++;
+        cb_on_drain(priv);
+        priv->dispatching--;
+    }
+}
+
+
+/**
+ * Removes a message that has not started from a class queue and releases
+ * its frames.
+ *
+ * @param priv   the curlws object of reference
+ * @param c      the class queue the message is in
+ * @param prev   the frame before the message, or NULL if it is the head
+ * @param status the status to report for the message
+ */
+static void _drop_msg(CWS *priv, struct send_queue *c, struct cws_buf_queue *prev,
+                      CWScode status)
+{
+    struct cws_buf_queue *first = (prev) ? prev->next : c->head;
+    struct cws_buf_queue *last  = first;
+
+    while (last->next && (first->msg_id == last->next->msg_id)) {
+        last = last->next;
+    }
+
+    /* Unlink the message before anyone is told, so more can be queued. */
+    if (prev) {
+        prev->next = last->next;
+    } else {
+        c->head = last->next;
+    }
+    if (c->tail == last) {
+        c->tail = prev;
+    }
+    last->next = NULL;
+
+    verbose(priv, "[ websocket message %llu dropped ]\n", (unsigned long long) first->msg_id);
+
+    while (first) {
+        struct cws_buf_queue *tmp = first->next;
+        _release(priv, first, status);
+        first = tmp;
+    }
+
+    /* Cancelled, expired and replaced messages can drain the queue while
+     * curl is paused with nothing to send. */
+    _check_drained(priv);
+}
+
+
+/**
+ * Replaces a queued message with the same conflation key as the message just
+ * queued.  The new message takes the place of the old one in the queue so
+ * updates for a key are not delayed by being replaced.  A message that has
+ * started is left alone.
+ *
+ * @param priv the curlws object of reference
+ */
+static void _conflate(CWS *priv)
+{
+    struct send *q              = &priv->send;
+    struct send_queue *c        = &q->q[q->mark.class_idx];
+    struct cws_buf_queue *first = (q->mark.tail) ? q->mark.tail->next : c->head;
+    struct cws_buf_queue *last  = c->tail;
+    struct cws_buf_queue *prev  = NULL;
+    uint64_t started            = 0;
+
+    if (!q->mark.key || !first) {
+        return;
+    }
+
+    if (q->data_in_progress && (q->data_class == q->mark.class_idx)) {
+        started = q->started_msg_id;
+    }
+
+    for (struct cws_buf_queue *buf = c->head; buf != first; buf = buf->next) {
+        if ((q->mark.key == buf->key) && (started != buf->msg_id)) {
+            /* Move the new message in front of the old one, then drop the
+             * old one.  The new one is never the head so the mark is set. */
+            q->mark.tail->next = NULL;
+            c->tail            = q->mark.tail;
+
+            last->next = buf;
+            if (prev) {
+                prev->next = first;
+            } else {
+                c->head = first;
+            }
+
+            q->stats.msgs_conflated++;
+            _drop_msg(priv, c, last, CWSE_MSG_DROPPED);
+            return;
+        }
+        prev = buf;
+    }
+}
+
+
+/**
+ * Makes the next frame of a producer message.  The producer is only asked for
+ * as much as fits in a frame, and only when curl has room for more data.
+ *
+ * @param priv the curlws object of reference
+ * @param c    the class queue with the producer at the head
+ * @param out  set to the new frame, or NULL if the producer has no data ready
+ *
+ * @return false if the producer gave up and was removed, true otherwise
+ */
+static bool _produce(CWS *priv, struct send_queue *c, struct cws_buf_queue **out)
+{
+    struct cws_buf_queue *src = c->head;
+    struct cws_buf_queue *buf;
+    struct cws_frame f = {
+        .mask   = 1,
+        .opcode = (src->started) ? WS_OPCODE_CONTINUATION : src->opcode,
+    };
+    size_t len = priv->cfg.max_payload_size;
+    size_t got = CWS_PRODUCER_ABORT;
+    int eom    = 0;
+
+    *out = NULL;
+
+    buf = (struct cws_buf_queue *) mem_alloc_data(priv->mem, send_get_memory_needed(len));
+    if (buf) {
+        memset(buf, 0, sizeof(struct cws_buf_queue));
+        priv->dispatching++;
+        got = src->producer.read(src->producer.user, priv, buf->buffer, len, &eom);
+        priv->dispatching--;
+    }
+
+    if ((CWS_PRODUCER_ABORT == got) || (len < got)) {
+        bool started = src->started;
+
+        if (buf) {
+            mem_free(buf);
+        }
+
+        c->head = src->next;
+        if (NULL == c->head) {
+            c->tail = NULL;
+        }
+        src->next = NULL;
+
+        verbose(priv, "[ websocket producer aborted ]\n");
+        _release(priv, src, CWSE_MSG_DROPPED);
+
+        /* The peer has part of the message, so the connection is done. */
+        if (started) {
+            cws_close(priv, -1011, NULL, 0);
+        }
+        return false;
+    }
+
+    if (!got && !eom) {
+        mem_free(buf);
+        return true;
+    }
+
+    f.fin         = (eom) ? 1 : 0;
+    f.payload_len = got;
+    cws_random(priv, f.masking_key, 4);
+
+    buf->header_len = frame_encode_header(&f, buf->header, sizeof(buf->header));
+    memcpy(buf->masking_key, f.masking_key, sizeof(buf->masking_key));
+    buf->payload       = buf->buffer;
+    buf->payload_len   = got;
+    buf->class_idx     = src->class_idx;
+    buf->is_data_frame = true;
+    buf->fin           = f.fin;
+    buf->msg_id        = src->msg_id;
+
+    priv->send.stats.queued_frames++;
+    priv->send.stats.queued_bytes += buf->header_len + buf->payload_len;
+
+    src->started = true;
+    if (eom) {
+        c->head = src->next;
+        if (NULL == c->head) {
+            c->tail = NULL;
+        }
+        src->next = NULL;
+        _release(priv, src, CWSE_OK);
+    }
+
+    *out = buf;
+    return true;
+}
+
+
+/**
+ * Replaces a queued PONG that hasn't been sent yet with a newer one.  Only
+ * the reply to the latest PING matters (RFC 6455 section 5.5.3), so a flood
+ * of PINGs costs at most one queued PONG.
+ *
+ * @param priv the curlws object of reference
+ * @param f    the PONG frame to queue
+ *
+ * @return true if the frame replaced a queued PONG, false otherwise
+ */
+static bool _coalesce_pong(CWS *priv, const struct cws_frame *f)
+{
+    struct cws_buf_queue *buf = priv->send.q[SEND_CLASS_CONTROL].head;
+
+    while (buf && !buf->is_pong) {
+        buf = buf->next;
+    }
+
+    if (!buf) {
+        return false;
+    }
+
+    priv->send.stats.queued_bytes -= buf->header_len + buf->payload_len;
+
+    buf->header_len  = frame_encode_header(f, buf->header, sizeof(buf->header));
+    buf->payload_len = (size_t) f->payload_len;
+    memcpy(buf->masking_key, f->masking_key, sizeof(buf->masking_key));
+    if (buf->payload_len) {
+        memcpy(buf->buffer, f->payload, buf->payload_len);
+    }
+
+    priv->send.stats.queued_bytes += buf->header_len + buf->payload_len;
+    priv->send.stats.pongs_coalesced++;
+
+    verbose(priv, "[ websocket queued pong replaced, payload len: %zd ]\n",
+            buf->payload_len);
+
+    return true;
+}
+
+
+/**
+ * Cuts a data frame that is about to start so a control frame queued while
+ * it is being sent waits behind no more than max_control_delay payload
+ * bytes.  A frame's length is fixed once its header is sent, so this is
+ * the only point it can be cut.  Nothing can be queued while curl's buffer
+ * is being filled, so a frame that ends within the buffer is left whole.
+ *
+ * @param priv the curlws object of reference
+ * @param buf  the frame about to be sent
+ * @param room the bytes left in curl's buffer
+ */
+static void _cut(CWS *priv, struct cws_buf_queue *buf, size_t room)
+{
+    size_t cap = priv->cfg.max_control_delay;
+    struct cws_frame f;
+
+    if (!cap) {
+        return;
+    }
+
+    if ((WS_FRAME_HEADER_MAX < room) && (cap < room - WS_FRAME_HEADER_MAX)) {
+        cap = room - WS_FRAME_HEADER_MAX;
+    }
+
+    if (buf->payload_len <= cap) {
+        return;
+    }
+
+    memset(&f, 0, sizeof(f));
+    f.mask        = 1;
+    f.opcode      = buf->header[0] & 0x0f;
+    f.payload_len = cap;
+    cws_random(priv, f.masking_key, 4);
+
+    priv->send.stats.queued_bytes -= buf->header_len;
+
+    buf->rest        = buf->payload_len - cap;
+    buf->payload_len = cap;
+    buf->header_len  = frame_encode_header(&f, buf->header, sizeof(buf->header));
+    memcpy(buf->masking_key, f.masking_key, sizeof(buf->masking_key));
+
+    priv->send.stats.queued_bytes += buf->header_len;
+    priv->send.stats.frames_cut++;
+
+    /* The rest of the frame must come before other data messages. */
+    priv->send.data_in_progress = true;
+    priv->send.data_class       = buf->class_idx;
+    priv->send.started_msg_id   = buf->msg_id;
+}
+
+
+/**
+ * Puts the rest of a cut frame back at the head of its class as a
+ * continuation frame, which is cut again if it is still too large.
+ *
+ * @param priv the curlws object of reference
+ * @param buf  the frame whose first part was just sent
+ */
+static void _requeue_rest(CWS *priv, struct cws_buf_queue *buf)
+{
+    struct cws_frame f;
+
+    memset(&f, 0, sizeof(f));
+    f.fin         = buf->fin;
+    f.mask        = 1;
+    f.opcode      = WS_OPCODE_CONTINUATION;
+    f.payload_len = buf->rest;
+    cws_random(priv, f.masking_key, 4);
+
+    buf->payload += buf->payload_len;
+    buf->payload_len = buf->rest;
+    buf->rest        = 0;
+    buf->sent        = 0;
+    buf->header_len  = frame_encode_header(&f, buf->header, sizeof(buf->header));
+    memcpy(buf->masking_key, f.masking_key, sizeof(buf->masking_key));
+
+    priv->send.stats.queued_bytes += buf->header_len;
+
+    _enqueue(&priv->send, buf, true);
+}
@@ -7,11 +7,13 @@
 #ifndef __SENDING_H__
 #define __SENDING_H__
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <curl/curl.h>
 
+#include "broadcast.h"
 #include "frame.h"
 #include "internal.h"
 
@@ -40,14 +42,169 @@ size_t send_get_memory_needed(size_t payload_size);
 /**
  * Used to send exactly 1 frame of data.
  *
- * @note Sending always requires a mask.
+ * @note Sending always requires a mask.  The payload is masked as it is
+ *       handed to curl, so it is copied (unmasked) into the queue unless the
+ *       frame is marked is_ref, in which case the payload must stay valid
+ *       until the frame is sent or the queue is destroyed.
  *
  * @param priv the curlws object to sent data through
  * @param f    the frame to send
  *
  * @retval CWSE_OK
  * @retval CWSE_OUT_OF_MEMORY
+ * @retval CWSE_APP_DATA_LENGTH_TOO_LONG
  */
 CWScode send_frame(CWS *priv, const struct cws_frame *f);
 
+
+/**
+ * Queues a message whose payload is pulled from the producer one frame at a
+ * time, when curl asks for more data.
+ *
+ * @param priv     the curlws object to operate on
+ * @param type     CWS_BINARY or CWS_TEXT
+ * @param priority the CWS_PRIO_* value the message is queued with
+ * @param producer the source of the payload (copied)
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_OUT_OF_MEMORY
+ */
+CWScode send_producer(CWS *priv, int type, int priority, const struct cws_producer *producer);
+
+
+/**
+ * Wakes curl up to send after a producer had no data ready.
+ *
+ * @param priv the curlws object to operate on
+ */
+void send_producer_ready(CWS *priv);
+
+
+/**
+ * Marks the start of queuing a message that may need to be withdrawn,
+ * tagged or cancelled as a whole.
+ *
+ * @param priv     the curlws object to operate on
+ * @param priority the CWS_PRIO_* value the message is queued with
+ * @param ttl_usec the time the message may wait to start, or 0 for no limit
+ * @param key      the conflation key of the message, or 0 for none
+ *
+ * @return the handle of the message
+ */
+uint64_t send_msg_begin(CWS *priv, int priority, uint32_t ttl_usec, uint64_t key);
+
+
+/**
+ * Finishes a message started by send_msg_begin().  If has_tag is set, the
+ * last frame of the message carries the tag, which is reported via
+ * cb_on_sent() when the frame has been sent or is discarded.  A queued
+ * message with the same conflation key that has not started is replaced by
+ * this one, which takes its place in the queue.
+ *
+ * @param priv    the curlws object to operate on
+ * @param has_tag if the tag should be reported
+ * @param tag     the user value to report
+ */
+void send_msg_commit(CWS *priv, bool has_tag, void *tag);
+
+
+/**
+ * Makes the last frame of the message being queued hold a reference to the
+ * prepared message its payload points to, until the frame is released.
+ *
+ * @param priv the curlws object to operate on
+ * @param msg  the prepared message
+ */
+void send_msg_hold(CWS *priv, struct cws_prepared *msg);
+
+
+/**
+ * Removes a queued message that has not started sending.
+ *
+ * @param priv   the curlws object to operate on
+ * @param msg_id the handle returned by send_msg_begin()
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_MSG_NOT_QUEUED if the message has started, is done or unknown
+ */
+CWScode send_msg_cancel(CWS *priv, uint64_t msg_id);
+
+
+/**
+ * Removes all the frames queued since send_msg_begin() without sending them.
+ *
+ * @param priv the curlws object to operate on
+ */
+void send_msg_abort(CWS *priv);
+
+
+/**
+ * Opens (or nests) a batch.  While a batch is open curl is not woken up when
+ * frames are queued.
+ *
+ * @param priv the curlws object to operate on
+ */
+void send_batch_begin(CWS *priv);
+
+
+/**
+ * Closes a batch.  When the outermost batch is closed curl is woken up once
+ * if it was held back.
+ *
+ * @param priv the curlws object to operate on
+ *
+ * @retval CWSE_OK
+ * @retval CWSE_BAD_FUNCTION_ARGUMENT if no batch is open
+ */
+CWScode send_batch_commit(CWS *priv);
+
+
+/**
+ * Determines if the queued bytes have reached the high watermark and not yet
+ * drained to the low watermark, so no more data should be queued.
+ *
+ * @param priv the curlws object to operate on
+ *
+ * @return true if the queue is full, false otherwise
+ */
+bool send_is_full(CWS *priv);
+
+
+/**
+ * Gets the send statistics.
+ *
+ * @param priv  the curlws object to operate on
+ * @param stats the structure to fill in
+ */
+void send_get_stats(CWS *priv, struct cws_send_stats *stats);
+
+
+/**
+ * Corks the send queue: frames are queued but curl is not given any of them
+ * until send_uncork() is called, a close frame is queued or (if max_usec is
+ * not 0) the first held frame has waited max_usec microseconds.
+ *
+ * @param priv     the curlws object to operate on
+ * @param max_usec the longest a frame is held, or 0 for no limit
+ */
+void send_cork(CWS *priv, uint32_t max_usec);
+
+
+/**
+ * Removes the cork and wakes up curl if there are frames to send.
+ *
+ * @param priv the curlws object to operate on
+ */
+void send_uncork(CWS *priv);
+
+
+/**
+ * Wakes up curl if the frames held by the cork have waited long enough.
+ *
+ * @note There is no timer, so this is called when curl hands over data.
+ *
+ * @param priv the curlws object to operate on
+ */
+void send_cork_check(CWS *priv);
+
 #endif
@@ -0,0 +1,158 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "spill.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define SPILL_TEMPLATE "/curlws-XXXXXX"
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                             Function Prototypes                            */
+/*----------------------------------------------------------------------------*/
+static int _tmpfile(const char *);
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+
+bool spill_open(struct spill *s, const char *dir)
+{
+    int fd = _tmpfile(dir);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    s->open = true;
+    s->fd   = fd;
+    s->len  = 0;
+
+    return true;
+}
+
+
+bool spill_write(struct spill *s, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) data;
+
+    while (0 < len) {
+        ssize_t n = write(s->fd, p, len);
+
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return false;
+        }
+
+        p += n;
+        len -= (size_t) n;
+        s->len += (size_t) n;
+    }
+
+    return true;
+}
+
+
+const void *spill_map(struct spill *s)
+{
+    void *map;
+
+    if (0 == s->len) {
+        return NULL;
+    }
+
+    map = mmap(NULL, s->len, PROT_READ, MAP_PRIVATE, s->fd, 0);
+    if (MAP_FAILED == map) {
+        return NULL;
+    }
+
+    return map;
+}
+
+
+void spill_close(struct spill *s, const void *map)
+{
+    if (!s->open) {
+        return;
+    }
+
+    if (map) {
+        munmap((void *) map, s->len);
+    }
+    close(s->fd);
+
+    s->open = false;
+    s->fd   = -1;
+    s->len  = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+
+
+/**
+ * Creates a temporary file that is removed once it is closed.
+ *
+ * @param dir the directory to create the file in
+ *
+ * @return the file descriptor, or -1 on failure
+ */
+static int _tmpfile(const char *dir)
+{
+    char *path;
+    int fd;
+
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (0 <= fd) {
+        return fd;
+    }
+#endif
+
+    /* Not every file system supports O_TMPFILE, so fall back to a named file
+     * that is unlinked right away. */
+    path = (char *) malloc(strlen(dir) + sizeof(SPILL_TEMPLATE));
+    if (!path) {
+        return -1;
+    }
+    sprintf(path, "%s" SPILL_TEMPLATE, dir);
+
+    fd = mkostemp(path, O_CLOEXEC);
+    if (0 <= fd) {
+        unlink(path);
+    }
+    free(path);
+
+    return fd;
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A received message being reassembled in a temporary file instead of in
+ * memory. */
+struct spill {
+    bool open;
+    int fd;
+
+    /* The number of bytes written to the file. */
+    size_t len;
+};
+
+
+/**
+ * Creates an anonymous temporary file to reassemble a message in.  The file
+ * has no name, so it is removed once it is closed.
+ *
+ * @param s   the spill to open
+ * @param dir the directory to create the file in
+ *
+ * @return true if the file was created, false otherwise
+ */
+bool spill_open(struct spill *s, const char *dir);
+
+
+/**
+ * Appends bytes to the file.
+ *
+ * @param s    the open spill
+ * @param data the bytes to append
+ * @param len  the number of bytes
+ *
+ * @return true if all the bytes were written, false otherwise
+ */
+bool spill_write(struct spill *s, const void *data, size_t len);
+
+
+/**
+ * Maps the whole file read-only.
+ *
+ * @param s the open spill
+ *
+ * @return the mapping, or NULL if the file is empty or can't be mapped
+ */
+const void *spill_map(struct spill *s);
+
+
+/**
+ * Unmaps the file (if it was mapped) and closes it.  Closing a spill that
+ * isn't open does nothing.
+ *
+ * @param s   the spill to close
+ * @param map the mapping returned by spill_map() or NULL
+ */
+void spill_close(struct spill *s, const void *map);
+
+#endif
@@ -7,17 +7,44 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "kernel.h"
 #include "utf8.h"
 
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
 /*----------------------------------------------------------------------------*/
-/* none */
+
+/* Like the masking kernels, the SIMD validators are only built where the
+ * instruction set can be enabled per function. */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_X86 1
+#include <immintrin.h>
+#else
+#define UTF8_X86 0
+#endif
+
+/* The error bits of the lookup tables used by the SIMD validators.  See
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" (Keiser, Lemire)
+ * for how they combine. */
+#define TOO_SHORT      (1 << 0)
+#define TOO_LONG       (1 << 1)
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7)
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
 
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
 
+/* A kernel returns how many leading bytes it proved to be valid, always
+ * ending on a character boundary, or SIZE_MAX if they are not valid. */
+typedef size_t (*validate_fn)(const uint8_t *, size_t);
+
 /* General notes:
  *
  * Anything that falls outside the ranges specified is invalid.
@@ -71,12 +98,108 @@ static const uint8_t utf8_len[256] = {
        3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, /* 0xe0-0xef */
        4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0  /* 0xf0-0xff */
 };
+
+/* The streaming validator is the DFA described by Bjoern Hoehrmann in
+ * "Flexible and Economical UTF-8 Decoder".  Each byte maps to one of 12
+ * classes and the state (a multiple of 12) plus the class index the next
+ * state.
+ */
+static const uint8_t utf8_class[256] = {
+    /* 0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f
+     *-----------------------------------------------------------------*/
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x00-0x0f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x10-0x1f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x20-0x2f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x30-0x3f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x40-0x4f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x50-0x5f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x60-0x6f */
+       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x70-0x7f */
+       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80-0x8f */
+       9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, /* 0x90-0x9f */
+       7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, /* 0xa0-0xaf */
+       7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, /* 0xb0-0xbf */
+       8, 8, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xc0-0xcf */
+       2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* 0xd0-0xdf */
+      10, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 3, 3, /* 0xe0-0xef */
+      11, 6, 6, 6, 5, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8  /* 0xf0-0xff */
+};
+
+static const uint8_t utf8_transition[108] = {
+    /* 0   1   2   3   4   5   6   7   8   9  10  11      class
+     *------------------------------------------------------------------*/
+       0, 12, 24, 36, 60, 96, 84, 12, 12, 12, 48, 72, /* accept        */
+      12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, /* reject        */
+      12,  0, 12, 12, 12, 12, 12,  0, 12,  0, 12, 12, /* 1 byte left   */
+      12, 24, 12, 12, 12, 12, 12, 24, 12, 24, 12, 12, /* 2 bytes left  */
+      12, 12, 12, 12, 12, 12, 12, 24, 12, 12, 12, 12, /* after 0xe0    */
+      12, 24, 12, 12, 12, 12, 12, 12, 12, 24, 12, 12, /* after 0xed    */
+      12, 12, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12, /* after 0xf0    */
+      12, 36, 12, 12, 12, 12, 12, 36, 12, 36, 12, 12, /* 3 bytes left  */
+      12, 36, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12  /* after 0xf4    */
+};
+
+/* The lookup tables of the SIMD validators, indexed by the high and low
+ * nibbles of the first byte and the high nibble of the second byte of each
+ * pair of bytes. */
+#if UTF8_X86
+static const uint8_t byte_1_high[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,                         /* 0_______ */
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                     /* 10______ */
+    TOO_SHORT | OVERLONG_2,                                         /* 1100____ */
+    TOO_SHORT,                                                      /* 1101____ */
+    TOO_SHORT | OVERLONG_3 | SURROGATE,                             /* 1110____ */
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4             /* 1111____ */
+};
+
+static const uint8_t byte_1_low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,                   /* ____0000 */
+    CARRY | OVERLONG_2,                                             /* ____0001 */
+    CARRY,                                                          /* ____001_ */
+    CARRY,
+    CARRY | TOO_LARGE,                                              /* ____0100 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,                             /* ____0101 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,                             /* ____011_ */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,                             /* ____1___ */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,                 /* ____1101 */
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+static const uint8_t byte_2_high[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                     /* 0_______ */
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000
+        | OVERLONG_4,                                               /* 1000____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,     /* 1001____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,      /* 101_____ */
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT                      /* 11______ */
+};
+#endif
 // clang-format on
 
+/* The selected kernel, see kernel_get(). */
+static kernel_fn __kernel = NULL;
+
 /*----------------------------------------------------------------------------*/
 /*                             Function Prototypes                            */
 /*----------------------------------------------------------------------------*/
-/* none */
+static int _validate_scalar(const uint8_t *, size_t *);
+static size_t _validate_none(const uint8_t *, size_t);
+#if UTF8_X86
+static size_t _validate_sse41(const uint8_t *, size_t);
+static size_t _validate_avx2(const uint8_t *, size_t);
+#endif
+static kernel_fn _validate_select(void);
+static size_t _boundary(const uint8_t *, size_t);
+static uint8_t _step(uint8_t *, uint8_t);
 
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
@@ -87,35 +210,88 @@ size_t utf8_get_size(char c)
 }
 
 
-bool utf8_maybe_valid(const char *text, size_t len)
+int utf8_stream(uint8_t *state, const char *text, size_t len)
 {
-    uint8_t buf[4] = { 0, 0x80, 0x80, 0x80 };
-    size_t c_len;
-
-    memcpy(buf, text, len);
-    c_len = utf8_len[*buf];
+    const uint8_t *bytes = (const uint8_t *) text;
+    size_t done;
 
-    if (0 == c_len) {
-        return false;
+    /* Finish the character left over from the last chunk. */
+    while (len && (UTF8_ACCEPT != *state)) {
+        if (UTF8_REJECT == _step(state, *bytes)) {
+            return -1;
+        }
+        bytes++;
+        len--;
     }
 
+    /* Complete characters go through the fast validator ... */
+    done = len;
+    if (0 != utf8_validate((const char *) bytes, &done)) {
+        *state = UTF8_REJECT;
+        return -1;
+    }
 
-    if (0 == utf8_validate((char *) buf, &c_len)) {
-        return true;
+    /* ... and the start of one continuing in the next chunk is checked as
+     * far as it goes, so invalid input is rejected as early as possible. */
+    for (; done < len; done++) {
+        if (UTF8_REJECT == _step(state, bytes[done])) {
+            return -1;
+        }
     }
 
-    return false;
+    return 0;
 }
 
 
 int utf8_validate(const char *text, size_t *len)
 {
     const uint8_t *bytes = (const uint8_t *) text;
-    size_t left          = *len;
+    validate_fn fn       = (validate_fn) kernel_get(&__kernel, _validate_select);
+    size_t done, left;
+
+    done = (*fn)(bytes, *len);
+    if (SIZE_MAX == done) {
+        return -1;
+    }
+
+    left = *len - done;
+    if (0 != _validate_scalar(&bytes[done], &left)) {
+        return -1;
+    }
+
+    *len = done + left;
+    return 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+
+
+/**
+ * The reference validator, one character at a time.  It follows the same
+ * contract as utf8_validate().
+ */
+static int _validate_scalar(const uint8_t *bytes, size_t *len)
+{
+    size_t left = *len;
 
     while (left) {
         size_t c_len = utf8_len[*bytes];
 
+        /* Skip runs of ASCII a word at a time. */
+        if ((1 == c_len) && (sizeof(uint64_t) <= left)) {
+            uint64_t w;
+
+            memcpy(&w, bytes, sizeof(w));
+            if (0 == (w & 0x8080808080808080ULL)) {
+                left -= sizeof(w);
+                bytes += sizeof(w);
+                continue;
+            }
+        }
+
         if (left < c_len) {
             *len -= left;
             return 0;
@@ -166,7 +342,176 @@ int utf8_validate(const char *text, size_t *len)
 }
 
 
-/*----------------------------------------------------------------------------*/
-/*                             Internal functions                             */
-/*----------------------------------------------------------------------------*/
-/* none */
+/* Picks the widest kernel the running CPU supports. */
+static kernel_fn _validate_select(void)
+{
+#if UTF8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return (kernel_fn) _validate_avx2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return (kernel_fn) _validate_sse41;
+    }
+#endif
+    return (kernel_fn) _validate_none;
+}
+
+
+/* Leaves everything to the scalar validator. */
+static size_t _validate_none(const uint8_t *bytes, size_t len)
+{
+    (void) bytes;
+    (void) len;
+
+    return 0;
+}
+
+
+/**
+ * Backs up from the end of a valid prefix to the start of the character
+ * that may be cut off there, so the scalar validator can finish it.
+ *
+ * @param bytes the valid prefix
+ * @param len   the length of the prefix
+ *
+ * @return the length of the prefix up to the last character boundary
+ */
+static size_t _boundary(const uint8_t *bytes, size_t len)
+{
+    size_t end = len;
+
+    while ((0 < end) && (len - end < 3) && (0x80 == (0xc0 & bytes[end - 1]))) {
+        end--;
+    }
+    if ((0 < end) && (0xc0 <= bytes[end - 1])) {
+        end--;
+    }
+
+    return end;
+}
+
+
+/**
+ * Advances the streaming validator by one byte.
+ *
+ * @param state the DFA state to update
+ * @param byte  the next byte of the text
+ *
+ * @return the new state
+ */
+static uint8_t _step(uint8_t *state, uint8_t byte)
+{
+    *state = utf8_transition[*state + utf8_class[byte]];
+
+    return *state;
+}
+
+
+/* The SIMD validators only look at blocks that end at least 3 bytes before
+ * the end of the text.  Every character starting in those blocks is then
+ * complete in the text, so an error found there is an error the scalar
+ * validator would report too, and the partial character at the end is
+ * always left to the scalar validator. */
+#if UTF8_X86
+__attribute__((target("sse4.1"))) static size_t _validate_sse41(const uint8_t *bytes, size_t len)
+{
+    const __m128i t1h  = _mm_loadu_si128((const __m128i *) byte_1_high);
+    const __m128i t1l  = _mm_loadu_si128((const __m128i *) byte_1_low);
+    const __m128i t2h  = _mm_loadu_si128((const __m128i *) byte_2_high);
+    const __m128i nib  = _mm_set1_epi8(0x0f);
+    const __m128i max  = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       (char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1));
+    __m128i prev       = _mm_setzero_si128();
+    __m128i incomplete = _mm_setzero_si128();
+    __m128i error      = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i + sizeof(__m128i) + 3 <= len; i += sizeof(__m128i)) {
+        __m128i in = _mm_loadu_si128((const __m128i *) &bytes[i]);
+
+        if (0 == _mm_movemask_epi8(in)) {
+            /* All ASCII, so only a character cut off before it can fail. */
+            error = _mm_or_si128(error, incomplete);
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(in, prev, 16 - 1);
+            __m128i prev2 = _mm_alignr_epi8(in, prev, 16 - 2);
+            __m128i prev3 = _mm_alignr_epi8(in, prev, 16 - 3);
+            __m128i sc, must23;
+
+            sc = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+                              _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nib))),
+                _mm_shuffle_epi8(t2h, _mm_and_si128(_mm_srli_epi16(in, 4), nib)));
+
+            must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char) (0xe0 - 0x80))),
+                                  _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xf0 - 0x80))));
+            must23 = _mm_and_si128(must23, _mm_set1_epi8((char) 0x80));
+
+            error = _mm_or_si128(error, _mm_xor_si128(must23, sc));
+        }
+
+        incomplete = _mm_subs_epu8(in, max);
+        prev       = in;
+
+        if (!_mm_testz_si128(error, error)) {
+            return SIZE_MAX;
+        }
+    }
+
+    return _boundary(bytes, i);
+}
+
+
+__attribute__((target("avx2"))) static size_t _validate_avx2(const uint8_t *bytes, size_t len)
+{
+    const __m256i t1h  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) byte_1_high));
+    const __m256i t1l  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) byte_1_low));
+    const __m256i t2h  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) byte_2_high));
+    const __m256i nib  = _mm256_set1_epi8(0x0f);
+    const __m256i max  = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          (char) (0xf0 - 1), (char) (0xe0 - 1), (char) (0xc0 - 1));
+    __m256i prev       = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i error      = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + sizeof(__m256i) + 3 <= len; i += sizeof(__m256i)) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) &bytes[i]);
+
+        if (0 == _mm256_movemask_epi8(in)) {
+            /* All ASCII, so only a character cut off before it can fail. */
+            error = _mm256_or_si256(error, incomplete);
+        } else {
+            /* The previous block's upper half joined with this block's lower
+             * half, since alignr works on each 128 bit lane. */
+            __m256i joined = _mm256_permute2x128_si256(prev, in, 0x21);
+            __m256i prev1  = _mm256_alignr_epi8(in, joined, 16 - 1);
+            __m256i prev2  = _mm256_alignr_epi8(in, joined, 16 - 2);
+            __m256i prev3  = _mm256_alignr_epi8(in, joined, 16 - 3);
+            __m256i sc, must23;
+
+            sc = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+                                 _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nib))),
+                _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+
+            must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xe0 - 0x80))),
+                                     _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xf0 - 0x80))));
+            must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80));
+
+            error = _mm256_or_si256(error, _mm256_xor_si256(must23, sc));
+        }
+
+        incomplete = _mm256_subs_epu8(in, max);
+        prev       = in;
+
+        if (!_mm256_testz_si256(error, error)) {
+            return SIZE_MAX;
+        }
+    }
+
+    return _boundary(bytes, i);
+}
+#endif
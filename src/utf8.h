@@ -9,11 +9,16 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 /* The maximum number of bytes needed to make any UTF8 encoded character. */
 #define MAX_UTF_BYTES 4
 
+/* The states of utf8_stream() that are meaningful to the caller. */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 12
+
 /**
  * Returns the number of total bytes needed by the UTF8 starting character
  * passed in.
@@ -25,16 +30,21 @@ size_t utf8_get_size(char c);
 
 
 /**
- * Returns if the starting sequence could possible be valid UTF8 or if it is
- * already out of bounds.
+ * Validates text that arrives in chunks, where a character may be split
+ * between chunks.  Only the state is kept between calls, so every chunk can
+ * be used as soon as this returns.
+ *
+ * @note The state must start as UTF8_ACCEPT and the text is only complete
+ *       if it is UTF8_ACCEPT again after the last chunk.
  *
- * @param string the text to validate is UTF8
- * @param len    the length of the string in bytes
+ * @param state the validator state, updated by the call (in/out)
+ * @param text  the next chunk of text
+ * @param len   the length of the chunk in bytes
  *
- * @return true if the sequence could possibly be valid, false if it is
- *         definitely not possibly valid.
+ * @returns 0 if the text is valid so far, or less than zero (and the state
+ *          is UTF8_REJECT) as soon as a byte makes it invalid
  */
-bool utf8_maybe_valid(const char *text, size_t len);
+int utf8_stream(uint8_t *state, const char *text, size_t len);
 
 
 /**
@@ -4,10 +4,13 @@
  *
  * SPDX-License-Identifier: MIT
  */
+#define _XOPEN_SOURCE 600
+
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "utils.h"
 
@@ -166,6 +169,18 @@ char *cws_strmerge(const char *s1, const char *s2)
 }
 
 
+uint64_t cws_now_usec(void)
+{
+    struct timespec ts;
+
+    if (0 != clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    }
+
+    return ((uint64_t) ts.tv_sec * 1000000) + ((uint64_t) ts.tv_nsec / 1000);
+}
+
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
@@ -95,4 +95,12 @@ int cws_strncasecmp(const char *s1, const char *s2, size_t maxlen);
 char *cws_strmerge(const char *s1, const char *s2);
 
 
+/**
+ * Gets the current time of the monotonic clock.
+ *
+ * @return the time in microseconds, or 0 if the clock is not available
+ */
+uint64_t cws_now_usec(void);
+
+
 #endif
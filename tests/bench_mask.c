@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Compares the masking kernels against the original byte at a time loop.
+ *
+ * Run with: meson test --benchmark bench_mask -v
+ *
+ * On x86 the results are in bytes per TSC cycle, elsewhere in bytes per
+ * nanosecond. */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/mask.c"
+
+#define TOTAL_BYTES (256 * 1024 * 1024)
+
+static uint64_t now(void)
+{
+#if MASK_X86
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+
+static double run(mask_fn fn, uint8_t *dst, const uint8_t *src, size_t len)
+{
+    const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+    size_t loops         = TOTAL_BYTES / len;
+    uint64_t start, stop;
+
+    /* Warm the caches */
+    fn(dst, src, len, key, 0);
+
+    start = now();
+    for (size_t i = 0; i < loops; i++) {
+        fn(dst, src, len, key, i);
+    }
+    stop = now();
+
+    return (double) (loops * len) / (double) (stop - start);
+}
+
+
+int main(void)
+{
+    static const size_t sizes[] = {16, 125, 1024, 16384, 1024 * 1024};
+    struct {
+        const char *name;
+        mask_fn fn;
+    } kernels[5];
+    size_t count = 0;
+    uint8_t *src, *dst;
+
+    kernels[count].name = "byte";
+    kernels[count++].fn = _mask_bytes;
+    kernels[count].name = "word";
+    kernels[count++].fn = _mask_word;
+#if MASK_X86
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[count].name = "sse2";
+        kernels[count++].fn = _mask_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[count].name = "avx2";
+        kernels[count++].fn = _mask_avx2;
+    }
+#endif
+
+    /* Offset by one so the heads and tails are exercised like real frames. */
+    src = malloc(sizes[4] + 1);
+    dst = malloc(sizes[4] + 1);
+    if (!src || !dst) {
+        return 1;
+    }
+    memset(src, 0xa5, sizes[4] + 1);
+
+    printf("%-8s", "bytes");
+    for (size_t k = 0; k < count; k++) {
+        printf("%10s", kernels[k].name);
+    }
+    for (size_t k = 0; k < count; k++) {
+        if (_mask_select() == (kernel_fn) kernels[k].fn) {
+            printf("   (selected: %s)", kernels[k].name);
+        }
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        printf("%-8zu", sizes[s]);
+        for (size_t k = 0; k < count; k++) {
+            printf("%10.2f", run(kernels[k].fn, &dst[1], &src[1], sizes[s]));
+        }
+        printf("\n");
+    }
+
+    free(src);
+    free(dst);
+
+    return 0;
+}
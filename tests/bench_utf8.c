@@ -0,0 +1,137 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Compares the UTF-8 validation kernels on ASCII, mixed and CJK text.
+ *
+ * Run with: meson test --benchmark bench_utf8 -v
+ *
+ * On x86 the results are in bytes per TSC cycle, elsewhere in bytes per
+ * nanosecond. */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/utf8.c"
+
+#define TOTAL_BYTES (256 * 1024 * 1024)
+#define CORPUS_SIZE (64 * 1024)
+
+static uint64_t now(void)
+{
+#if UTF8_X86
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+
+/* Fills buf with copies of the sample, ending on a character boundary. */
+static size_t fill(char *buf, size_t size, const char *sample)
+{
+    size_t len  = strlen(sample);
+    size_t used = 0;
+
+    while (used + len <= size) {
+        memcpy(&buf[used], sample, len);
+        used += len;
+    }
+
+    return used;
+}
+
+
+static double run(validate_fn fn, const char *text, size_t len)
+{
+    size_t loops = TOTAL_BYTES / len;
+    uint64_t start, stop;
+    size_t valid;
+
+    __kernel = (kernel_fn) fn;
+
+    /* Warm the caches */
+    valid = len;
+    if (0 != utf8_validate(text, &valid)) {
+        return 0.0;
+    }
+
+    start = now();
+    for (size_t i = 0; i < loops; i++) {
+        valid = len;
+        utf8_validate(text, &valid);
+    }
+    stop = now();
+
+    return (double) (loops * len) / (double) (stop - start);
+}
+
+
+int main(void)
+{
+    static const struct {
+        const char *name;
+        const char *sample;
+    } corpora[] = {
+        { "ascii", "{\"id\":12345,\"name\":\"device\",\"status\":\"online\",\"tags\":[\"a\",\"b\"]}," },
+        { "mixed", "{\"city\":\"Zürich\",\"note\":\"naïve café\",\"temp\":\"21°C\",\"ok\":true}," },
+        { "cjk", "東京都の天気は晴れです。明日は雨が降るでしょう。日本語のテキスト。" },
+    };
+    struct {
+        const char *name;
+        validate_fn fn;
+    } kernels[3];
+    size_t count = 0;
+    char *buf;
+
+    kernels[count].name = "scalar";
+    kernels[count++].fn = _validate_none;
+#if UTF8_X86
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels[count].name = "sse4.1";
+        kernels[count++].fn = _validate_sse41;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[count].name = "avx2";
+        kernels[count++].fn = _validate_avx2;
+    }
+#endif
+
+    buf = malloc(CORPUS_SIZE);
+    if (!buf) {
+        return 1;
+    }
+
+    printf("%-8s", "corpus");
+    for (size_t k = 0; k < count; k++) {
+        printf("%10s", kernels[k].name);
+    }
+    for (size_t k = 0; k < count; k++) {
+        if (_validate_select() == (kernel_fn) kernels[k].fn) {
+            printf("   (selected: %s)", kernels[k].name);
+        }
+    }
+    printf("\n");
+
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        size_t len = fill(buf, CORPUS_SIZE, corpora[c].sample);
+
+        printf("%-8s", corpora[c].name);
+        for (size_t k = 0; k < count; k++) {
+            printf("%10.2f", run(kernels[k].fn, buf, len));
+        }
+        printf("\n");
+    }
+
+    free(buf);
+
+    return 0;
+}
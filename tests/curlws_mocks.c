@@ -43,6 +43,25 @@ CURLcode receive_init(CWS *priv)
     return CURLE_OK;
 }
 
+static int __receive_pause  = 0;
+static int __receive_resume = 0;
+void receive_pause(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __receive_pause++;
+}
+
+void receive_resume(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __receive_resume++;
+}
+
+void receive_destroy(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+}
+
 /*----------------------------------------------------------------------------*/
 /*                                  Mock Send                                 */
 /*----------------------------------------------------------------------------*/
@@ -53,9 +72,14 @@ CURLcode send_init(CWS *priv)
     return CURLE_OK;
 }
 
+static int __curl_easy_cleanup = 0;
+static int __send_destroy_state = 0;
+static int __send_destroy_cleanup = 0;
 void send_destroy(CWS *priv)
 {
     CU_ASSERT(NULL != priv);
+    __send_destroy_state   = priv->close_state;
+    __send_destroy_cleanup = __curl_easy_cleanup;
 }
 
 size_t send_get_memory_needed(size_t payload_size)
@@ -63,6 +87,119 @@ size_t send_get_memory_needed(size_t payload_size)
     return 100 + payload_size;
 }
 
+static int __send_msg_begin       = 0;
+static int __send_msg_commit      = 0;
+static int __send_msg_abort       = 0;
+static bool __send_msg_has_tag    = false;
+static void *__send_msg_tag       = NULL;
+static uint32_t __send_msg_ttl    = 0;
+static uint64_t __send_msg_id     = 0;
+static uint64_t __send_msg_key    = 0;
+static uint64_t __send_msg_cancel = 0;
+uint64_t send_msg_begin(CWS *priv, int priority, uint32_t ttl_usec, uint64_t key)
+{
+    CU_ASSERT(NULL != priv);
+    IGNORE_UNUSED(priority);
+    __send_msg_ttl = ttl_usec;
+    __send_msg_key = key;
+    __send_msg_begin++;
+    return ++__send_msg_id;
+}
+
+void send_msg_commit(CWS *priv, bool has_tag, void *tag)
+{
+    CU_ASSERT(NULL != priv);
+    __send_msg_has_tag = has_tag;
+    __send_msg_tag     = tag;
+    __send_msg_commit++;
+}
+
+CWScode send_msg_cancel(CWS *priv, uint64_t msg_id)
+{
+    CU_ASSERT(NULL != priv);
+    __send_msg_cancel = msg_id;
+    return (msg_id == __send_msg_id) ? CWSE_OK : CWSE_MSG_NOT_QUEUED;
+}
+
+void send_msg_abort(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __send_msg_abort++;
+}
+
+static int __send_producer_type   = 0;
+static int __send_producer_prio   = 0;
+static int __send_producer_ready  = 0;
+static CWScode __send_producer_rv = CWSE_OK;
+static struct cws_producer __send_producer;
+CWScode send_producer(CWS *priv, int type, int priority, const struct cws_producer *producer)
+{
+    CU_ASSERT(NULL != priv);
+    CU_ASSERT(NULL != producer);
+    __send_producer_type = type;
+    __send_producer_prio = priority;
+    __send_producer      = *producer;
+    return __send_producer_rv;
+}
+
+void send_producer_ready(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __send_producer_ready++;
+}
+
+static struct cws_prepared *__send_msg_hold = NULL;
+void send_msg_hold(CWS *priv, struct cws_prepared *msg)
+{
+    CU_ASSERT(NULL != priv);
+    __send_msg_hold = msg;
+}
+
+static bool __send_is_full = false;
+bool send_is_full(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    return __send_is_full;
+}
+
+static int __send_batch_depth = 0;
+void send_batch_begin(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __send_batch_depth++;
+}
+
+CWScode send_batch_commit(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    if (0 == __send_batch_depth) {
+        return CWSE_BAD_FUNCTION_ARGUMENT;
+    }
+    __send_batch_depth--;
+    return CWSE_OK;
+}
+
+static uint32_t __send_cork = 0;
+static int __send_uncork   = 0;
+void send_cork(CWS *priv, uint32_t max_usec)
+{
+    CU_ASSERT(NULL != priv);
+    __send_cork = max_usec;
+}
+
+void send_uncork(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    __send_uncork++;
+}
+
+void send_get_stats(CWS *priv, struct cws_send_stats *stats)
+{
+    CU_ASSERT(NULL != priv);
+    stats->unpauses       = 1;
+    stats->unpauses_saved = 2;
+}
+
 
 /*----------------------------------------------------------------------------*/
 /*                              Mock Frame Sender                             */
@@ -141,11 +278,34 @@ CWScode data_block_sender(CWS *priv, int options, const void *data, size_t len)
     return sender(&__data_block_sender, options, data, len);
 }
 
+/* Joins the segments so the same mock vectors can be used. */
+CWScode data_block_sender_iov(CWS *priv, int options, const struct cws_iov *iov, size_t count)
+{
+    char buf[256];
+    size_t len = 0;
+
+    CU_ASSERT(NULL != priv);
+    for (size_t i = 0; i < count; i++) {
+        CU_ASSERT_FATAL(len + iov[i].len <= sizeof(buf));
+        memcpy(&buf[len], iov[i].base, iov[i].len);
+        len += iov[i].len;
+    }
+    return sender(&__data_block_sender, options, buf, len);
+}
+
 /*----------------------------------------------------------------------------*/
 /*                                Mock Random                                 */
 /*----------------------------------------------------------------------------*/
 
 
+uint64_t __random_seed = 0;
+void cws_random_seed(CWS *priv, uint64_t seed)
+{
+    CU_ASSERT(NULL != priv);
+    __random_seed = seed;
+}
+
+
 void cws_random(CWS *priv, void *buffer, size_t len)
 {
     uint8_t *bytes = buffer;
@@ -295,6 +455,9 @@ CURLcode curl_easy_setopt(CURL *easy, CURLoption option, ...)
         case CURLOPT_STDERR:
             snprintf(buf, sizeof(buf), "%-*s: %p", width, "CURLOPT_STDERR", (void *) va_arg(ap, FILE *));
             break;
+        case CURLOPT_UPLOAD_BUFFERSIZE:
+            snprintf(buf, sizeof(buf), "%-*s: %ld", width, "CURLOPT_UPLOAD_BUFFERSIZE", va_arg(ap, long));
+            break;
         case CURLOPT_HTTPHEADER: /* pointer to headers */
             p = va_arg(ap, struct curl_slist *);
             break;
@@ -327,6 +490,7 @@ CURLcode curl_easy_getinfo(CURL *easy, CURLINFO info, ... )
 void curl_easy_cleanup(CURL *easy)
 {
     (void) easy;
+    __curl_easy_cleanup++;
 }
 
 
@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/broadcast.h"
+#include "../src/internal.h"
+
+void test_prepared()
+{
+    struct cws_prepared *msg;
+
+    msg = prepared_create(CWS_TEXT, "hello", 5);
+    CU_ASSERT_FATAL(NULL != msg);
+    CU_ASSERT(1 == msg->refs);
+    CU_ASSERT(CWS_TEXT == msg->type);
+    CU_ASSERT(5 == msg->len);
+    CU_ASSERT(0 == memcmp(msg->data, "hello", 5));
+
+    prepared_ref(msg);
+    prepared_ref(msg);
+    CU_ASSERT(3 == msg->refs);
+    prepared_unref(msg);
+    prepared_unref(msg);
+    CU_ASSERT(1 == msg->refs);
+    prepared_unref(msg);
+
+    msg = prepared_create(CWS_BINARY, NULL, 0);
+    CU_ASSERT_FATAL(NULL != msg);
+    CU_ASSERT(0 == msg->len);
+    prepared_unref(msg);
+
+    CU_ASSERT(NULL == prepared_create(CWS_BINARY, "", SIZE_MAX));
+}
+
+
+void test_group()
+{
+    struct cws_group *g1, *g2;
+    CWS ws[20];
+
+    memset(ws, 0, sizeof(ws));
+
+    g1 = group_create();
+    g2 = group_create();
+    CU_ASSERT_FATAL(NULL != g1);
+    CU_ASSERT_FATAL(NULL != g2);
+
+    /* Enough members to grow the group. */
+    for (int i = 0; i < 20; i++) {
+        CU_ASSERT(CWSE_OK == group_add(g1, &ws[i]));
+    }
+    CU_ASSERT(20 == g1->count);
+
+    /* Adding again does nothing. */
+    CU_ASSERT(CWSE_OK == group_add(g1, &ws[3]));
+    CU_ASSERT(20 == g1->count);
+
+    CU_ASSERT(CWSE_OK == group_add(g2, &ws[3]));
+    CU_ASSERT(CWSE_OK == group_add(g2, &ws[4]));
+
+    /* The last member fills the hole. */
+    CU_ASSERT(CWSE_OK == group_remove(g1, &ws[0]));
+    CU_ASSERT(19 == g1->count);
+    CU_ASSERT(&ws[19] == g1->members[0]);
+    CU_ASSERT(NULL == ws[0].groups);
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == group_remove(g1, &ws[0]));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == group_remove(g2, &ws[5]));
+
+    /* A destroyed handle leaves all its groups. */
+    group_leave_all(&ws[3]);
+    CU_ASSERT(18 == g1->count);
+    CU_ASSERT(1 == g2->count);
+    CU_ASSERT(&ws[4] == g2->members[0]);
+    CU_ASSERT(NULL == ws[3].groups);
+    for (size_t i = 0; i < g1->count; i++) {
+        CU_ASSERT(&ws[3] != g1->members[i]);
+    }
+
+    /* A destroyed group is forgotten by its members. */
+    group_destroy(g1);
+    for (int i = 0; i < 20; i++) {
+        if (4 == i) {
+            CU_ASSERT_FATAL(NULL != ws[i].groups);
+            CU_ASSERT(g2 == ws[i].groups->group);
+            CU_ASSERT(NULL == ws[i].groups->next);
+        } else {
+            CU_ASSERT(NULL == ws[i].groups);
+        }
+    }
+
+    group_leave_all(&ws[4]);
+    CU_ASSERT(0 == g2->count);
+    group_destroy(g2);
+}
+
+
+void add_suites(CU_pSuite *suite)
+{
+    struct {
+        const char *label;
+        void (*fn)(void);
+    } tests[] = {
+        {.label = "prepared messages", .fn = test_prepared},
+        {           .label = "groups",    .fn = test_group},
+        {               .label = NULL,          .fn = NULL}
+    };
+    int i;
+
+    *suite = CU_add_suite("broadcast.c tests", NULL, NULL);
+
+    for (i = 0; NULL != tests[i].fn; i++) {
+        CU_add_test(*suite, tests[i].label, tests[i].fn);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+int main(void)
+{
+    unsigned rv     = 1;
+    CU_pSuite suite = NULL;
+
+    if (CUE_SUCCESS == CU_initialize_registry()) {
+        add_suites(&suite);
+
+        if (NULL != suite) {
+            CU_basic_set_mode(CU_BRM_VERBOSE);
+            CU_basic_run_tests();
+            printf("\n");
+            CU_basic_show_failures(CU_get_failure_list());
+            printf("\n\n");
+            rv = CU_get_number_of_tests_failed();
+        }
+
+        CU_cleanup_registry();
+    }
+
+    if (0 != rv) {
+        return 1;
+    }
+    return 0;
+}
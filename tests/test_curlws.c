@@ -13,6 +13,7 @@
 #include <string.h>
 
 
+#include "../src/broadcast.h"
 #include "../src/frame_senders.h"
 #include "../src/internal.h"
 
@@ -133,6 +134,7 @@ void test_create_verbose()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -153,6 +155,7 @@ void test_create_verbose()
     CU_ASSERT((FILE *) 0x1234 == ws->cfg.verbose_stream);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -174,6 +177,7 @@ void test_create_verbose()
     CU_ASSERT((FILE *) 0x1234 == ws->cfg.verbose_stream);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_VERBOSE        : 1",
@@ -195,6 +199,7 @@ void test_create_verbose()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_VERBOSE        : 1",
@@ -216,6 +221,7 @@ void test_create_verbose()
     CU_ASSERT(3 == ws->cfg.verbose);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_VERBOSE        : 1",
@@ -236,6 +242,7 @@ void test_create_verbose()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -297,6 +304,7 @@ void test_create_basic()
     CU_ASSERT_STRING_EQUAL(ws->expected_key_header, "4522FSSIYHASSkUaUouiInl8Cvk=");
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -329,6 +337,7 @@ void test_create_config_cb()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -367,6 +376,7 @@ void test_create_redirect()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_FOLLOWLOCATION : 1",
@@ -388,6 +398,7 @@ void test_create_redirect()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_FOLLOWLOCATION : 1",
@@ -422,6 +433,7 @@ void test_create_ws_protos()
     cws_destroy(ws);
     cfg.websocket_protocols = NULL;
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -459,6 +471,7 @@ void test_create_expect()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -484,13 +497,47 @@ void test_create_payload_size()
     cfg.url = "wss://example.com";
     reset_setopt();
 
-    /* Valid max payload size */
+    /* By default frames fill the upload buffer */
+    ws = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(65536 - WS_FRAME_HEADER_MAX == ws->cfg.max_payload_size);
+    cws_destroy(ws);
+    reset_setopt();
+
+    /* The upload buffer size is limited to what curl allows */
+    cfg.upload_buffer_size = 100;
+    ws                     = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(16384 - WS_FRAME_HEADER_MAX == ws->cfg.max_payload_size);
+    cws_destroy(ws);
+    reset_setopt();
+
+    cfg.upload_buffer_size = 100000000;
+    ws                     = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(2097152 - WS_FRAME_HEADER_MAX == ws->cfg.max_payload_size);
+    cws_destroy(ws);
+    cfg.upload_buffer_size = 0;
+    reset_setopt();
+
+    /* The lower bound applies */
+    cfg.min_payload_size = 100000;
+    ws                   = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(100000 == ws->cfg.max_payload_size);
+    cws_destroy(ws);
+    reset_setopt();
+
+    /* The upper bound wins */
     cfg.max_payload_size = 10;
     ws                   = cws_create(&cfg);
     CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(10 == ws->cfg.max_payload_size);
     cws_destroy(ws);
     cfg.max_payload_size = 0;
+    cfg.min_payload_size = 0;
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -506,6 +553,54 @@ void test_create_payload_size()
 }
 
 
+void test_create_watermarks()
+{
+    CWS *ws;
+    struct cws_config cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.url = "wss://example.com";
+    reset_setopt();
+
+    /* The low watermark must be below the high watermark */
+    cfg.send_high_watermark = 1000;
+    cfg.send_low_watermark  = 1000;
+    ws                      = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL == ws);
+    reset_setopt();
+
+    cfg.send_low_watermark = 999;
+    ws                     = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(1000 == ws->cfg.send_high_watermark);
+    CU_ASSERT(999 == ws->cfg.send_low_watermark);
+    cws_destroy(ws);
+    reset_setopt();
+
+    /* Without a high watermark the low watermark is ignored */
+    cfg.send_high_watermark = 0;
+    cfg.send_low_watermark  = 5000;
+    ws                      = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(0 == ws->cfg.send_high_watermark);
+    CU_ASSERT(0 == ws->cfg.send_low_watermark);
+    cws_destroy(ws);
+    reset_setopt();
+
+    /* The seed is handed to the handle's generator. */
+    cfg.random_seed       = 1234;
+    cfg.max_ping_rate     = 10;
+    cfg.max_control_delay = 4096;
+    ws                    = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    CU_ASSERT(1234 == __random_seed);
+    CU_ASSERT(10 == ws->cfg.max_ping_rate);
+    CU_ASSERT(4096 == ws->cfg.max_control_delay);
+    cws_destroy(ws);
+    reset_setopt();
+}
+
+
 void test_create_extra_headers()
 {
     CWS *ws;
@@ -534,6 +629,7 @@ void test_create_extra_headers()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -553,6 +649,7 @@ void test_create_extra_headers()
     CU_ASSERT_FATAL(NULL != ws);
     cws_destroy(ws);
     validate_and_reset(
+        "CURLOPT_UPLOAD_BUFFERSIZE: 65536",
         "CURLOPT_URL            : https://example.com",
         "CURLOPT_SSLVERSION     : " xstr(MY_CURL_SSLVERSION_TLS),
         "CURLOPT_HTTP_VERSION   : " xstr(MY_HTTP_VERSION),
@@ -614,6 +711,16 @@ void test_destroy_failures()
 
     ws->dispatching = 0;
     cws_destroy(ws);
+
+    /* The queue is discarded while curl is still valid and nothing more can
+     * be sent. */
+    ws = cws_create(&cfg);
+    CU_ASSERT_FATAL(NULL != ws);
+    __curl_easy_cleanup = 0;
+    cws_destroy(ws);
+    CU_ASSERT(0 == __send_destroy_cleanup);
+    CU_ASSERT(1 == __curl_easy_cleanup);
+    CU_ASSERT((CLOSE_QUEUED | CLOSED) == ((CLOSE_QUEUED | CLOSED) & __send_destroy_state));
 }
 
 void test_close()
@@ -718,6 +825,450 @@ void test_send_blk()
 }
 
 
+void test_send_msg()
+{
+    CWS ws;
+    struct cws_send_opts opts;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&opts, 0, sizeof(opts));
+
+    // clang-format off
+    struct mock_sender test[] = {
+        { .options = CWS_BINARY,                 .data = "random data", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 1 },
+        { .options = CWS_TEXT,                   .data = "random data", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 2 },
+        { .options = CWS_BINARY | CWS_PRIO_HIGH, .data = "random data", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 3 },
+        { .options = CWS_TEXT   | CWS_PRIO_BULK, .data = "random data", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 0 },
+    };
+    // clang-format on
+    __data_block_sender = &test[0];
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_msg(NULL, CWS_BINARY, NULL, 0, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_msg(&ws, CWS_BINARY, NULL, 2, NULL));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_msg(&ws, CWS_CONT, "random data", 11, NULL));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_msg(&ws, CWS_BINARY | CWS_TEXT, "random data", 11, NULL));
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_send_msg(&ws, CWS_TEXT, "\xc4 data", 6, NULL));
+
+    opts.priority = 42;
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_msg(&ws, CWS_BINARY, "random data", 11, &opts));
+    opts.priority = CWS_PRIO_HIGH | CWS_PRIO_BULK;
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_msg(&ws, CWS_BINARY, "random data", 11, &opts));
+
+    CU_ASSERT(CWSE_OK == cws_send_msg(&ws, CWS_BINARY, "random data", 11, NULL));
+    opts.priority = CWS_PRIO_NORMAL;
+    CU_ASSERT(CWSE_OK == cws_send_msg(&ws, CWS_TEXT, "random data", SIZE_MAX, &opts));
+    opts.priority = CWS_PRIO_HIGH;
+    CU_ASSERT(CWSE_OK == cws_send_msg(&ws, CWS_BINARY, "random data", 11, &opts));
+    opts.priority = CWS_PRIO_BULK;
+    CU_ASSERT(CWSE_OK == cws_send_msg(&ws, CWS_TEXT, "random data", 11, &opts));
+    CU_ASSERT(false == __send_msg_has_tag);
+}
+
+
+void test_cancel_msg()
+{
+    CWS ws;
+    struct cws_send_opts opts;
+    uint64_t msg_id = 0;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&opts, 0, sizeof(opts));
+
+    // clang-format off
+    struct mock_sender test[] = {
+        { .options = CWS_BINARY, .data = "random data", .len = 11, .rv = CWSE_OK,            .seen = 0, .more = 1 },
+        { .options = CWS_BINARY, .data = "random data", .len = 11, .rv = CWSE_OUT_OF_MEMORY, .seen = 0, .more = 0 },
+    };
+    // clang-format on
+    __data_block_sender = &test[0];
+
+    opts.ttl_usec     = 5000;
+    opts.msg_id       = &msg_id;
+    opts.conflate_key = 42;
+    CU_ASSERT(CWSE_OK == cws_send_msg(&ws, CWS_BINARY, "random data", 11, &opts));
+    CU_ASSERT(5000 == __send_msg_ttl);
+    CU_ASSERT(42 == __send_msg_key);
+    CU_ASSERT(__send_msg_id == msg_id);
+    CU_ASSERT(0 != msg_id);
+
+    /* The handle is only set if the message is queued. */
+    msg_id = 0;
+    CU_ASSERT(CWSE_OUT_OF_MEMORY == cws_send_msg(&ws, CWS_BINARY, "random data", 11, &opts));
+    CU_ASSERT(0 == msg_id);
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_cancel_msg(NULL, 1));
+    CU_ASSERT(CWSE_OK == cws_cancel_msg(&ws, __send_msg_id));
+    CU_ASSERT(__send_msg_id == __send_msg_cancel);
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == cws_cancel_msg(&ws, 0));
+}
+
+
+void test_send_ref()
+{
+    CWS ws;
+    struct cws_send_opts opts;
+    int tag = 0;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&opts, 0, sizeof(opts));
+
+    // clang-format off
+    struct mock_sender test[] = {
+        { .options = CWS_BINARY | CWS_REF,                 .data = "random data", .len = 11, .rv = CWSE_OK,            .seen = 0, .more = 1 },
+        { .options = CWS_TEXT   | CWS_REF | CWS_PRIO_BULK, .data = "random data", .len = 11, .rv = CWSE_OUT_OF_MEMORY, .seen = 0, .more = 1 },
+        { .options = CWS_BINARY | CWS_REF | CWS_WHOLE,     .data = "random data", .len = 11, .rv = CWSE_OK,            .seen = 0, .more = 0 },
+    };
+    // clang-format on
+    __data_block_sender = &test[0];
+    __send_msg_begin    = 0;
+    __send_msg_commit   = 0;
+    __send_msg_abort    = 0;
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_ref(NULL, CWS_BINARY, NULL, 0, &tag, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_ref(&ws, CWS_BINARY, NULL, 2, &tag, NULL));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_ref(&ws, CWS_CONT, "random data", 11, &tag, NULL));
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_send_ref(&ws, CWS_TEXT, "\xc4 data", 6, &tag, NULL));
+    CU_ASSERT(0 == __send_msg_begin);
+
+    CU_ASSERT(CWSE_OK == cws_send_ref(&ws, CWS_BINARY, "random data", 11, &tag, NULL));
+    CU_ASSERT(1 == __send_msg_begin);
+    CU_ASSERT(1 == __send_msg_commit);
+    CU_ASSERT(true == __send_msg_has_tag);
+    CU_ASSERT(&tag == __send_msg_tag);
+
+    /* A failure withdraws the message & restores the stream state. */
+    ws.last_sent_data_frame_info = CWS_BINARY | CWS_FIRST | CWS_LAST;
+    opts.priority                = CWS_PRIO_BULK;
+    CU_ASSERT(CWSE_OUT_OF_MEMORY == cws_send_ref(&ws, CWS_TEXT, "random data", 11, &tag, &opts));
+    CU_ASSERT(2 == __send_msg_begin);
+    CU_ASSERT(1 == __send_msg_commit);
+    CU_ASSERT(1 == __send_msg_abort);
+    CU_ASSERT((CWS_BINARY | CWS_FIRST | CWS_LAST) == ws.last_sent_data_frame_info);
+
+    opts.priority     = CWS_PRIO_NORMAL;
+    opts.unfragmented = 1;
+    CU_ASSERT(CWSE_OK == cws_send_ref(&ws, CWS_BINARY, "random data", 11, &tag, &opts));
+    CU_ASSERT(1 == test[2].seen);
+}
+
+
+void test_send_iov()
+{
+    CWS ws;
+    struct cws_send_opts opts;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&opts, 0, sizeof(opts));
+
+    // clang-format off
+    struct cws_iov bin[] = {
+        { .base = "random", .len = 6 },
+        { .base = NULL,     .len = 0 },
+        { .base = " data",  .len = 5 },
+    };
+    /* A 2, 3 and 4 byte character split across segments. */
+    struct cws_iov text[] = {
+        { .base = "a\xc2",      .len = 2 },
+        { .base = "\xa2\xe2",  .len = 2 },
+        { .base = "\x82",      .len = 1 },
+        { .base = "\xac\xf0",  .len = 2 },
+        { .base = "\x90\x8d",  .len = 2 },
+        { .base = "\x88z",     .len = 2 },
+    };
+    struct mock_sender test[] = {
+        { .options = CWS_BINARY,                 .data = "random data", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 1 },
+        { .options = CWS_TEXT | CWS_PRIO_HIGH,   .data = "a\xc2\xa2\xe2\x82\xac\xf0\x90\x8d\x88z", .len = 11, .rv = CWSE_OK, .seen = 0, .more = 2 },
+        { .options = CWS_BINARY,                 .data = NULL,          .len = 0,  .rv = CWSE_OK, .seen = 0, .more = 0 },
+    };
+    // clang-format on
+    __data_block_sender = &test[0];
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_iov(NULL, CWS_BINARY, bin, 3, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_iov(&ws, CWS_BINARY, NULL, 3, NULL));
+    bin[1].len = 1;
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_iov(&ws, CWS_BINARY, bin, 3, NULL));
+    bin[1].len = 0;
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_iov(&ws, CWS_CONT, bin, 3, NULL));
+
+    /* Invalid UTF-8: a truncated character at the end, and segments that
+     * start in the middle of a character. */
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_send_iov(&ws, CWS_TEXT, text, 1, NULL));
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_send_iov(&ws, CWS_TEXT, &text[2], 4, NULL));
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_send_iov(&ws, CWS_TEXT, &text[5], 1, NULL));
+
+    CU_ASSERT(CWSE_OK == cws_send_iov(&ws, CWS_BINARY, bin, 3, NULL));
+    opts.priority = CWS_PRIO_HIGH;
+    CU_ASSERT(CWSE_OK == cws_send_iov(&ws, CWS_TEXT, text, 6, &opts));
+    CU_ASSERT(CWSE_OK == cws_send_iov(&ws, CWS_BINARY, NULL, 0, NULL));
+    CU_ASSERT(1 == test[2].seen);
+}
+
+
+void test_batch()
+{
+    CWS ws;
+    struct cws_send_stats stats;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&stats, 0, sizeof(stats));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_batch_begin(NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_batch_commit(NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_batch_commit(&ws));
+    CU_ASSERT(CWSE_OK == cws_batch_begin(&ws));
+    CU_ASSERT(CWSE_OK == cws_batch_commit(&ws));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_get_send_stats(NULL, &stats));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_get_send_stats(&ws, NULL));
+    CU_ASSERT(CWSE_OK == cws_get_send_stats(&ws, &stats));
+    CU_ASSERT(1 == stats.unpauses);
+    CU_ASSERT(2 == stats.unpauses_saved);
+}
+
+
+static size_t __producer_read(void *user, CWS *handle, void *buf, size_t len, int *eom)
+{
+    IGNORE_UNUSED(user);
+    IGNORE_UNUSED(handle);
+    IGNORE_UNUSED(buf);
+    IGNORE_UNUSED(len);
+    *eom = 1;
+    return 0;
+}
+
+
+void test_send_producer()
+{
+    CWS ws;
+    struct cws_send_opts opts;
+    struct cws_producer producer = { .read = __producer_read, .done = NULL, .user = &ws };
+    struct cws_producer empty    = { .read = NULL, .done = NULL, .user = NULL };
+    uint64_t msg_id              = 0;
+
+    memset(&ws, 0, sizeof(CWS));
+    memset(&opts, 0, sizeof(opts));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_producer(NULL, CWS_BINARY, &producer, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_producer(&ws, CWS_BINARY, NULL, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_producer(&ws, CWS_BINARY, &empty, NULL));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_producer(&ws, CWS_CONT, &producer, NULL));
+
+    ws.close_state = CLOSE_QUEUED;
+    CU_ASSERT(CWSE_CLOSED_CONNECTION == cws_send_producer(&ws, CWS_BINARY, &producer, NULL));
+    ws.close_state = 0;
+
+    ws.last_sent_data_frame_info = CWS_BINARY | CWS_FIRST;
+    CU_ASSERT(CWSE_STREAM_CONTINUITY_ISSUE == cws_send_producer(&ws, CWS_BINARY, &producer, NULL));
+    ws.last_sent_data_frame_info = 0;
+
+    __send_is_full = true;
+    CU_ASSERT(CWSE_SEND_QUEUE_FULL == cws_send_producer(&ws, CWS_BINARY, &producer, NULL));
+    __send_is_full = false;
+
+    __send_msg_begin  = 0;
+    __send_msg_commit = 0;
+    __send_msg_abort  = 0;
+
+    opts.priority = CWS_PRIO_BULK;
+    opts.msg_id   = &msg_id;
+    CU_ASSERT(CWSE_OK == cws_send_producer(&ws, CWS_TEXT, &producer, &opts));
+    CU_ASSERT(CWS_TEXT == __send_producer_type);
+    CU_ASSERT(CWS_PRIO_BULK == __send_producer_prio);
+    CU_ASSERT(__producer_read == __send_producer.read);
+    CU_ASSERT(&ws == __send_producer.user);
+    CU_ASSERT(1 == __send_msg_begin);
+    CU_ASSERT(1 == __send_msg_commit);
+    CU_ASSERT(__send_msg_id == msg_id);
+
+    __send_producer_rv = CWSE_OUT_OF_MEMORY;
+    CU_ASSERT(CWSE_OUT_OF_MEMORY == cws_send_producer(&ws, CWS_BINARY, &producer, NULL));
+    CU_ASSERT(1 == __send_msg_abort);
+    __send_producer_rv = CWSE_OK;
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_producer_ready(NULL));
+    CU_ASSERT(CWSE_OK == cws_producer_ready(&ws));
+    CU_ASSERT(1 == __send_producer_ready);
+}
+
+
+static void *__fd_sent_tag      = NULL;
+static CWScode __fd_sent_status = CWSE_LAST;
+static void __fd_on_sent(void *user, CWS *handle, void *tag, CWScode status)
+{
+    IGNORE_UNUSED(user);
+    IGNORE_UNUSED(handle);
+    __fd_sent_tag    = tag;
+    __fd_sent_status = status;
+}
+
+
+void test_send_fd()
+{
+    CWS ws;
+    FILE *f;
+    int fd;
+    int eom;
+    int tag;
+    char buf[8];
+
+    memset(&ws, 0, sizeof(CWS));
+    ws.cb.on_sent_fn = __fd_on_sent;
+
+    f = tmpfile();
+    CU_ASSERT_FATAL(NULL != f);
+    fputs("0123456789abc", f);
+    fflush(f);
+    fd = fileno(f);
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_fd(&ws, CWS_BINARY, -1, 0, 4, &tag, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_fd(&ws, CWS_BINARY, fd, UINT64_MAX, 4, &tag, NULL));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_send_fd(&ws, CWS_CONT, fd, 0, 4, &tag, NULL));
+
+    /* Read from the middle of the file, a buffer at a time. */
+    CU_ASSERT(CWSE_OK == cws_send_fd(&ws, CWS_BINARY, fd, 2, 10, &tag, NULL));
+    CU_ASSERT(CWS_BINARY == __send_producer_type);
+
+    eom = 0;
+    CU_ASSERT(8 == __send_producer.read(__send_producer.user, &ws, buf, sizeof(buf), &eom));
+    CU_ASSERT(0 == eom);
+    CU_ASSERT(0 == memcmp(buf, "23456789", 8));
+    CU_ASSERT(2 == __send_producer.read(__send_producer.user, &ws, buf, sizeof(buf), &eom));
+    CU_ASSERT(1 == eom);
+    CU_ASSERT(0 == memcmp(buf, "ab", 2));
+    __send_producer.done(__send_producer.user, &ws, CWSE_OK);
+    CU_ASSERT(&tag == __fd_sent_tag);
+    CU_ASSERT(CWSE_OK == __fd_sent_status);
+
+    /* A file that ends early aborts the message. */
+    CU_ASSERT(CWSE_OK == cws_send_fd(&ws, CWS_BINARY, fd, 8, 10, &tag, NULL));
+    eom = 0;
+    CU_ASSERT(5 == __send_producer.read(__send_producer.user, &ws, buf, sizeof(buf), &eom));
+    CU_ASSERT(0 == eom);
+    CU_ASSERT(CWS_PRODUCER_ABORT == __send_producer.read(__send_producer.user, &ws, buf, sizeof(buf), &eom));
+    __send_producer.done(__send_producer.user, &ws, CWSE_MSG_DROPPED);
+    CU_ASSERT(CWSE_MSG_DROPPED == __fd_sent_status);
+
+    /* An empty message. */
+    CU_ASSERT(CWSE_OK == cws_send_fd(&ws, CWS_BINARY, fd, 0, 0, &tag, NULL));
+    eom = 0;
+    CU_ASSERT(0 == __send_producer.read(__send_producer.user, &ws, buf, sizeof(buf), &eom));
+    CU_ASSERT(1 == eom);
+    __send_producer.done(__send_producer.user, &ws, CWSE_OK);
+
+    /* The state is freed if the message isn't queued. */
+    __send_producer_rv = CWSE_OUT_OF_MEMORY;
+    CU_ASSERT(CWSE_OUT_OF_MEMORY == cws_send_fd(&ws, CWS_BINARY, fd, 0, 4, &tag, NULL));
+    __send_producer_rv = CWSE_OK;
+
+    fclose(f);
+}
+
+
+void test_prepared()
+{
+    CWS ws[3];
+    struct cws_prepared *msg = NULL;
+    struct cws_group *group;
+    struct cws_send_opts opts;
+    uint64_t msg_id = 0;
+    size_t queued   = 0;
+
+    memset(ws, 0, sizeof(ws));
+    memset(&opts, 0, sizeof(opts));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_prepare(NULL, CWS_TEXT, "hi", 2));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_prepare(&msg, CWS_TEXT, NULL, 2));
+    CU_ASSERT(CWSE_INVALID_OPTIONS == cws_prepare(&msg, CWS_CONT, "hi", 2));
+    CU_ASSERT(CWSE_INVALID_UTF8 == cws_prepare(&msg, CWS_TEXT, "\xc4 data", 6));
+    CU_ASSERT(NULL == msg);
+
+    CU_ASSERT(CWSE_OK == cws_prepare(&msg, CWS_TEXT, "random data", SIZE_MAX));
+    CU_ASSERT_FATAL(NULL != msg);
+    CU_ASSERT(11 == msg->len);
+
+    // clang-format off
+    struct mock_sender test[] = {
+        { .options = CWS_TEXT | CWS_REF,                 .data = "random data", .len = 11, .rv = CWSE_OK,                .seen = 0, .more = 1 },
+        { .options = CWS_TEXT | CWS_REF | CWS_PRIO_HIGH, .data = "random data", .len = 11, .rv = CWSE_OK,                .seen = 0, .more = 2 },
+        { .options = CWS_TEXT | CWS_REF | CWS_PRIO_HIGH, .data = "random data", .len = 11, .rv = CWSE_SEND_QUEUE_FULL,   .seen = 0, .more = 3 },
+        { .options = CWS_TEXT | CWS_REF | CWS_PRIO_HIGH, .data = "random data", .len = 11, .rv = CWSE_OK,                .seen = 0, .more = 0 },
+    };
+    // clang-format on
+    __data_block_sender = &test[0];
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_prepared(&ws[0], NULL, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_send_prepared(NULL, msg, NULL));
+
+    __send_msg_hold = NULL;
+    CU_ASSERT(CWSE_OK == cws_send_prepared(&ws[0], msg, NULL));
+    CU_ASSERT(msg == __send_msg_hold);
+    CU_ASSERT(false == __send_msg_has_tag);
+
+    group = cws_group_create();
+    CU_ASSERT_FATAL(NULL != group);
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_add(NULL, &ws[0]));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_add(group, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_remove(NULL, &ws[0]));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_remove(group, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_broadcast(NULL, msg, NULL, NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_broadcast(group, NULL, NULL, NULL));
+
+    for (int i = 0; i < 3; i++) {
+        CU_ASSERT(CWSE_OK == cws_group_add(group, &ws[i]));
+    }
+
+    /* One handle can't take the message; the others still get it. */
+    opts.priority = CWS_PRIO_HIGH;
+    opts.msg_id   = &msg_id;
+    CU_ASSERT(CWSE_SEND_QUEUE_FULL == cws_group_broadcast(group, msg, &opts, &queued));
+    CU_ASSERT(2 == queued);
+    CU_ASSERT(0 == msg_id);
+    CU_ASSERT(NULL == __data_block_sender);
+
+    CU_ASSERT(CWSE_OK == cws_group_remove(group, &ws[1]));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_group_remove(group, &ws[1]));
+
+    cws_group_destroy(group);
+    cws_group_destroy(NULL);
+    CU_ASSERT(NULL == ws[0].groups);
+
+    cws_prepared_release(msg);
+    cws_prepared_release(NULL);
+}
+
+
+void test_cork()
+{
+    CWS ws;
+
+    memset(&ws, 0, sizeof(CWS));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_cork(NULL, 0));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_uncork(NULL));
+
+    CU_ASSERT(CWSE_OK == cws_cork(&ws, 250));
+    CU_ASSERT(250 == __send_cork);
+    CU_ASSERT(CWSE_OK == cws_uncork(&ws));
+    CU_ASSERT(1 == __send_uncork);
+}
+
+
+void test_pause_recv()
+{
+    CWS ws;
+
+    memset(&ws, 0, sizeof(CWS));
+
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_pause_recv(NULL));
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == cws_resume_recv(NULL));
+
+    CU_ASSERT(CWSE_OK == cws_pause_recv(&ws));
+    CU_ASSERT(1 == __receive_pause);
+    CU_ASSERT(CWSE_OK == cws_resume_recv(&ws));
+    CU_ASSERT(1 == __receive_resume);
+}
+
+
 void test_bin_stream()
 {
     CWS ws;
@@ -750,6 +1301,10 @@ void test_bin_stream()
     CU_ASSERT(CWSE_OK == cws_send_strm_binary(&ws, 0, "mid", 3));
     CU_ASSERT(CWSE_OK == cws_send_strm_binary(&ws, CWS_LAST, "bye", 3));
     ws.last_sent_data_frame_info = 0;
+
+    __send_is_full = true;
+    CU_ASSERT(CWSE_SEND_QUEUE_FULL == cws_send_strm_binary(&ws, CWS_FIRST | CWS_LAST, "hi", 2));
+    __send_is_full = false;
 }
 
 void test_txt_stream()
@@ -817,6 +1372,7 @@ void add_suites(CU_pSuite *suite)
         { .label = "create: ws protos Tests",     .fn = test_create_ws_protos      },
         { .label = "create: expect Tests",        .fn = test_create_expect         },
         { .label = "create: payload size Tests",  .fn = test_create_payload_size   },
+        { .label = "create: watermarks Tests",    .fn = test_create_watermarks     },
         { .label = "create: extra headers Tests", .fn = test_create_extra_headers  },
         { .label = "create: curl version Tests",  .fn = test_create_curl_version   },
         { .label = "create: verbose Tests",       .fn = test_create_verbose        },
@@ -825,6 +1381,16 @@ void add_suites(CU_pSuite *suite)
         { .label = "cws_close Tests",       .fn = test_close          },
         { .label = "cws_ping/pong Tests",   .fn = test_ping_pong      },
         { .label = "cws_send_blk Tests",    .fn = test_send_blk       },
+        { .label = "cws_send_msg Tests",    .fn = test_send_msg       },
+        { .label = "cws_send_ref Tests",    .fn = test_send_ref       },
+        { .label = "cws_send_iov Tests",    .fn = test_send_iov       },
+        { .label = "cws_cancel_msg Tests",  .fn = test_cancel_msg     },
+        { .label = "cws_send_producer Tests", .fn = test_send_producer },
+        { .label = "cws_send_fd Tests",     .fn = test_send_fd        },
+        { .label = "prepared Tests",        .fn = test_prepared       },
+        { .label = "batch Tests",           .fn = test_batch          },
+        { .label = "cork Tests",            .fn = test_cork           },
+        { .label = "pause receive Tests",   .fn = test_pause_recv     },
         { .label = "bin stream Tests",      .fn = test_bin_stream     },
         { .label = "txt stream Tests",      .fn = test_txt_stream     },
         { .label = "multi handles Tests",   .fn = test_multi_handles  },
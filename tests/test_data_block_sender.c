@@ -4,11 +4,13 @@
  * SPDX-License-Identifier: MIT
  */
 #include <CUnit/Basic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "../src/data_block_sender.h"
+#include "../src/frame_senders.h"
 #include "../src/internal.h"
 #include "../src/ws.h"
 
@@ -47,6 +49,49 @@ CWScode frame_sender_data(CWS *priv, int options, const void *data, size_t len)
     return rv;
 }
 
+/* Joins the payload from the segments so the same mock vectors can be
+ * used, and checks the payload really spans the segments it claims to. */
+static int __iov_frames_spanning = 0;
+CWScode frame_sender_data_iov(CWS *priv, int options, const struct cws_iov *iov,
+                              size_t skip, size_t len)
+{
+    uint8_t buf[64];
+    size_t got = 0;
+
+    CU_ASSERT_FATAL(len <= sizeof(buf));
+
+    while (iov->len <= skip && len) {
+        skip -= iov->len;
+        iov++;
+    }
+    if (skip + len > iov->len) {
+        __iov_frames_spanning++;
+    }
+
+    while (got < len) {
+        size_t lesser = iov->len - skip;
+
+        if (len - got < lesser) {
+            lesser = len - got;
+        }
+        memcpy(&buf[got], &((const uint8_t *) iov->base)[skip], lesser);
+        got += lesser;
+        skip = 0;
+        iov++;
+    }
+
+    return frame_sender_data(priv, options, (len) ? buf : NULL, len);
+}
+
+
+static bool __send_is_full = false;
+bool send_is_full(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    return __send_is_full;
+}
+
+
 void test_data_block_sender()
 {
     CWS priv;
@@ -62,6 +107,10 @@ void test_data_block_sender()
     CU_ASSERT(CWSE_CLOSED_CONNECTION == data_block_sender(&priv, CWS_TEXT, NULL, 0));
 
     priv.close_state = 0;
+    __send_is_full   = true;
+    CU_ASSERT(CWSE_SEND_QUEUE_FULL == data_block_sender(&priv, CWS_TEXT, "ignore", 6));
+    __send_is_full = false;
+
     do {
         struct mock vector = {
             .rv      = CWSE_OK,
@@ -173,6 +222,53 @@ void test_data_block_sender()
         CU_ASSERT(1 == vector[2].seen);
     } while (0);
 
+    do {
+        // clang-format off
+        struct mock vector[] = {
+            {
+                .rv = CWSE_OK,
+                .options = CWS_TEXT | CWS_FIRST | CWS_PRIO_BULK | CWS_REF,
+                .data = "0123456789",
+                .len = 10,
+                .seen = 0,
+                .next = NULL,
+            },
+            {
+                .rv = CWSE_OK,
+                .options = CWS_CONT | CWS_LAST | CWS_PRIO_BULK | CWS_REF,
+                .data = "abc",
+                .len = 3,
+                .seen = 0,
+                .next = NULL,
+            }
+        };
+        // clang-format on
+        vector[0].next = &vector[1];
+
+        __goal = &vector[0];
+        CU_ASSERT(CWSE_OK == data_block_sender(&priv, CWS_TEXT | CWS_PRIO_BULK | CWS_REF, "0123456789abc", 13));
+        CU_ASSERT(1 == vector[0].seen);
+        CU_ASSERT(1 == vector[1].seen);
+    } while (0);
+
+    do {
+        struct mock vector = {
+            .rv      = CWSE_OK,
+            .options = CWS_BINARY | CWS_FIRST | CWS_LAST | CWS_REF,
+            .data    = "0123456789abcdefghij9876543",
+            .len     = 27,
+            .seen    = 0,
+            .next    = NULL,
+        };
+
+        /* Only a referenced payload can be sent as one frame. */
+        CU_ASSERT(CWSE_INVALID_OPTIONS == data_block_sender(&priv, CWS_BINARY | CWS_WHOLE, "0123456789abc", 13));
+
+        __goal = &vector;
+        CU_ASSERT(CWSE_OK == data_block_sender(&priv, CWS_BINARY | CWS_WHOLE | CWS_REF, "0123456789abcdefghij9876543", 27));
+        CU_ASSERT(1 == vector.seen);
+    } while (0);
+
     do {
         // clang-format off
         struct mock vector[] = {
@@ -204,14 +300,85 @@ void test_data_block_sender()
 }
 
 
+void test_data_block_sender_iov()
+{
+    CWS priv;
+
+    // clang-format off
+    struct cws_iov iov[] = {
+        { .base = "0123",          .len = 4 },
+        { .base = NULL,            .len = 0 },
+        { .base = "456789abcdefg", .len = 13 },
+        { .base = "hij98",         .len = 5 },
+        { .base = "76543",         .len = 5 },
+    };
+    struct mock vector[] = {
+        {
+            .rv = CWSE_OK,
+            .options = CWS_BINARY | CWS_FIRST,
+            .data = "0123456789",
+            .len = 10,
+            .seen = 0,
+            .next = NULL,
+        },
+        {
+            .rv = CWSE_OK,
+            .options = CWS_CONT,
+            .data = "abcdefghij",
+            .len = 10,
+            .seen = 0,
+            .next = NULL,
+        },
+        {
+            .rv = CWSE_OK,
+            .options = CWS_CONT | CWS_LAST,
+            .data = "9876543",
+            .len = 7,
+            .seen = 0,
+            .next = NULL,
+        }
+    };
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    priv.cfg.max_payload_size = 10;
+
+    CU_ASSERT(CWSE_INVALID_OPTIONS == data_block_sender_iov(&priv, CWS_CONT, iov, 5));
+
+    vector[0].next = &vector[1];
+    vector[1].next = &vector[2];
+
+    __goal                = &vector[0];
+    __iov_frames_spanning = 0;
+    CU_ASSERT(CWSE_OK == data_block_sender_iov(&priv, CWS_BINARY, iov, 5));
+    CU_ASSERT(1 == vector[0].seen);
+    CU_ASSERT(1 == vector[1].seen);
+    CU_ASSERT(1 == vector[2].seen);
+    CU_ASSERT(3 == __iov_frames_spanning);
+
+    /* No segments is an empty message. */
+    vector[2].options = CWS_BINARY | CWS_FIRST | CWS_LAST;
+    vector[2].data    = NULL;
+    vector[2].len     = 0;
+    vector[2].seen    = 0;
+    __goal            = &vector[2];
+    CU_ASSERT(CWSE_OK == data_block_sender_iov(&priv, CWS_BINARY, NULL, 0));
+    CU_ASSERT(1 == vector[2].seen);
+
+    /* A single frame can't span segments without copying them. */
+    CU_ASSERT(CWSE_INVALID_OPTIONS == data_block_sender_iov(&priv, CWS_BINARY | CWS_WHOLE | CWS_REF, iov, 5));
+}
+
+
 void add_suites(CU_pSuite *suite)
 {
     struct {
         const char *label;
         void (*fn)(void);
     } tests[] = {
-        {.label = "data_block_sender() Tests", .fn = test_data_block_sender},
-        {                       .label = NULL,                   .fn = NULL}
+        {    .label = "data_block_sender() Tests",     .fn = test_data_block_sender},
+        {.label = "data_block_sender_iov() Tests", .fn = test_data_block_sender_iov},
+        {                           .label = NULL,                       .fn = NULL}
     };
     int i;
 
@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "../src/frame.h"
+#include "../src/mask.h"
 
 
 void test_validate()
@@ -341,8 +342,11 @@ void test_encode()
     };
     size_t rv;
 
-    rv = frame_encode(&f, buffer, 256);
-    CU_ASSERT(sizeof(expect) == rv);
+    /* The header is encoded first and the payload masked in after it, as
+     * the send queue does. */
+    rv = frame_encode_header(&f, buffer, 256);
+    CU_ASSERT_FATAL(6 == rv);
+    mask_copy(&buffer[rv], f.payload, f.payload_len, f.masking_key, 0);
 
     for (size_t i = 0; i < sizeof(expect); i++) {
         if (expect[i] != buffer[i]) {
@@ -368,16 +372,44 @@ void test_encode_too_short()
     };
     size_t rv;
 
-    rv = frame_encode(&f, buffer, 1);
+    rv = frame_encode_header(&f, buffer, 1);
     CU_ASSERT(0 == rv);
 
     /* Header is 6, payload is 0x10000, so there are
      * extra length bytes needed */
-    rv = frame_encode(&f, buffer, 0x10000 + 7);
+    rv = frame_encode_header(&f, buffer, 7);
     CU_ASSERT(0 == rv);
 }
 
 
+void test_encode_header()
+{
+    // clang-format off
+    const uint8_t expect[] = { 0x81, 0xfe,                 /* base header */
+                               0x01, 0x00,                 /* payload len */
+                               0x01, 0x02, 0x03, 0x04 };   /* mask */
+    // clang-format on
+    uint8_t buffer[WS_FRAME_HEADER_MAX];
+
+    struct cws_frame f = {
+        .fin         = 1,
+        .mask        = 1,
+        .is_control  = 0,
+        .opcode      = WS_OPCODE_TEXT,
+        .masking_key = {1, 2, 3, 4},
+        .payload_len = 0x100,
+        .payload     = NULL,
+    };
+
+    CU_ASSERT(0 == frame_encode_header(&f, buffer, sizeof(expect) - 1));
+    CU_ASSERT(sizeof(expect) == frame_encode_header(&f, buffer, sizeof(buffer)));
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+
+    f.payload_len = 0x10000;
+    CU_ASSERT(WS_FRAME_HEADER_MAX == frame_encode_header(&f, buffer, sizeof(buffer)));
+}
+
+
 void test_encode_long()
 {
     // clang-format off
@@ -431,8 +463,9 @@ void test_encode_long()
 
     f.payload = payload;
 
-    rv = frame_encode(&f, buffer1, 0x10000 + 14);
-    CU_ASSERT((0x10000 + 14) == rv);
+    rv = frame_encode_header(&f, buffer1, 0x10000 + 14);
+    CU_ASSERT_FATAL(14 == rv);
+    mask_copy(&buffer1[rv], f.payload, f.payload_len, f.masking_key, 0);
     CU_ASSERT(0xa5 == buffer1[0x10000+14]);
 
     for (i = 0; i < (0x10000+14); i++) {
@@ -444,8 +477,9 @@ void test_encode_long()
 
 
     f.payload_len = 0x01000;
-    rv = frame_encode(&f, buffer2, 0x01000 + 8);
-    CU_ASSERT((0x01000 + 8) == rv);
+    rv = frame_encode_header(&f, buffer2, 0x01000 + 8);
+    CU_ASSERT_FATAL(8 == rv);
+    mask_copy(&buffer2[rv], f.payload, f.payload_len, f.masking_key, 0);
     CU_ASSERT(0xa5 == buffer2[0x01000+8]);
 
     for (i = 0; i < sizeof(expect2); i++) {
@@ -514,6 +548,7 @@ void add_suites( CU_pSuite *suite )
     } tests[] = {
         { .label = "Basic Encode Tests",       .fn = test_encode           },
         { .label = "Encode Too Short Tests",   .fn = test_encode_too_short },
+        { .label = "Encode Header Tests",      .fn = test_encode_header    },
         { .label = "Encode Long Buffer Tests", .fn = test_encode_long      },
         { .label = "Basic Decode Tests",       .fn = test_decode           },
         { .label = "Basic Validate Tests",     .fn = test_validate         },
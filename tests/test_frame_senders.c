@@ -37,6 +37,10 @@ CWScode send_frame(CWS *priv, const struct cws_frame *f)
     CU_ASSERT(__send_frame_frame.masking_key[2] == f->masking_key[2]);
     CU_ASSERT(__send_frame_frame.masking_key[3] == f->masking_key[3]);
     CU_ASSERT(__send_frame_frame.payload_len == f->payload_len);
+    CU_ASSERT(__send_frame_frame.priority == f->priority);
+    CU_ASSERT(__send_frame_frame.is_ref == f->is_ref);
+    CU_ASSERT(__send_frame_frame.iov == f->iov);
+    CU_ASSERT(__send_frame_frame.iov_skip == f->iov_skip);
     if (NULL == __send_frame_frame.payload) {
         CU_ASSERT(NULL == f->payload);
     } else {
@@ -135,6 +139,63 @@ void test_frame_sender_data()
     CU_ASSERT(CWSE_OK == frame_sender_data(&priv, CWS_CONT | CWS_LAST, "H", 1));
 
     CU_ASSERT(CWSE_STREAM_CONTINUITY_ISSUE == frame_sender_data(&priv, CWS_CONT, "ignore", 5));
+
+    /* Priority classes */
+    CU_ASSERT(CWSE_INVALID_OPTIONS == frame_sender_data(&priv, CWS_TEXT | CWS_FIRST | CWS_PRIO_HIGH | CWS_PRIO_BULK, "H", 1));
+
+    __send_frame_frame.opcode   = WS_OPCODE_TEXT;
+    __send_frame_frame.priority = CWS_PRIO_BULK;
+    CU_ASSERT(CWSE_OK == frame_sender_data(&priv, CWS_TEXT | CWS_FIRST | CWS_LAST | CWS_PRIO_BULK, "H", 1));
+
+    __send_frame_frame.priority = CWS_PRIO_HIGH;
+    CU_ASSERT(CWSE_OK == frame_sender_data(&priv, CWS_TEXT | CWS_FIRST | CWS_LAST | CWS_PRIO_HIGH, "H", 1));
+    __send_frame_frame.priority = CWS_PRIO_NORMAL;
+
+    /* Referenced payloads */
+    __send_frame_frame.is_ref = 1;
+    CU_ASSERT(CWSE_OK == frame_sender_data(&priv, CWS_TEXT | CWS_FIRST | CWS_LAST | CWS_REF, "H", 1));
+    CU_ASSERT((CWS_TEXT | CWS_FIRST | CWS_LAST) == priv.last_sent_data_frame_info);
+    __send_frame_frame.is_ref = 0;
+}
+
+
+void test_frame_sender_data_iov()
+{
+    CWS priv;
+
+    // clang-format off
+    struct cws_iov iov[] = {
+        { .base = "abc", .len = 3 },
+        { .base = NULL,  .len = 0 },
+        { .base = "def", .len = 3 },
+    };
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    memset(&__send_frame_frame, 0, sizeof(__send_frame_frame));
+
+    __send_frame_frame.fin            = 1;
+    __send_frame_frame.mask           = 1;
+    __send_frame_frame.opcode         = WS_OPCODE_BINARY;
+    __send_frame_frame.masking_key[0] = 0;
+    __send_frame_frame.masking_key[1] = 1;
+    __send_frame_frame.masking_key[2] = 2;
+    __send_frame_frame.masking_key[3] = 3;
+
+    /* Within one segment (even after skipping past the first ones) the
+     * payload is used directly. */
+    __send_frame_frame.payload_len = 2;
+    __send_frame_frame.payload     = "";
+    CU_ASSERT(CWSE_OK == frame_sender_data_iov(&priv, CWS_BINARY | CWS_FIRST | CWS_LAST, iov, 4, 2));
+
+    /* Spanning segments points at the segments instead. */
+    __send_frame_frame.payload_len = 4;
+    __send_frame_frame.payload     = NULL;
+    __send_frame_frame.iov         = iov;
+    __send_frame_frame.iov_skip    = 1;
+    CU_ASSERT(CWSE_OK == frame_sender_data_iov(&priv, CWS_BINARY | CWS_FIRST | CWS_LAST, iov, 1, 4));
+
+    memset(&__send_frame_frame, 0, sizeof(__send_frame_frame));
 }
 
 
@@ -144,9 +205,10 @@ void add_suites(CU_pSuite *suite)
         const char *label;
         void (*fn)(void);
     } tests[] = {
-        {.label = "frame_sender_control() Tests", .fn = test_frame_sender_control},
-        {   .label = "frame_sender_data() Tests",    .fn = test_frame_sender_data},
-        {                          .label = NULL,                      .fn = NULL}
+        { .label = "frame_sender_control() Tests",  .fn = test_frame_sender_control},
+        {    .label = "frame_sender_data() Tests",     .fn = test_frame_sender_data},
+        {.label = "frame_sender_data_iov() Tests", .fn = test_frame_sender_data_iov},
+        {                           .label = NULL,                       .fn = NULL}
     };
     int i;
 
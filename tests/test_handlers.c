@@ -51,6 +51,57 @@ int on_pong(void *user, CWS *handle, const void *p, size_t len)
     return __on_pong_rv;
 }
 
+static size_t __on_binary_len     = 0;
+static const void *__on_binary_buf = NULL;
+static uint64_t __on_binary_sum    = 0;
+int on_binary(void *user, CWS *handle, const void *p, size_t len)
+{
+    IGNORE_UNUSED(user);
+    IGNORE_UNUSED(handle);
+    __on_binary_buf = p;
+    __on_binary_len = len;
+    __on_binary_sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        __on_binary_sum += (i + 1) * ((const uint8_t *) p)[i];
+    }
+
+    return 0;
+}
+
+static uint8_t __user_buffer[16];
+static size_t __get_buffer_expected = 0;
+static bool __get_buffer_none       = false;
+void *get_buffer(void *user, CWS *handle, size_t expected_len, size_t *size)
+{
+    IGNORE_UNUSED(user);
+    IGNORE_UNUSED(handle);
+    __get_buffer_expected = expected_len;
+
+    if (__get_buffer_none) {
+        return NULL;
+    }
+    *size = sizeof(__user_buffer);
+    return __user_buffer;
+}
+
+static int __on_spilled_fd       = -1;
+static size_t __on_spilled_len   = 0;
+static uint64_t __on_spilled_sum = 0;
+int on_spilled(void *user, CWS *handle, int type, int fd, const void *p, size_t len)
+{
+    IGNORE_UNUSED(user);
+    IGNORE_UNUSED(handle);
+    CU_ASSERT(CWS_BINARY == type);
+    __on_spilled_fd  = fd;
+    __on_spilled_len = len;
+    __on_spilled_sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        __on_spilled_sum += (i + 1) * ((const uint8_t *) p)[i];
+    }
+
+    return 0;
+}
+
 /*----------------------------------------------------------------------------*/
 /*                               Test Functions                               */
 /*----------------------------------------------------------------------------*/
@@ -70,6 +121,11 @@ void test_populate_callbacks()
     CU_ASSERT(priv.cb.on_ping_fn == _default_on_ping);
     CU_ASSERT(priv.cb.on_pong_fn == NULL);
     CU_ASSERT(priv.cb.on_close_fn == NULL);
+    CU_ASSERT(priv.cb.on_sent_fn == NULL);
+    CU_ASSERT(priv.cb.on_drain_fn == NULL);
+    CU_ASSERT(priv.cb.get_buffer_fn == NULL);
+    CU_ASSERT(priv.cb.on_spilled_fn == NULL);
+    CU_ASSERT(priv.cb.on_messages_fn == NULL);
 
     populate_callbacks(&priv.cb, &src);
 
@@ -81,6 +137,11 @@ void test_populate_callbacks()
     src.on_pong     = (int (*)(void *, CWS *, const void *, size_t)) 6;
     src.on_close    = (int (*)(void *, CWS *, int, const char *, size_t)) 7;
     src.configure   = (CURLcode(*)(void *, CWS *, CURL *)) 8;
+    src.on_sent     = (void (*)(void *, CWS *, void *, CWScode)) 9;
+    src.on_drain    = (void (*)(void *, CWS *)) 10;
+    src.get_buffer  = (void *(*) (void *, CWS *, size_t, size_t *) ) 11;
+    src.on_spilled  = (int (*)(void *, CWS *, int, int, const void *, size_t)) 12;
+    src.on_messages = (int (*)(void *, CWS *, const struct cws_message *, size_t)) 13;
 
     populate_callbacks(&priv.cb, &src);
     CU_ASSERT(priv.cb.on_connect_fn == (int (*)(void *, CWS *, const char *)) 1);
@@ -90,6 +151,16 @@ void test_populate_callbacks()
     CU_ASSERT(priv.cb.on_ping_fn == (int (*)(void *, CWS *, const void *, size_t)) 5);
     CU_ASSERT(priv.cb.on_pong_fn == (int (*)(void *, CWS *, const void *, size_t)) 6);
     CU_ASSERT(priv.cb.on_close_fn == (int (*)(void *, CWS *, int, const char *, size_t)) 7);
+    CU_ASSERT(priv.cb.on_sent_fn == (void (*)(void *, CWS *, void *, CWScode)) 9);
+    CU_ASSERT(priv.cb.on_drain_fn == (void (*)(void *, CWS *)) 10);
+    CU_ASSERT(priv.cb.get_buffer_fn == (void *(*) (void *, CWS *, size_t, size_t *) ) 11);
+    CU_ASSERT(priv.cb.on_spilled_fn == (int (*)(void *, CWS *, int, int, const void *, size_t)) 12);
+
+    /* Only used by the default (*on_fragment). */
+    CU_ASSERT(priv.cb.on_messages_fn == NULL);
+    src.on_fragment = NULL;
+    populate_callbacks(&priv.cb, &src);
+    CU_ASSERT(priv.cb.on_messages_fn == (int (*)(void *, CWS *, const struct cws_message *, size_t)) 13);
 }
 
 
@@ -153,6 +224,193 @@ void test_close_on_rv()
 }
 
 
+void test_reassembly()
+{
+    CWS priv;
+    uint8_t frag[100];
+    uint64_t sum = 0;
+
+    memset(&priv, 0, sizeof(priv));
+    populate_callbacks(&priv.cb, NULL);
+    priv.cb.on_binary_fn      = on_binary;
+    priv.cfg.recv_buffer_keep = 4096;
+
+    /* 1000 fragments, with the buffer doubling instead of growing each
+     * time. */
+    for (int i = 0; i < 1000; i++) {
+        int info = (0 == i) ? (CWS_BINARY | CWS_FIRST) : CWS_CONT;
+
+        if (999 == i) {
+            info |= CWS_LAST;
+        }
+        memset(frag, i, sizeof(frag));
+        for (size_t j = 0; j < sizeof(frag); j++) {
+            sum += (i * sizeof(frag) + j + 1) * frag[j];
+        }
+        cb_on_fragment(&priv, info, frag, sizeof(frag));
+        CU_ASSERT(0 == (priv.stream_buffer_size & (priv.stream_buffer_size - 1)));
+    }
+    CU_ASSERT(100000 == __on_binary_len);
+    CU_ASSERT(sum == __on_binary_sum);
+
+    /* Too big to keep. */
+    CU_ASSERT(NULL == priv.stream_buffer);
+    CU_ASSERT(0 == priv.stream_buffer_size);
+
+    /* A small buffer is kept for the next message. */
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, frag, 10);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, frag, 10);
+    CU_ASSERT(20 == __on_binary_len);
+    CU_ASSERT(NULL != priv.stream_buffer);
+    CU_ASSERT(1024 == priv.stream_buffer_size);
+    CU_ASSERT(0 == priv.stream_buffer_len);
+
+    /* An empty message is delivered without a buffer. */
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, NULL, 0);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, NULL, 0);
+    CU_ASSERT(0 == __on_binary_len);
+    CU_ASSERT(NULL == __on_binary_buf);
+
+    free(priv.stream_buffer);
+}
+
+
+void test_user_buffer()
+{
+    CWS priv;
+    struct cws_frame frame;
+
+    memset(&priv, 0, sizeof(priv));
+    memset(&frame, 0, sizeof(frame));
+    populate_callbacks(&priv.cb, NULL);
+    priv.cb.on_binary_fn      = on_binary;
+    priv.cb.get_buffer_fn     = get_buffer;
+    priv.cfg.recv_buffer_keep = 4096;
+    priv.recv.frame           = &frame;
+
+    /* The final frame tells how long the message is. */
+    frame.fin         = 1;
+    frame.payload_len = 5;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, "abc", 3);
+    CU_ASSERT(8 == __get_buffer_expected);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, "defgh", 5);
+    CU_ASSERT(__user_buffer == __on_binary_buf);
+    CU_ASSERT(8 == __on_binary_len);
+    CU_ASSERT(0 == memcmp(__user_buffer, "abcdefgh", 8));
+    CU_ASSERT(NULL == priv.stream_buffer);
+
+    /* A whole message is copied out of curl's buffer too. */
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST | CWS_LAST, "wxyz", 4);
+    CU_ASSERT(4 == __get_buffer_expected);
+    CU_ASSERT(__user_buffer == __on_binary_buf);
+    CU_ASSERT(0 == memcmp(__user_buffer, "wxyz", 4));
+
+    /* Other frames follow, so the length isn't known. */
+    frame.fin       = 0;
+    __on_binary_buf = NULL;
+    __close_called  = 0;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, "0123456789", 10);
+    CU_ASSERT(0 == __get_buffer_expected);
+
+    /* The message doesn't fit, so it is dropped. */
+    cb_on_fragment(&priv, CWS_CONT, "0123456789", 10);
+    CU_ASSERT(1 == __close_called);
+    CU_ASSERT(1009 == __close_code);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, "0", 1);
+    CU_ASSERT(NULL == __on_binary_buf);
+
+    /* The library's buffer is used when there is no buffer. */
+    __get_buffer_none = true;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, "abc", 3);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, "def", 3);
+    CU_ASSERT(NULL != __on_binary_buf);
+    CU_ASSERT(priv.stream_buffer == __on_binary_buf);
+    CU_ASSERT(6 == __on_binary_len);
+
+    free(priv.stream_buffer);
+}
+
+
+void test_spilled()
+{
+    CWS priv;
+    uint8_t frag[1000];
+    uint64_t sum = 0;
+
+    memset(&priv, 0, sizeof(priv));
+    populate_callbacks(&priv.cb, NULL);
+    priv.cb.on_binary_fn      = on_binary;
+    priv.cfg.recv_buffer_keep = 4096;
+    priv.cfg.spill_threshold  = 2500;
+    priv.cfg.spill_dir        = "/tmp";
+
+    /* Past the threshold the message moves to a file and memory stops
+     * growing. */
+    for (int i = 0; i < 10; i++) {
+        int info = (0 == i) ? (CWS_BINARY | CWS_FIRST) : CWS_CONT;
+
+        if (9 == i) {
+            info |= CWS_LAST;
+        }
+        memset(frag, i + 1, sizeof(frag));
+        for (size_t j = 0; j < sizeof(frag); j++) {
+            sum += (i * sizeof(frag) + j + 1) * frag[j];
+        }
+        cb_on_fragment(&priv, info, frag, sizeof(frag));
+        if ((2 <= i) && (i < 9)) {
+            CU_ASSERT(true == priv.spill.open);
+        }
+        CU_ASSERT(priv.stream_buffer_size <= 4096);
+    }
+
+    /* Without (*on_spilled) the mapping goes to (*on_binary). */
+    CU_ASSERT(10000 == __on_binary_len);
+    CU_ASSERT(sum == __on_binary_sum);
+    CU_ASSERT(false == priv.spill.open);
+
+    /* With it the file is passed along too. */
+    priv.cb.on_spilled_fn = on_spilled;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, frag, sizeof(frag));
+    cb_on_fragment(&priv, CWS_CONT, frag, sizeof(frag));
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, frag, sizeof(frag));
+    CU_ASSERT(0 <= __on_spilled_fd);
+    CU_ASSERT(3000 == __on_spilled_len);
+    CU_ASSERT(false == priv.spill.open);
+
+    /* Small messages stay in memory. */
+    __on_spilled_len = 0;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, frag, 10);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, frag, 10);
+    CU_ASSERT(0 == __on_spilled_len);
+    CU_ASSERT(20 == __on_binary_len);
+
+    /* A file that can't be created closes the connection. */
+    priv.cfg.spill_dir = "/no/such/directory";
+    __close_called     = 0;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, frag, sizeof(frag));
+    cb_on_fragment(&priv, CWS_CONT, frag, sizeof(frag));
+    cb_on_fragment(&priv, CWS_CONT, frag, sizeof(frag));
+    CU_ASSERT(1 == __close_called);
+    CU_ASSERT(1011 == __close_code);
+
+    /* Once the message spills, the memory it used isn't kept past
+     * recv_buffer_keep. */
+    priv.cfg.spill_dir        = "/tmp";
+    priv.cfg.recv_buffer_keep = 1024;
+    cb_on_fragment(&priv, CWS_BINARY | CWS_FIRST, frag, sizeof(frag));
+    cb_on_fragment(&priv, CWS_CONT, frag, sizeof(frag));
+    CU_ASSERT(2048 == priv.stream_buffer_size);
+    cb_on_fragment(&priv, CWS_CONT, frag, sizeof(frag));
+    CU_ASSERT(true == priv.spill.open);
+    CU_ASSERT(NULL == priv.stream_buffer);
+    CU_ASSERT(0 == priv.stream_buffer_size);
+    cb_on_fragment(&priv, CWS_CONT | CWS_LAST, frag, sizeof(frag));
+    CU_ASSERT(4000 == __on_spilled_len);
+
+    free(priv.stream_buffer);
+}
+
+
 void test_defaults_dont_crash()
 {
     CWS priv;
@@ -260,6 +518,9 @@ void add_suites(CU_pSuite *suite)
         {.label = "Test populate_callbacks()",  .fn = test_populate_callbacks},
         {.label = "Test close on non-zero rv",         .fn = test_close_on_rv},
         {.label = "Test defaults don't crash", .fn = test_defaults_dont_crash},
+        {          .label = "Test reassembly",          .fn = test_reassembly},
+        { .label = "Test application buffers",         .fn = test_user_buffer},
+        {    .label = "Test spilled messages",             .fn = test_spilled},
         {                       .label = NULL,                     .fn = NULL}
     };
     int i;
@@ -0,0 +1,180 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/mask.c"
+
+#define MAX_LEN   300
+#define MAX_ALIGN 40
+
+static const uint8_t __key[4] = {0x12, 0x9a, 0xc3, 0x7f};
+
+/* Checks a kernel against the spec for every combination of length, payload
+ * offset and src/dst alignment, including masking in place. */
+static void check_kernel(mask_fn fn)
+{
+    static uint8_t src[MAX_LEN + MAX_ALIGN];
+    static uint8_t dst[MAX_LEN + MAX_ALIGN + 1];
+    static uint8_t tmp[MAX_LEN + MAX_ALIGN];
+
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (uint8_t) (i * 7 + 3);
+    }
+
+    for (size_t len = 0; len < MAX_LEN; len++) {
+        for (size_t offset = 0; offset < 8; offset++) {
+            for (size_t align = 0; align < MAX_ALIGN; align += 3) {
+                const uint8_t *s = &src[(align * 5) % MAX_ALIGN];
+                uint8_t *d       = &dst[align];
+                bool ok          = true;
+
+                memset(dst, 0xee, sizeof(dst));
+                fn(d, s, len, __key, offset);
+
+                for (size_t i = 0; i < len; i++) {
+                    if (d[i] != (s[i] ^ __key[0x3 & (offset + i)])) {
+                        ok = false;
+                    }
+                }
+                /* Nothing outside of the output was touched. */
+                for (size_t i = 0; i < align; i++) {
+                    if (0xee != dst[i]) {
+                        ok = false;
+                    }
+                }
+                if (0xee != d[len]) {
+                    ok = false;
+                }
+                if (!ok) {
+                    printf("len: %zu, offset: %zu, align: %zu\n", len, offset, align);
+                }
+                CU_ASSERT_FATAL(true == ok);
+
+                /* In place, then back again. */
+                memcpy(tmp, s, len);
+                fn(tmp, tmp, len, __key, offset);
+                CU_ASSERT_FATAL(0 == memcmp(tmp, d, len));
+                fn(tmp, tmp, len, __key, offset);
+                CU_ASSERT_FATAL(0 == memcmp(tmp, s, len));
+            }
+        }
+    }
+}
+
+
+void test_bytes()
+{
+    check_kernel(_mask_bytes);
+}
+
+
+void test_word()
+{
+    check_kernel(_mask_word);
+}
+
+
+void test_sse2()
+{
+#if MASK_X86
+    if (__builtin_cpu_supports("sse2")) {
+        check_kernel(_mask_sse2);
+    }
+#endif
+}
+
+
+void test_avx2()
+{
+#if MASK_X86
+    if (__builtin_cpu_supports("avx2")) {
+        check_kernel(_mask_avx2);
+    }
+#endif
+}
+
+
+void test_mask_copy()
+{
+    const uint8_t key[4] = {1, 2, 3, 4};
+    uint8_t buf[70];
+    uint8_t out[70];
+
+    memset(buf, 0, sizeof(buf));
+
+    /* Masking in pieces is the same as masking all at once. */
+    mask_copy(out, buf, sizeof(buf), key, 0);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        CU_ASSERT(key[i % 4] == out[i]);
+    }
+
+    memset(out, 0, sizeof(out));
+    mask_copy(out, buf, 3, key, 0);
+    mask_copy(&out[3], &buf[3], 50, key, 3);
+    mask_copy(&out[53], &buf[53], 17, key, 53);
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        CU_ASSERT(key[i % 4] == out[i]);
+    }
+
+    CU_ASSERT(NULL != __kernel);
+    check_kernel((mask_fn) __kernel);
+}
+
+
+void add_suites(CU_pSuite *suite)
+{
+    struct {
+        const char *label;
+        void (*fn)(void);
+    } tests[] = {
+        {.label = "byte kernel Tests",     .fn = test_bytes},
+        {.label = "word kernel Tests",      .fn = test_word},
+        {.label = "SSE2 kernel Tests",      .fn = test_sse2},
+        {.label = "AVX2 kernel Tests",      .fn = test_avx2},
+        {.label = "mask_copy() Tests", .fn = test_mask_copy},
+        {             .label = NULL,           .fn = NULL}
+    };
+    int i;
+
+    *suite = CU_add_suite("mask.c tests", NULL, NULL);
+
+    for (i = 0; NULL != tests[i].fn; i++) {
+        CU_add_test(*suite, tests[i].label, tests[i].fn);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+int main(void)
+{
+    unsigned rv     = 1;
+    CU_pSuite suite = NULL;
+
+    if (CUE_SUCCESS == CU_initialize_registry()) {
+        add_suites(&suite);
+
+        if (NULL != suite) {
+            CU_basic_set_mode(CU_BRM_VERBOSE);
+            CU_basic_run_tests();
+            printf("\n");
+            CU_basic_show_failures(CU_get_failure_list());
+            printf("\n\n");
+            rv = CU_get_number_of_tests_failed();
+        }
+
+        CU_cleanup_registry();
+    }
+
+    if (0 != rv) {
+        return 1;
+    }
+    return 0;
+}
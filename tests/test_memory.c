@@ -6,6 +6,7 @@
 #include <CUnit/Basic.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,7 +40,7 @@ void test_basic()
     memset(ctrl, 5, 128);
     ctrl_last = ctrl;
 
-    data = mem_alloc_data(pool);
+    data = mem_alloc_data(pool, 4096);
     CU_ASSERT(NULL != data);
     memset(data, 9, 4096);
     data_last = data;
@@ -50,7 +51,7 @@ void test_basic()
     ctrl = mem_alloc_ctrl(pool);
     CU_ASSERT(ctrl == ctrl_last);
 
-    data = mem_alloc_data(pool);
+    data = mem_alloc_data(pool, 4096);
     CU_ASSERT(data == data_last);
 
     mem_cleanup_pool(pool);
@@ -75,7 +76,7 @@ void test_lots()
         c[i] = mem_alloc_ctrl(pool);
         CU_ASSERT(NULL != c[i]);
 
-        d[i] = mem_alloc_data(pool);
+        d[i] = mem_alloc_data(pool, 4096);
         CU_ASSERT(NULL != d[i]);
     }
 
@@ -92,7 +93,7 @@ void test_lots()
         c[i] = mem_alloc_ctrl(pool);
         CU_ASSERT(NULL != c[i]);
 
-        d[i] = mem_alloc_data(pool);
+        d[i] = mem_alloc_data(pool, 4096);
         CU_ASSERT(NULL != d[i]);
     }
 
@@ -103,6 +104,48 @@ void test_lots()
 }
 
 
+void test_sizes()
+{
+    void *a, *b, *c;
+    pool_t *pool;
+    struct mem_pool_config cfg = {
+        .control_block_size = 128,
+        .data_block_size    = 100
+    };
+
+    pool = mem_init_pool(&cfg);
+    CU_ASSERT(NULL != pool);
+
+    /* Blocks are reused by any size that rounds to the same block size. */
+    a = mem_alloc_data(pool, 10);
+    CU_ASSERT(NULL != a);
+    memset(a, 1, 100);
+    mem_free(a);
+    b = mem_alloc_data(pool, 100);
+    CU_ASSERT(a == b);
+
+    c = mem_alloc_data(pool, 101);
+    CU_ASSERT(NULL != c);
+    CU_ASSERT(b != c);
+    memset(c, 2, 200);
+    mem_free(c);
+    mem_free(b);
+
+    b = mem_alloc_data(pool, 150);
+    CU_ASSERT(b == c);
+
+    a = mem_alloc_data(pool, 100000);
+    CU_ASSERT(NULL != a);
+    memset(a, 3, 100000);
+    mem_free(a);
+
+    /* Larger than the largest size. */
+    CU_ASSERT(NULL == mem_alloc_data(pool, SIZE_MAX));
+
+    mem_cleanup_pool(pool);
+}
+
+
 void add_suites(CU_pSuite *suite)
 {
     struct {
@@ -112,6 +155,7 @@ void add_suites(CU_pSuite *suite)
         {.label = "Basic Tests", .fn = test_basic},
         {.label = "Silly Tests", .fn = test_silly},
         { .label = "Lots Tests",  .fn = test_lots},
+        {.label = "Size Tests", .fn = test_sizes},
         {         .label = NULL,       .fn = NULL}
     };
     int i;
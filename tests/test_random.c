@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/internal.h"
+#include "../src/random.h"
+
+void test_seeded()
+{
+    CWS a, b;
+    uint8_t x[100], y[100];
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+
+    /* The same seed gives the same bytes however they are asked for. */
+    cws_random_seed(&a, 42);
+    cws_random_seed(&b, 42);
+    cws_random(&a, x, sizeof(x));
+    for (size_t i = 0; i < sizeof(y); i += 4) {
+        cws_random(&b, &y[i], 4);
+    }
+    CU_ASSERT(0 == memcmp(x, y, sizeof(x)));
+
+    /* Reseeding starts over. */
+    cws_random_seed(&b, 42);
+    cws_random(&b, y, 3);
+    CU_ASSERT(0 == memcmp(x, y, 3));
+
+    cws_random_seed(&b, 43);
+    cws_random(&b, y, sizeof(y));
+    CU_ASSERT(0 != memcmp(x, y, sizeof(x)));
+}
+
+
+void test_unseeded()
+{
+    CWS a, b;
+    uint8_t x[32], y[32], zero[32];
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    memset(zero, 0, sizeof(zero));
+
+    cws_random_seed(&a, 0);
+    cws_random_seed(&b, 0);
+    CU_ASSERT(0 != (a.rng.s[0] | a.rng.s[1] | a.rng.s[2] | a.rng.s[3]));
+
+    cws_random(&a, x, sizeof(x));
+    cws_random(&b, y, sizeof(y));
+    CU_ASSERT(0 != memcmp(x, y, sizeof(x)));
+    CU_ASSERT(0 != memcmp(x, zero, sizeof(x)));
+
+    /* Nothing asked for, nothing written. */
+    cws_random(&a, NULL, 0);
+}
+
+
+void add_suites(CU_pSuite *suite)
+{
+    struct {
+        const char *label;
+        void (*fn)(void);
+    } tests[] = {
+        {.label = "deterministic seeds",   .fn = test_seeded},
+        {  .label = "getrandom() seeds", .fn = test_unseeded},
+        {                 .label = NULL,          .fn = NULL}
+    };
+    int i;
+
+    *suite = CU_add_suite("random.c tests", NULL, NULL);
+
+    for (i = 0; NULL != tests[i].fn; i++) {
+        CU_add_test(*suite, tests[i].label, tests[i].fn);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+int main(void)
+{
+    unsigned rv     = 1;
+    CU_pSuite suite = NULL;
+
+    if (CUE_SUCCESS == CU_initialize_registry()) {
+        add_suites(&suite);
+
+        if (NULL != suite) {
+            CU_basic_set_mode(CU_BRM_VERBOSE);
+            CU_basic_run_tests();
+            printf("\n");
+            CU_basic_show_failures(CU_get_failure_list());
+            printf("\n\n");
+            rv = CU_get_number_of_tests_failed();
+        }
+
+        CU_cleanup_registry();
+    }
+
+    if (0 != rv) {
+        return 1;
+    }
+    return 0;
+}
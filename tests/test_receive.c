@@ -25,14 +25,30 @@ CURLcode curl_easy_setopt(CURL *easy, CURLoption option, ...)
 }
 
 
+static int __curl_pause_calls   = 0;
+static int __curl_pause_bitmask = 0;
 CURLcode curl_easy_pause(CURL *easy, int bitmask)
 {
     (void) easy;
-    (void) bitmask;
+    __curl_pause_calls++;
+    __curl_pause_bitmask = bitmask;
     return CURLE_OK;
 }
 
 
+void send_cork_check(CWS *priv)
+{
+    (void) priv;
+}
+
+
+static uint64_t __now = 0;
+uint64_t cws_now_usec(void)
+{
+    return __now;
+}
+
+
 struct mock_cws_close {
     int code;
     const char *reason;
@@ -551,32 +567,37 @@ void test_more_complex()
         .pong = (struct mock_pong[1]) {
             { .data = "pong", .len = 4, .seen = 0, .more = 0, },
         },
-        .stream = (struct mock_stream[25]) {
-            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "h",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "e",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "l",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "l",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "o",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT               | CWS_LAST, .len = 3, .data = "ᚅ",  .seen = 0, .more = 1, },
-            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_CONT               | CWS_LAST, .len = 4, .data = "𒀺",  .seen = 0, .more = 1, },
-            { .info = CWS_BINARY | CWS_FIRST,            .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "-",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "_",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "/",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "-",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "|",  .seen = 0, .more = 1, },
-            { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "h",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "i",  .seen = 0, .more = 1, },
-            { .info = CWS_BINARY | CWS_FIRST,            .len = 0, .data = NULL, .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "-",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "_",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "/",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT,                          .len = 1, .data = "-",  .seen = 0, .more = 1, },
-            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "|",  .seen = 0, .more = 0, },
+        .stream = (struct mock_stream[30]) {
+            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "h",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "e",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "l",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "l",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "o",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "\xe1", .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "\x9a", .seen = 0, .more = 1, },
+            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "\x85", .seen = 0, .more = 1, },
+            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "\xf0", .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "\x92", .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "\x80", .seen = 0, .more = 1, },
+            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "\xba", .seen = 0, .more = 1, },
+            { .info = CWS_BINARY | CWS_FIRST,            .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "-",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "_",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "/",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "-",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "|",    .seen = 0, .more = 1, },
+            { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_TEXT   | CWS_FIRST,            .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "h",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "i",    .seen = 0, .more = 1, },
+            { .info = CWS_BINARY | CWS_FIRST,            .len = 0, .data = NULL,   .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "-",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "_",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "/",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT,                          .len = 1, .data = "-",    .seen = 0, .more = 1, },
+            { .info = CWS_CONT               | CWS_LAST, .len = 1, .data = "|",    .seen = 0, .more = 0, },
         },
         .close = NULL,
     };
@@ -585,6 +606,277 @@ void test_more_complex()
     run_test(&test);
 }
 
+void test_header_split()
+{
+    // clang-format off
+    struct test_vector tests[] = {
+        {
+            .test_name = "Burst of small frames",
+            .in = "\x82\x01" "a"
+                  "\x89\x00"
+                  "\x82\x01" "b"
+                  "\x81\x02" "hi",
+            .blocks = (int[1]){ 12 },
+            .rv = (size_t[1]){ 12 },
+            .block_count = 1,
+
+            .ping = (struct mock_ping[1]) {
+                { .data = NULL, .len = 0, .seen = 0, .more = 0 },
+            },
+            .stream = (struct mock_stream[3]) {
+                { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 1, .data = "a",  .seen = 0, .more = 1, },
+                { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 1, .data = "b",  .seen = 0, .more = 1, },
+                { .info = CWS_TEXT   | CWS_FIRST | CWS_LAST, .len = 2, .data = "hi", .seen = 0, .more = 0, },
+            },
+        },
+        {
+            .test_name = "Headers split across buffers",
+            .in = "\x82\x01" "a"
+                  "\x82\x7e\x00\x7e"
+                  "0123456789012345678901234567890123456789012345678901234567890123"
+                  "01234567890123456789012345678901234567890123456789012345678901"
+                  "\x81\x02" "hi",
+            .blocks = (int[5]){ 4, 2, 127, 1, 3 },
+            .rv = (size_t[5]){ 4, 2, 127, 1, 3 },
+            .block_count = 5,
+
+            .stream = (struct mock_stream[3]) {
+                { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 1,   .data = "a",  .seen = 0, .more = 1, },
+                { .info = CWS_BINARY | CWS_FIRST | CWS_LAST, .len = 126, .data = NULL, .seen = 0, .more = 1, },
+                { .info = CWS_TEXT   | CWS_FIRST | CWS_LAST, .len = 2,   .data = "hi", .seen = 0, .more = 0, },
+            },
+        },
+    };
+    // clang-format on
+
+    run_test(&tests[0]);
+    run_test(&tests[1]);
+}
+
+
+void test_ping_flood()
+{
+    CWS priv;
+    const char ping[] = "\x89\x01p";
+
+    // clang-format off
+    struct mock_ping pings[4] = {
+        { .data = "p", .len = 1, .seen = 0, .more = 1 },
+        { .data = "p", .len = 1, .seen = 0, .more = 1 },
+        { .data = "p", .len = 1, .seen = 0, .more = 1 },
+        { .data = "p", .len = 1, .seen = 0, .more = 0 },
+    };
+    struct mock_cws_close close = {
+        .code = 1008,
+        .reason = "ping rate exceeded",
+        .len = SIZE_MAX,
+        .seen = 0,
+        .rv = CWSE_OK,
+        .more = 0,
+    };
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    priv.cb.on_ping_fn     = on_ping;
+    priv.cfg.max_ping_rate = 2;
+
+    __on_ping_goal = &pings[0];
+    __now          = 5000000;
+
+    /* Two per second are fine, even back to back. */
+    CU_ASSERT(3 == _receive_cb(ping, 3, 1, &priv));
+    CU_ASSERT(3 == _receive_cb(ping, 3, 1, &priv));
+    __now += 1000000;
+    CU_ASSERT(3 == _receive_cb(ping, 3, 1, &priv));
+    __now += 500000;
+    CU_ASSERT(3 == _receive_cb(ping, 3, 1, &priv));
+    CU_ASSERT(1 == pings[3].seen);
+    CU_ASSERT(0 == (CLOSE_RECEIVED & priv.close_state));
+
+    /* The third in the same second closes the connection. */
+    __cws_close_goal = &close;
+    CU_ASSERT(3 == _receive_cb(ping, 3, 1, &priv));
+    CU_ASSERT(1 == close.seen);
+    CU_ASSERT(NULL == __on_ping_goal);
+}
+
+
+void test_too_big()
+{
+    CWS priv;
+    const char first[] = "\x01\x03" "abc";
+    const char last[]  = "\x80\x03" "def";
+
+    // clang-format off
+    struct mock_stream stream[1] = {
+        { .info = CWS_TEXT | CWS_FIRST, .len = 3, .data = "abc", .seen = 0, .more = 0, },
+    };
+    struct mock_cws_close close = {
+        .code = 1009,
+        .reason = NULL,
+        .len = 0,
+        .seen = 0,
+        .rv = CWSE_OK,
+        .more = 0,
+    };
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    priv.cb.on_fragment_fn    = on_fragment;
+    priv.cfg.max_message_size = 5;
+
+    __on_fragment_goal = &stream[0];
+
+    /* The message fits so far. */
+    CU_ASSERT(5 == _receive_cb(first, 5, 1, &priv));
+    CU_ASSERT(1 == stream[0].seen);
+
+    /* The next frame's header is enough to know it doesn't. */
+    __cws_close_goal = &close;
+    CU_ASSERT(2 == _receive_cb(last, 2, 1, &priv));
+    CU_ASSERT(1 == close.seen);
+}
+
+
+static char __log[64];
+static int on_messages_log(void *data, CWS *handle, const struct cws_message *msgs, size_t count)
+{
+    (void) data;
+    (void) handle;
+
+    snprintf(&__log[strlen(__log)], sizeof(__log) - strlen(__log), "[");
+    for (size_t i = 0; i < count; i++) {
+        snprintf(&__log[strlen(__log)], sizeof(__log) - strlen(__log), "%c%.*s",
+                 (CWS_TEXT == msgs[i].type) ? 't' : 'b', (int) msgs[i].len,
+                 msgs[i].data ? (const char *) msgs[i].data : "");
+    }
+    snprintf(&__log[strlen(__log)], sizeof(__log) - strlen(__log), "]");
+
+    return 0;
+}
+
+
+static int on_ping_log(void *data, CWS *handle, const void *buffer, size_t len)
+{
+    (void) data;
+    (void) handle;
+    (void) buffer;
+    (void) len;
+
+    snprintf(&__log[strlen(__log)], sizeof(__log) - strlen(__log), "P");
+
+    return 0;
+}
+
+
+void test_batch()
+{
+    CWS priv;
+    // clang-format off
+    const char in[] = "\x82\x01" "a"
+                      "\x81\x02" "hi"
+                      "\x89\x00"
+                      "\x82\x01" "b"
+                      "\x81\x00"
+                      "\x02\x01" "c";
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    priv.cb.on_messages_fn = on_messages_log;
+    priv.cb.on_ping_fn     = on_ping_log;
+    priv.cb.on_fragment_fn = on_fragment;
+    __log[0]               = '\0';
+
+    /* One call for the messages before the PING and one for those after,
+     * while a fragment still goes to (*on_fragment). */
+    __on_fragment_goal = NULL;
+    CU_ASSERT(sizeof(in) - 1 == _receive_cb(in, sizeof(in) - 1, 1, &priv));
+    CU_ASSERT_STRING_EQUAL(__log, "[bathi]P[bbt]");
+}
+
+
+static bool __resume_in_cb = false;
+static int on_fragment_pause(void *data, CWS *handle, int info, const void *buffer, size_t len)
+{
+    (void) data;
+    (void) info;
+
+    snprintf(&__log[strlen(__log)], sizeof(__log) - strlen(__log), "%.*s", (int) len,
+             (const char *) buffer);
+
+    if ((1 == len) && ('a' == *(const char *) buffer)) {
+        receive_pause(handle);
+        if (__resume_in_cb) {
+            receive_resume(handle);
+        }
+    }
+
+    return 0;
+}
+
+
+void test_pause()
+{
+    CWS priv;
+    // clang-format off
+    const char in[] = "\x82\x01" "a"
+                      "\x82\x01" "b"
+                      "\x82\x01" "c";
+    // clang-format on
+
+    memset(&priv, 0, sizeof(CWS));
+    priv.cb.on_fragment_fn = on_fragment_pause;
+    __log[0]               = '\0';
+    __curl_pause_calls     = 0;
+    __resume_in_cb         = false;
+
+    /* Pausing from a callback keeps the rest of the buffer and pauses curl
+     * once, after the buffer is done. */
+    CU_ASSERT(sizeof(in) - 1 == _receive_cb(in, sizeof(in) - 1, 1, &priv));
+    CU_ASSERT_STRING_EQUAL(__log, "a");
+    CU_ASSERT(1 == __curl_pause_calls);
+    CU_ASSERT(CURLPAUSE_RECV == __curl_pause_bitmask);
+    CU_ASSERT(6 == priv.recv.pending.len);
+
+    /* curl is told to hold on to anything it hands over while paused. */
+    CU_ASSERT(CURL_WRITEFUNC_PAUSE == _receive_cb(in, 3, 1, &priv));
+
+    /* Resuming delivers what was kept before unpausing curl. */
+    receive_resume(&priv);
+    CU_ASSERT_STRING_EQUAL(__log, "abc");
+    CU_ASSERT(2 == __curl_pause_calls);
+    CU_ASSERT(0 == __curl_pause_bitmask);
+    CU_ASSERT(NULL == priv.recv.pending.buf);
+    CU_ASSERT(0 == priv.pause_flags);
+
+    /* Resuming again or pausing twice does nothing more. */
+    receive_resume(&priv);
+    CU_ASSERT(2 == __curl_pause_calls);
+    receive_pause(&priv);
+    receive_pause(&priv);
+    CU_ASSERT(3 == __curl_pause_calls);
+    CU_ASSERT(CURLPAUSE_RECV == __curl_pause_bitmask);
+    receive_resume(&priv);
+    CU_ASSERT(4 == __curl_pause_calls);
+
+    /* Resuming from the callback that paused just carries on. */
+    __log[0]       = '\0';
+    __resume_in_cb = true;
+    CU_ASSERT(sizeof(in) - 1 == _receive_cb(in, sizeof(in) - 1, 1, &priv));
+    CU_ASSERT_STRING_EQUAL(__log, "abc");
+    CU_ASSERT(4 == __curl_pause_calls);
+    CU_ASSERT(NULL == priv.recv.pending.buf);
+
+    /* Data kept when the handle is destroyed is freed. */
+    __resume_in_cb = false;
+    CU_ASSERT(sizeof(in) - 1 == _receive_cb(in, sizeof(in) - 1, 1, &priv));
+    CU_ASSERT(NULL != priv.recv.pending.buf);
+    receive_destroy(&priv);
+    CU_ASSERT(NULL == priv.recv.pending.buf);
+    CU_ASSERT(0 == priv.recv.pending.len);
+}
+
+
 void add_suites(CU_pSuite *suite)
 {
     struct {
@@ -595,6 +887,11 @@ void add_suites(CU_pSuite *suite)
         {.label = "more complex Tests ", .fn = test_more_complex},
         {.label = "invalid input Tests",      .fn = test_null_in},
         {.label = "redirection Tests  ",  .fn = test_redirection},
+        { .label = "header split Tests", .fn = test_header_split},
+        {   .label = "ping flood Tests",   .fn = test_ping_flood},
+        {      .label = "too big Tests",      .fn = test_too_big},
+        {        .label = "batch Tests",        .fn = test_batch},
+        {        .label = "pause Tests",        .fn = test_pause},
         {                 .label = NULL,              .fn = NULL}
     };
     int i;
@@ -23,23 +23,59 @@ CURLcode curl_easy_setopt(CURL *easy, CURLoption option, ...)
     return CURLE_OK;
 }
 
+static int __pause_calls = 0;
 CURLcode curl_easy_pause(CURL *easy, int bitmask)
 {
     (void) easy;
     (void) bitmask;
+    __pause_calls++;
     return CURLE_OK;
 }
 
+static uint64_t __now = 1000;
+uint64_t cws_now_usec(void)
+{
+    return __now;
+}
+
+void cws_random(CWS *priv, void *buffer, size_t len)
+{
+    (void) priv;
+    memset(buffer, 0, len);
+}
+
+void prepared_ref(struct cws_prepared *msg)
+{
+    msg->refs++;
+}
+
+void prepared_unref(struct cws_prepared *msg)
+{
+    CU_ASSERT(0 < msg->refs);
+    msg->refs--;
+}
+
+static int __close_code = 0;
+CWScode cws_close(CWS *priv, int code, const char *reason, size_t len)
+{
+    (void) priv;
+    (void) reason;
+    (void) len;
+    __close_code = code;
+    return CWSE_OK;
+}
+
+
 void *mem_alloc_ctrl(pool_t *pool)
 {
     (void) pool;
-    return malloc(WS_CTL_PAYLOAD_MAX);
+    return malloc(send_get_memory_needed(WS_CTL_PAYLOAD_MAX));
 }
 
-void *mem_alloc_data(pool_t *pool)
+void *mem_alloc_data(pool_t *pool, size_t size)
 {
     (void) pool;
-    return malloc(1024);
+    return malloc(size);
 }
 
 void mem_free(void *ptr)
@@ -48,11 +84,33 @@ void mem_free(void *ptr)
 }
 
 
+static int __on_sent_count     = 0;
+static void *__on_sent_tag     = NULL;
+static CWScode __on_sent_status = CWSE_LAST;
+void cb_on_sent(CWS *priv, void *tag, CWScode status)
+{
+    CU_ASSERT(NULL != priv);
+    CU_ASSERT(0 < priv->dispatching);
+    __on_sent_count++;
+    __on_sent_tag    = tag;
+    __on_sent_status = status;
+}
+
+
+static int __on_drain_count = 0;
+void cb_on_drain(CWS *priv)
+{
+    CU_ASSERT(NULL != priv);
+    CU_ASSERT(0 < priv->dispatching);
+    __on_drain_count++;
+}
+
+
 void setup_test(CWS *priv)
 {
     memset(priv, 0, sizeof(CWS));
     priv->cfg.max_payload_size    = 1024;
-    priv->mem_cfg.data_block_size = 1024 + WS_FRAME_HEADER_MAX;
+    priv->mem_cfg.data_block_size = send_get_memory_needed(1024);
     send_init(priv);
     srand(0);
 }
@@ -67,15 +125,15 @@ void test_simple()
     char *ping    = "ping";
 
     // clang-format off
-    uint8_t expect[] = {   0x81, 0x85,                   /* header */
-                           0x01, 0x02, 0x03, 0x04,       /* mask */
-                           0x69, 0x67, 0x6f, 0x68, 0x6e, /* 'hello' encoded */
-                           0x89, 0x84,                   /* header */
+    uint8_t expect[] = {   0x89, 0x84,                   /* header */
                            0x01, 0x02, 0x03, 0x04,       /* mask */
                            0x71, 0x6b, 0x6d, 0x63,       /* 'ping' encoded */
                            0x8a, 0x84,                   /* header */
                            0x01, 0x02, 0x03, 0x04,       /* mask */
-                           0x71, 0x6b, 0x6d, 0x63 };     /* 'ping' encoded */
+                           0x71, 0x6b, 0x6d, 0x63,       /* 'ping' encoded */
+                           0x81, 0x85,                   /* header */
+                           0x01, 0x02, 0x03, 0x04,       /* mask */
+                           0x69, 0x67, 0x6f, 0x68, 0x6e  /* 'hello' encoded */ };
     struct cws_frame f[] = {
         {
             .fin = 1,
@@ -115,12 +173,13 @@ void test_simple()
     priv.header_state.redirection = false;
 
     /* Test the empty send queue --> pause things behavior */
-    CU_ASSERT(NULL == priv.send);
+    CU_ASSERT(NULL == priv.send.active);
     CU_ASSERT(0 == priv.pause_flags);
     CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, 40, 1, &priv));
     CU_ASSERT(CURLPAUSE_SEND == priv.pause_flags);
 
-    /* Send 2 frames in a large enough buffer - starting from paused state */
+    /* Send 3 frames in a large enough buffer - starting from paused state.
+     * The control frames are sent ahead of the data frame. */
     priv.pause_flags = CURLPAUSE_SEND;
     CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
     CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
@@ -177,7 +236,976 @@ void test_small_buffer()
     }
 
     /* There is a buffer that is not freed. */
-    free(priv.send);
+    send_destroy(&priv);
+}
+
+
+void test_priority()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    uint8_t *p;
+
+    // clang-format off
+    struct cws_frame f[] = {
+        { .fin = 1, .mask = 1, .opcode = 2, .priority = CWS_PRIO_BULK,   .payload_len = 1, .payload = "b" },
+        { .fin = 1, .mask = 1, .opcode = 2, .priority = CWS_PRIO_NORMAL, .payload_len = 1, .payload = "n" },
+        { .fin = 0, .mask = 1, .opcode = 2, .priority = CWS_PRIO_HIGH,   .payload_len = 1, .payload = "h" },
+        { .fin = 1, .mask = 1, .opcode = 0, .priority = CWS_PRIO_HIGH,   .payload_len = 1, .payload = "H" },
+        { .fin = 1, .mask = 1, .opcode = 0, .priority = CWS_PRIO_NORMAL, .payload_len = 1, .payload = "N" },
+        { .fin = 1, .mask = 1, .opcode = 9, .is_control = 1,             .payload_len = 1, .payload = "p" },
+        { .fin = 0, .mask = 1, .opcode = 1, .priority = CWS_PRIO_NORMAL, .payload_len = 1, .payload = "s" },
+        { .fin = 1, .mask = 1, .opcode = 8, .is_control = 1,             .payload_len = 0, .payload = NULL },
+        { .fin = 1, .mask = 1, .opcode = 8, .is_control = 1, .is_urgent = 1, .payload_len = 0, .payload = NULL },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    /* Bulk, normal and a partial high message are queued. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+
+    /* Only send the partial high message header. */
+    CU_ASSERT(2 == _send_cb((char *) buffer, 2, 1, &priv));
+    CU_ASSERT(0x02 == buffer[0]);
+
+    /* The rest of the frame is sent, then the ping, but not the normal
+     * message because the high message is not complete. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[5]));
+    CU_ASSERT(12 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0x89 == buffer[5]);
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    /* Finish the high message, then the normal and bulk follow in order. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[3]));
+    CU_ASSERT(21 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    p = buffer;
+    CU_ASSERT(0x80 == p[0]);
+    CU_ASSERT('H' == (p[6] ^ p[2]));
+    p += 7;
+    CU_ASSERT(0x82 == p[0]);
+    CU_ASSERT('n' == (p[6] ^ p[2]));
+    p += 7;
+    CU_ASSERT(0x82 == p[0]);
+    CU_ASSERT('b' == (p[6] ^ p[2]));
+
+    /* A close waits for everything queued, but doesn't wait for a message
+     * that is still being streamed. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[6]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[7]));
+    CU_ASSERT(13 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0x01 == buffer[0]);
+    CU_ASSERT(0x88 == buffer[7]);
+    CU_ASSERT(CLOSE_SENT & priv.close_state);
+
+    /* Messages in other classes waiting for the streamed message to finish
+     * are still sent before the close. */
+    setup_test(&priv);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[6]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[7]));
+    CU_ASSERT(7 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == (CLOSE_SENT & priv.close_state));
+
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[4]));
+    CU_ASSERT(20 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0x80 == buffer[0]);
+    CU_ASSERT(0x82 == buffer[7]);
+    CU_ASSERT('b' == (buffer[13] ^ buffer[9]));
+    CU_ASSERT(0x88 == buffer[14]);
+    CU_ASSERT(CLOSE_SENT & priv.close_state);
+
+    /* An urgent close goes ahead of everything not yet started. */
+    setup_test(&priv);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[5]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[8]));
+    CU_ASSERT(6 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0x88 == buffer[0]);
+    CU_ASSERT(NULL == priv.send.active);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_NORMAL].head);
+}
+
+
+void test_by_reference()
+{
+    CWS priv;
+    uint8_t buffer[40];
+    char payload[] = "hello";
+
+    // clang-format off
+    uint8_t expect[] = {   0x82, 0x85,                   /* header */
+                           0x01, 0x02, 0x03, 0x04,       /* mask */
+                           0x49, 0x67, 0x6f, 0x68, 0x6e  /* 'Hello' encoded */ };
+    struct cws_frame f = {
+        .fin = 1,
+        .mask = 1,
+        .is_control = 0,
+        .is_ref = 1,
+        .opcode = 2,
+        .masking_key = {1, 2, 3, 4},
+        .payload_len = 5,
+        .payload = payload,
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+
+    /* The payload is referenced, so changes before sending are seen. */
+    payload[0] = 'H';
+
+    /* Split inside the header and inside the payload so the mask offset
+     * carries over. */
+    memset(buffer, 0, sizeof(buffer));
+    CU_ASSERT(3 == _send_cb((char *) buffer, 3, 1, &priv));
+    CU_ASSERT(5 == _send_cb((char *) &buffer[3], 5, 1, &priv));
+    CU_ASSERT(3 == _send_cb((char *) &buffer[8], sizeof(buffer) - 8, 1, &priv));
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+
+    /* The caller's memory is never masked in place. */
+    CU_ASSERT_STRING_EQUAL("Hello", payload);
+    CU_ASSERT(NULL == priv.send.active);
+
+    /* Copied payloads that don't fit are rejected. */
+    f.is_ref      = 0;
+    f.payload_len = 1025;
+    CU_ASSERT(CWSE_APP_DATA_LENGTH_TOO_LONG == send_frame(&priv, &f));
+
+    send_destroy(&priv);
+}
+
+
+void test_msg_tag()
+{
+    CWS priv;
+    uint8_t buffer[40];
+    int tag1, tag2;
+
+    // clang-format off
+    struct cws_frame f[] = {
+        { .fin = 0, .mask = 1, .is_ref = 1, .opcode = 2, .payload_len = 2, .payload = "ab" },
+        { .fin = 1, .mask = 1, .is_ref = 1, .opcode = 0, .payload_len = 2, .payload = "cd" },
+        { .fin = 1, .mask = 1, .is_ref = 1, .opcode = 2, .payload_len = 2, .payload = "ef" },
+        { .fin = 1, .mask = 1, .is_ref = 1, .opcode = 2, .priority = CWS_PRIO_BULK, .payload_len = 2, .payload = "gh" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __on_sent_count = 0;
+
+    /* Only the last frame of the message reports the tag. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    send_msg_commit(&priv, true, &tag1);
+
+    CU_ASSERT(4 == _send_cb((char *) buffer, 4, 1, &priv));
+    CU_ASSERT(0 == __on_sent_count);
+    CU_ASSERT(4 == _send_cb((char *) buffer, 4, 1, &priv));
+    CU_ASSERT(0 == __on_sent_count);
+    CU_ASSERT(5 == _send_cb((char *) buffer, 5, 1, &priv));
+    CU_ASSERT(0 == __on_sent_count);
+    CU_ASSERT(3 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(1 == __on_sent_count);
+    CU_ASSERT(&tag1 == __on_sent_tag);
+    CU_ASSERT(CWSE_OK == __on_sent_status);
+
+    /* A withdrawn message leaves the frames before it alone. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_abort(&priv);
+    CU_ASSERT(priv.send.q[SEND_CLASS_NORMAL].head == priv.send.q[SEND_CLASS_NORMAL].tail);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_NORMAL].head->next);
+
+    /* Also when the class was empty. */
+    send_msg_begin(&priv, CWS_PRIO_BULK, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[3]));
+    send_msg_abort(&priv);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_BULK].head);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_BULK].tail);
+
+    /* Discarded messages report they are no longer referenced. */
+    send_msg_begin(&priv, CWS_PRIO_BULK, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[3]));
+    send_msg_commit(&priv, true, &tag2);
+    send_destroy(&priv);
+    CU_ASSERT(2 == __on_sent_count);
+    CU_ASSERT(&tag2 == __on_sent_tag);
+    CU_ASSERT(CWSE_CLOSED_CONNECTION == __on_sent_status);
+}
+
+
+void test_gather()
+{
+    CWS priv;
+    uint8_t buffer[40];
+
+    // clang-format off
+    uint8_t expect[] = {   0x82, 0x85,                   /* header */
+                           0x01, 0x02, 0x03, 0x04,       /* mask */
+                           0x69, 0x67, 0x6f, 0x68, 0x6e  /* 'hello' encoded */ };
+    struct cws_iov iov[] = {
+        { .base = "xhe", .len = 3 },
+        { .base = NULL,  .len = 0 },
+        { .base = "llo", .len = 3 },
+    };
+    struct cws_frame f = {
+        .fin = 1,
+        .mask = 1,
+        .opcode = 2,
+        .masking_key = {1, 2, 3, 4},
+        .payload_len = 5,
+        .iov = iov,
+        .iov_skip = 1,
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(sizeof(expect) == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+
+    send_destroy(&priv);
+}
+
+
+void test_batch()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    struct cws_send_stats stats;
+
+    // clang-format off
+    struct cws_frame f = {
+        .fin = 1, .mask = 1, .opcode = 2, .masking_key = {1, 2, 3, 4}, .payload_len = 1, .payload = "a"
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __pause_calls = 0;
+
+    /* Without a batch each frame queued while paused wakes curl. */
+    priv.pause_flags = CURLPAUSE_SEND;
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(1 == __pause_calls);
+    CU_ASSERT(7 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(2 == __pause_calls);
+    CU_ASSERT(7 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    /* Within a (nested) batch curl is only woken at the outer commit. */
+    CU_ASSERT(CWSE_BAD_FUNCTION_ARGUMENT == send_batch_commit(&priv));
+    send_batch_begin(&priv);
+    send_batch_begin(&priv);
+    for (int i = 0; i < 5; i++) {
+        CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    }
+    CU_ASSERT(CWSE_OK == send_batch_commit(&priv));
+    CU_ASSERT(2 == __pause_calls);
+    CU_ASSERT(CWSE_OK == send_batch_commit(&priv));
+    CU_ASSERT(3 == __pause_calls);
+    CU_ASSERT(0 == (CURLPAUSE_SEND & priv.pause_flags));
+    CU_ASSERT(35 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(3 == stats.unpauses);
+    CU_ASSERT(4 == stats.unpauses_saved);
+
+    /* An empty batch doesn't wake curl & the stats survive a destroy. */
+    send_batch_begin(&priv);
+    CU_ASSERT(CWSE_OK == send_batch_commit(&priv));
+    CU_ASSERT(3 == __pause_calls);
+
+    send_destroy(&priv);
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(3 == stats.unpauses);
+}
+
+
+void test_cork()
+{
+    CWS priv;
+    uint8_t buffer[80];
+
+    // clang-format off
+    struct cws_frame f = {
+        .fin = 1, .mask = 1, .opcode = 2, .masking_key = {1, 2, 3, 4}, .payload_len = 1, .payload = "a"
+    };
+    struct cws_frame ping = {
+        .fin = 1, .mask = 1, .opcode = WS_OPCODE_PING, .is_control = 1, .masking_key = {1, 2, 3, 4}
+    };
+    struct cws_frame close = {
+        .fin = 1, .mask = 1, .opcode = WS_OPCODE_CLOSE, .is_control = 1, .masking_key = {1, 2, 3, 4}
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __pause_calls = 0;
+    __now         = 1000;
+
+    /* Corked without a time limit, nothing goes out until uncorked. */
+    send_cork(&priv, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &ping));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    __now = 1000000;
+    send_cork_check(&priv);
+    CU_ASSERT(0 == __pause_calls);
+    CU_ASSERT(CURLPAUSE_SEND == priv.pause_flags);
+
+    send_uncork(&priv);
+    CU_ASSERT(1 == __pause_calls);
+    CU_ASSERT(20 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    /* Uncorking with nothing queued doesn't wake curl. */
+    send_cork(&priv, 0);
+    send_uncork(&priv);
+    CU_ASSERT(1 == __pause_calls);
+
+    /* With a time limit the frames are released once the first one has
+     * waited long enough, and the cork applies again after that. */
+    __now = 1000;
+    send_cork(&priv, 100);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    __now = 1050;
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    send_cork_check(&priv);
+    CU_ASSERT(1 == __pause_calls);
+    __now = 1100;
+    send_cork_check(&priv);
+    CU_ASSERT(2 == __pause_calls);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(21 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(2 == __pause_calls);
+    CU_ASSERT(1200 == priv.send.cork.deadline);
+
+    /* A close frame removes the cork. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &close));
+    CU_ASSERT(3 == __pause_calls);
+    CU_ASSERT(false == priv.send.cork.on);
+    CU_ASSERT(13 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(NULL == priv.send.active);
+}
+
+
+void test_watermarks()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    struct cws_send_stats stats;
+
+    // clang-format off
+    struct cws_frame f = {
+        .fin = 1, .mask = 1, .opcode = 2, .masking_key = {1, 2, 3, 4}, .payload_len = 10, .payload = "0123456789"
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __on_drain_count             = 0;
+    priv.cfg.send_high_watermark = 40;
+    priv.cfg.send_low_watermark  = 16;
+
+    /* Each frame is 16 bytes (6 header + 10 payload). */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(false == send_is_full(&priv));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(true == send_is_full(&priv));
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(48 == stats.queued_bytes);
+    CU_ASSERT(3 == stats.queued_frames);
+
+    /* Partly sent frames count what is left. */
+    CU_ASSERT(20 == _send_cb((char *) buffer, 20, 1, &priv));
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(28 == stats.queued_bytes);
+    CU_ASSERT(2 == stats.queued_frames);
+    CU_ASSERT(0 == __on_drain_count);
+
+    /* Between the watermarks the queue stays full once it has been full. */
+    CU_ASSERT(true == send_is_full(&priv));
+
+    /* Drained to the low watermark. */
+    CU_ASSERT(12 == _send_cb((char *) buffer, 12, 1, &priv));
+    CU_ASSERT(1 == __on_drain_count);
+    CU_ASSERT(false == send_is_full(&priv));
+
+    /* Filling up again from below the high watermark doesn't make it full. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(false == send_is_full(&priv));
+    CU_ASSERT(32 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(1 == __on_drain_count);
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(0 == stats.queued_bytes);
+    CU_ASSERT(0 == stats.queued_frames);
+
+    /* Withdrawn and discarded frames are no longer counted. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    send_msg_abort(&priv);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+    CU_ASSERT(5 == _send_cb((char *) buffer, 5, 1, &priv));
+    send_destroy(&priv);
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(0 == stats.queued_bytes);
+    CU_ASSERT(0 == stats.queued_frames);
+    CU_ASSERT(1 == __on_drain_count);
+}
+
+
+void test_drain_on_drop()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    uint64_t id[3];
+
+    // clang-format off
+    struct cws_frame f = {
+        .fin = 1, .mask = 1, .opcode = 2, .masking_key = {1, 2, 3, 4}, .payload_len = 10, .payload = "0123456789"
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __on_drain_count             = 0;
+    __now                        = 1000;
+    priv.cfg.send_high_watermark = 40;
+    priv.cfg.send_low_watermark  = 16;
+
+    /* Cancelling messages drains a full queue without curl sending. */
+    for (int i = 0; i < 3; i++) {
+        id[i] = send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+        CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+        send_msg_commit(&priv, false, NULL);
+    }
+    CU_ASSERT(true == send_is_full(&priv));
+    CU_ASSERT(CWSE_OK == send_msg_cancel(&priv, id[2]));
+    CU_ASSERT(0 == __on_drain_count);
+    CU_ASSERT(CWSE_OK == send_msg_cancel(&priv, id[1]));
+    CU_ASSERT(1 == __on_drain_count);
+    CU_ASSERT(false == send_is_full(&priv));
+    CU_ASSERT(16 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+
+    /* So does every message expiring, even though curl is just paused. */
+    for (int i = 0; i < 3; i++) {
+        send_msg_begin(&priv, CWS_PRIO_NORMAL, 100, 0);
+        CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+        send_msg_commit(&priv, false, NULL);
+    }
+    CU_ASSERT(true == send_is_full(&priv));
+    __now = 1200;
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(2 == __on_drain_count);
+    CU_ASSERT(false == send_is_full(&priv));
+
+    send_destroy(&priv);
+}
+
+
+void test_msg_cancel()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    struct cws_send_stats stats;
+    uint64_t id1, id2, id3;
+    int tag1, tag2, tag3;
+
+    // clang-format off
+    struct cws_frame f[] = {
+        { .fin = 0, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "ab" },
+        { .fin = 1, .mask = 1, .opcode = 0, .payload_len = 2, .payload = "cd" },
+        { .fin = 1, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "ef" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __on_sent_count = 0;
+    __now           = 1000;
+
+    id1 = send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    send_msg_commit(&priv, true, &tag1);
+
+    id2 = send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    send_msg_commit(&priv, true, &tag2);
+
+    id3 = send_msg_begin(&priv, CWS_PRIO_NORMAL, 100, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    send_msg_commit(&priv, true, &tag3);
+
+    CU_ASSERT(0 != id1);
+    CU_ASSERT(id1 != id2);
+    CU_ASSERT(id2 != id3);
+
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, 0));
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, id3 + 1));
+
+    /* A message in the middle of the queue is dropped whole. */
+    CU_ASSERT(CWSE_OK == send_msg_cancel(&priv, id2));
+    CU_ASSERT(1 == __on_sent_count);
+    CU_ASSERT(&tag2 == __on_sent_tag);
+    CU_ASSERT(CWSE_MSG_DROPPED == __on_sent_status);
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, id2));
+
+    /* A started message can't be cancelled. */
+    CU_ASSERT(4 == _send_cb((char *) buffer, 4, 1, &priv));
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, id1));
+    CU_ASSERT(4 == _send_cb((char *) buffer, 4, 1, &priv));
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, id1));
+
+    /* The last message outlived its deadline. */
+    __now = 1200;
+    CU_ASSERT(8 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(3 == __on_sent_count);
+    CU_ASSERT(&tag3 == __on_sent_tag);
+    CU_ASSERT(CWSE_MSG_DROPPED == __on_sent_status);
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(1 == stats.msgs_cancelled);
+    CU_ASSERT(1 == stats.msgs_expired);
+    CU_ASSERT(0 == stats.queued_bytes);
+    CU_ASSERT(0 == stats.queued_frames);
+
+    /* A message within its deadline is sent. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 100, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    send_msg_commit(&priv, true, &tag1);
+    __now = 1250;
+    CU_ASSERT(8 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(4 == __on_sent_count);
+    CU_ASSERT(&tag1 == __on_sent_tag);
+    CU_ASSERT(CWSE_OK == __on_sent_status);
+
+    send_destroy(&priv);
+}
+
+
+void test_conflate()
+{
+    CWS priv;
+    uint8_t buffer[40];
+    struct cws_send_stats stats;
+    int tag1, tag2, tag3;
+
+    // clang-format off
+    struct cws_frame f[] = {
+        { .fin = 1, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "ab" },
+        { .fin = 1, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "cd" },
+        { .fin = 1, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "ef" },
+        { .fin = 0, .mask = 1, .opcode = 2, .payload_len = 2, .payload = "gh" },
+        { .fin = 1, .mask = 1, .opcode = 0, .payload_len = 2, .payload = "ij" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    __on_sent_count = 0;
+
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 7);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, true, &tag1);
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    send_msg_commit(&priv, true, &tag2);
+
+    /* The newer value takes the place of the older one.  The masking keys
+     * are 0 so the payloads can be read back. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 7);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    send_msg_commit(&priv, true, &tag3);
+    CU_ASSERT(1 == __on_sent_count);
+    CU_ASSERT(&tag1 == __on_sent_tag);
+    CU_ASSERT(CWSE_MSG_DROPPED == __on_sent_status);
+
+    CU_ASSERT(16 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == memcmp(&buffer[6], "ef", 2));
+    CU_ASSERT(0 == memcmp(&buffer[14], "cd", 2));
+    CU_ASSERT(3 == __on_sent_count);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_NORMAL].head);
+    CU_ASSERT(NULL == priv.send.q[SEND_CLASS_NORMAL].tail);
+
+    /* A message that has started is not replaced. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 9);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[3]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[4]));
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(4 == _send_cb((char *) buffer, 4, 1, &priv));
+
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 9);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, false, NULL);
+
+    CU_ASSERT(20 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == memcmp(&buffer[10], "ij", 2));
+    CU_ASSERT(0 == memcmp(&buffer[18], "ab", 2));
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(1 == stats.msgs_conflated);
+    CU_ASSERT(0 == stats.queued_frames);
+
+    send_destroy(&priv);
+}
+
+
+struct producer_state {
+    const char *data;
+    size_t left;
+    size_t chunk;
+    int reads;
+    int wait_at;
+    int abort_at;
+    int done;
+    CWScode status;
+};
+
+static size_t __producer_read(void *user, CWS *priv, void *buf, size_t len, int *eom)
+{
+    struct producer_state *s = user;
+    size_t lesser            = s->chunk;
+
+    CU_ASSERT(NULL != priv);
+    CU_ASSERT(0 < priv->dispatching);
+
+    s->reads++;
+    if (s->wait_at == s->reads) {
+        return 0;
+    }
+    if (s->abort_at == s->reads) {
+        return CWS_PRODUCER_ABORT;
+    }
+
+    if (len < lesser) {
+        lesser = len;
+    }
+    if (s->left < lesser) {
+        lesser = s->left;
+    }
+    memcpy(buf, s->data, lesser);
+    s->data += lesser;
+    s->left -= lesser;
+    *eom = (0 == s->left);
+
+    return lesser;
+}
+
+static void __producer_done(void *user, CWS *priv, CWScode status)
+{
+    struct producer_state *s = user;
+
+    CU_ASSERT(NULL != priv);
+    CU_ASSERT(0 < priv->dispatching);
+    s->done++;
+    s->status = status;
+}
+
+
+void test_producer()
+{
+    CWS priv;
+    uint8_t buffer[80];
+    struct cws_send_stats stats;
+    struct producer_state s;
+    struct cws_producer p = { .read = __producer_read, .done = __producer_done, .user = &s };
+
+    setup_test(&priv);
+
+    /* The payload is pulled a frame at a time.  The masking keys are 0 so
+     * the payload can be read back. */
+    memset(&s, 0, sizeof(s));
+    s.data  = "abcdefghij";
+    s.left  = 10;
+    s.chunk = 4;
+    CU_ASSERT(CWSE_OK == send_producer(&priv, CWS_BINARY, CWS_PRIO_NORMAL, &p));
+    CU_ASSERT(0 == s.reads);
+
+    CU_ASSERT(28 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(3 == s.reads);
+    CU_ASSERT(0x02 == buffer[0]);
+    CU_ASSERT(0 == memcmp(&buffer[6], "abcd", 4));
+    CU_ASSERT(0x00 == buffer[10]);
+    CU_ASSERT(0 == memcmp(&buffer[16], "efgh", 4));
+    CU_ASSERT(0x80 == buffer[20]);
+    CU_ASSERT(0 == memcmp(&buffer[26], "ij", 2));
+    CU_ASSERT(1 == s.done);
+    CU_ASSERT(CWSE_OK == s.status);
+
+    send_get_stats(&priv, &stats);
+    CU_ASSERT(0 == stats.queued_bytes);
+    CU_ASSERT(0 == stats.queued_frames);
+
+    /* Nothing is ready, so sending pauses until the producer is ready. */
+    memset(&s, 0, sizeof(s));
+    s.data    = "xyz";
+    s.left    = 3;
+    s.chunk   = 8;
+    s.wait_at = 1;
+    CU_ASSERT(CWSE_OK == send_producer(&priv, CWS_TEXT, CWS_PRIO_NORMAL, &p));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    __pause_calls = 0;
+    send_producer_ready(&priv);
+    CU_ASSERT(1 == __pause_calls);
+    CU_ASSERT(9 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0x81 == buffer[0]);
+    CU_ASSERT(0 == memcmp(&buffer[6], "xyz", 3));
+    CU_ASSERT(1 == s.done);
+
+    /* Giving up before anything is sent only drops the message. */
+    memset(&s, 0, sizeof(s));
+    s.left       = 3;
+    s.abort_at   = 1;
+    __close_code = 0;
+    CU_ASSERT(CWSE_OK == send_producer(&priv, CWS_BINARY, CWS_PRIO_NORMAL, &p));
+    CU_ASSERT(CURL_READFUNC_PAUSE == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(1 == s.done);
+    CU_ASSERT(CWSE_MSG_DROPPED == s.status);
+    CU_ASSERT(0 == __close_code);
+
+    /* Giving up part way through closes the connection. */
+    memset(&s, 0, sizeof(s));
+    s.data     = "abcdefghij";
+    s.left     = 10;
+    s.chunk    = 4;
+    s.abort_at = 2;
+    CU_ASSERT(CWSE_OK == send_producer(&priv, CWS_BINARY, CWS_PRIO_NORMAL, &p));
+    CU_ASSERT(10 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(1 == s.done);
+    CU_ASSERT(CWSE_MSG_DROPPED == s.status);
+    CU_ASSERT(-1011 == __close_code);
+    send_destroy(&priv);
+
+    /* A queued producer is told when it is discarded. */
+    setup_test(&priv);
+    memset(&s, 0, sizeof(s));
+    CU_ASSERT(CWSE_OK == send_producer(&priv, CWS_BINARY, CWS_PRIO_BULK, &p));
+    send_destroy(&priv);
+    CU_ASSERT(0 == s.reads);
+    CU_ASSERT(1 == s.done);
+    CU_ASSERT(CWSE_CLOSED_CONNECTION == s.status);
+}
+
+
+void test_large_frame()
+{
+    CWS priv;
+    static uint8_t payload[70000];
+    static uint8_t buffer[sizeof(payload) + WS_FRAME_HEADER_MAX];
+    size_t total = 0;
+
+    // clang-format off
+    uint8_t expect[] = { 0x82, 0xff,                                     /* 127 form */
+                         0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x11, 0x70, /* 70000 */
+                         0x00, 0x00, 0x00, 0x00 };                       /* mask */
+    struct cws_frame f = {
+        .fin = 1,
+        .mask = 1,
+        .is_ref = 1,
+        .opcode = 2,
+        .payload_len = sizeof(payload),
+        .payload = payload,
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (uint8_t) i;
+    }
+
+    /* Far larger than a pool block, but only the header is stored. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f));
+
+    while (total < sizeof(buffer)) {
+        size_t len = _send_cb((char *) &buffer[total], 16384, 1, &priv);
+
+        if (0 == len) {
+            break;
+        }
+        total += len;
+    }
+
+    CU_ASSERT(sizeof(buffer) == total);
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+    CU_ASSERT(0 == memcmp(payload, &buffer[sizeof(expect)], sizeof(payload)));
+    CU_ASSERT(NULL == priv.send.active);
+
+    send_destroy(&priv);
+}
+
+
+void test_pong_coalesce()
+{
+    CWS priv;
+    uint8_t buffer[40];
+
+    // clang-format off
+    uint8_t expect[] = { 0x8a, 0x82, 0x00, 0x00, 0x00, 0x00, 'b', 'c',
+                         0x8a, 0x81, 0x00, 0x00, 0x00, 0x00, 'd' };
+    struct cws_frame f[] = {
+        { .fin = 1, .mask = 1, .is_control = 1, .opcode = WS_OPCODE_PONG, .payload_len = 1, .payload = "a" },
+        { .fin = 1, .mask = 1, .is_control = 1, .opcode = WS_OPCODE_PONG, .payload_len = 2, .payload = "bc" },
+        { .fin = 1, .mask = 1, .is_control = 1, .opcode = WS_OPCODE_PING, .payload_len = 1, .payload = "x" },
+        { .fin = 1, .mask = 1, .is_control = 1, .opcode = WS_OPCODE_PONG, .payload_len = 1, .payload = "d" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    /* Only the latest PONG is sent, in the place of the first. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    CU_ASSERT(1 == priv.send.stats.queued_frames);
+    CU_ASSERT(8 == priv.send.stats.queued_bytes);
+    CU_ASSERT(1 == priv.send.stats.pongs_coalesced);
+
+    /* A PONG that has started sending is left alone. */
+    CU_ASSERT(2 == _send_cb((char *) buffer, 2, 1, &priv));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[3]));
+    CU_ASSERT(1 == priv.send.stats.pongs_coalesced);
+
+    /* Other control frames are never replaced. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[2]));
+    CU_ASSERT(3 == priv.send.stats.queued_frames);
+
+    CU_ASSERT(6 == _send_cb((char *) &buffer[2], 6, 1, &priv));
+    CU_ASSERT(7 == _send_cb((char *) &buffer[8], 7, 1, &priv));
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+
+    send_destroy(&priv);
+}
+
+
+void test_control_delay()
+{
+    CWS priv;
+    uint8_t buffer[100];
+    uint64_t id1, id2;
+
+    // clang-format off
+    uint8_t expect[] = { 0x02, 0x84, 0x00, 0x00, 0x00, 0x00, '0', '1', '2', '3',
+                         0x89, 0x81, 0x00, 0x00, 0x00, 0x00, 'x',
+                         0x80, 0x86, 0x00, 0x00, 0x00, 0x00, '4', '5', '6', '7', '8', '9' };
+    struct cws_frame f[] = {
+        { .fin = 1, .mask = 1, .is_control = 0, .opcode = WS_OPCODE_BINARY, .payload_len = 10, .payload = "0123456789" },
+        { .fin = 1, .mask = 1, .is_control = 1, .opcode = WS_OPCODE_PING,   .payload_len = 1,  .payload = "x" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+    priv.cfg.max_control_delay = 4;
+
+    /* curl has little room, so the frame is cut. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(3 == _send_cb((char *) buffer, 3, 1, &priv));
+    CU_ASSERT(1 == priv.send.stats.frames_cut);
+
+    /* The PING goes between the pieces and the rest fits in curl's buffer. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    CU_ASSERT(26 == _send_cb((char *) &buffer[3], sizeof(buffer) - 3, 1, &priv));
+    CU_ASSERT(0 == memcmp(expect, buffer, sizeof(expect)));
+    CU_ASSERT(1 == priv.send.stats.frames_cut);
+    CU_ASSERT(0 == priv.send.stats.queued_bytes);
+    CU_ASSERT(0 == priv.send.stats.queued_frames);
+    CU_ASSERT(false == priv.send.data_in_progress);
+
+    /* Nothing is cut when the frame fits in curl's buffer. */
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(16 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(1 == priv.send.stats.frames_cut);
+
+    /* While the first piece of a cut frame is being sent, the message
+     * queued after it is at the head of the class but has not started. */
+    id1 = send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(3 == _send_cb((char *) buffer, 3, 1, &priv));
+    CU_ASSERT(2 == priv.send.stats.frames_cut);
+
+    id2 = send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(CWSE_OK == send_msg_cancel(&priv, id2));
+    CU_ASSERT(CWSE_MSG_NOT_QUEUED == send_msg_cancel(&priv, id1));
+
+    /* The same goes for replacing it. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 7);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, false, NULL);
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 7);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(1 == priv.send.stats.msgs_conflated);
+
+    /* The rest of the cut frame is sent, then the replacement. */
+    CU_ASSERT(19 + 16 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == priv.send.stats.queued_bytes);
+    CU_ASSERT(0 == priv.send.stats.queued_frames);
+    CU_ASSERT(false == priv.send.data_in_progress);
+
+    send_destroy(&priv);
+}
+
+
+void test_prepared_hold()
+{
+    CWS priv;
+    uint8_t buffer[40];
+    struct cws_prepared msg = { .refs = 0 };
+
+    // clang-format off
+    struct cws_frame f[] = {
+        { .fin = 0, .mask = 1, .is_ref = 1, .opcode = 2, .payload_len = 2, .payload = "ab" },
+        { .fin = 1, .mask = 1, .is_ref = 1, .opcode = 0, .payload_len = 2, .payload = "cd" },
+    };
+    // clang-format on
+
+    setup_test(&priv);
+
+    /* The last frame holds the reference until it is sent. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    send_msg_hold(&priv, &msg);
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(1 == msg.refs);
+
+    CU_ASSERT(8 == _send_cb((char *) buffer, 8, 1, &priv));
+    CU_ASSERT(1 == msg.refs);
+    CU_ASSERT(8 == _send_cb((char *) buffer, sizeof(buffer), 1, &priv));
+    CU_ASSERT(0 == msg.refs);
+
+    /* Nothing is held if nothing was queued. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    send_msg_hold(&priv, &msg);
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(0 == msg.refs);
+
+    /* Discarded messages drop the reference too. */
+    send_msg_begin(&priv, CWS_PRIO_NORMAL, 0, 0);
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[0]));
+    CU_ASSERT(CWSE_OK == send_frame(&priv, &f[1]));
+    send_msg_hold(&priv, &msg);
+    send_msg_commit(&priv, false, NULL);
+    CU_ASSERT(1 == msg.refs);
+    send_destroy(&priv);
+    CU_ASSERT(0 == msg.refs);
 }
 
 
@@ -187,9 +1215,24 @@ void add_suites(CU_pSuite *suite)
         const char *label;
         void (*fn)(void);
     } tests[] = {
-        {    .label = "simple cb Tests",       .fn = test_simple},
-        {.label = "simple small buffer", .fn = test_small_buffer},
-        {                 .label = NULL,              .fn = NULL}
+        {          .label = "simple cb Tests",        .fn = test_simple},
+        {      .label = "simple small buffer",  .fn = test_small_buffer},
+        {         .label = "priority classes",      .fn = test_priority},
+        {     .label = "payload by reference",  .fn = test_by_reference},
+        {          .label = "message tagging",       .fn = test_msg_tag},
+        {         .label = "gathered payload",        .fn = test_gather},
+        {             .label = "send batches",         .fn = test_batch},
+        {             .label = "corked sends",          .fn = test_cork},
+        {               .label = "watermarks",    .fn = test_watermarks},
+        {.label = "drain on dropped messages", .fn = test_drain_on_drop},
+        {     .label = "message cancellation",    .fn = test_msg_cancel},
+        {       .label = "conflated messages",      .fn = test_conflate},
+        {        .label = "producer messages",      .fn = test_producer},
+        {        .label = "prepared messages", .fn = test_prepared_hold},
+        {      .label = "unfragmented frames",   .fn = test_large_frame},
+        {          .label = "pong coalescing", .fn = test_pong_coalesce},
+        {      .label = "control frame delay", .fn = test_control_delay},
+        {                       .label = NULL,               .fn = NULL}
     };
     int i;
 
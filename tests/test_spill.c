@@ -0,0 +1,110 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include <CUnit/Basic.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/spill.h"
+
+void test_spill()
+{
+    struct spill s;
+    uint8_t chunk[4096];
+    const uint8_t *map;
+
+    memset(&s, 0, sizeof(s));
+
+    CU_ASSERT_FATAL(true == spill_open(&s, "/tmp"));
+    CU_ASSERT(true == s.open);
+    CU_ASSERT(NULL == spill_map(&s));
+
+    /* The file isn't inherited by child processes. */
+    CU_ASSERT(FD_CLOEXEC & fcntl(s.fd, F_GETFD));
+
+    for (int i = 0; i < 100; i++) {
+        memset(chunk, i, sizeof(chunk));
+        CU_ASSERT(true == spill_write(&s, chunk, sizeof(chunk)));
+    }
+    CU_ASSERT(100 * sizeof(chunk) == s.len);
+
+    map = (const uint8_t *) spill_map(&s);
+    CU_ASSERT_FATAL(NULL != map);
+    for (int i = 0; i < 100; i++) {
+        CU_ASSERT(i == map[i * sizeof(chunk)]);
+        CU_ASSERT(i == map[i * sizeof(chunk) + sizeof(chunk) - 1]);
+    }
+
+    spill_close(&s, map);
+    CU_ASSERT(false == s.open);
+
+    /* Closing again does nothing. */
+    spill_close(&s, NULL);
+}
+
+
+void test_bad_dir()
+{
+    struct spill s;
+
+    memset(&s, 0, sizeof(s));
+
+    CU_ASSERT(false == spill_open(&s, "/no/such/directory"));
+    CU_ASSERT(false == s.open);
+    spill_close(&s, NULL);
+}
+
+
+void add_suites(CU_pSuite *suite)
+{
+    struct {
+        const char *label;
+        void (*fn)(void);
+    } tests[] = {
+        {  .label = "spill files",   .fn = test_spill},
+        {.label = "bad directory", .fn = test_bad_dir},
+        {           .label = NULL,         .fn = NULL}
+    };
+    int i;
+
+    *suite = CU_add_suite("spill.c tests", NULL, NULL);
+
+    for (i = 0; NULL != tests[i].fn; i++) {
+        CU_add_test(*suite, tests[i].label, tests[i].fn);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+int main(void)
+{
+    unsigned rv     = 1;
+    CU_pSuite suite = NULL;
+
+    if (CUE_SUCCESS == CU_initialize_registry()) {
+        add_suites(&suite);
+
+        if (NULL != suite) {
+            CU_basic_set_mode(CU_BRM_VERBOSE);
+            CU_basic_run_tests();
+            printf("\n");
+            CU_basic_show_failures(CU_get_failure_list());
+            printf("\n\n");
+            rv = CU_get_number_of_tests_failed();
+        }
+
+        CU_cleanup_registry();
+    }
+
+    if (0 != rv) {
+        return 1;
+    }
+    return 0;
+}
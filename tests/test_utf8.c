@@ -9,7 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "../src/utf8.h"
+#include "../src/utf8.c"
 
 
 void test_utf8()
@@ -96,12 +96,35 @@ void test_utf8()
 }
 
 
-void test_maybe_valid()
+void test_stream()
 {
-    CU_ASSERT(true == utf8_maybe_valid("\xe1", 1));
-    CU_ASSERT(false == utf8_maybe_valid("\xf5", 1));
-    CU_ASSERT(true == utf8_maybe_valid("\xf4", 1));
-    CU_ASSERT(false == utf8_maybe_valid("\xf4\xa0", 2));
+    uint8_t state;
+
+    /* The start of a character is only rejected once it can't be valid. */
+    state = UTF8_ACCEPT;
+    CU_ASSERT(0 == utf8_stream(&state, "\xe1", 1));
+    CU_ASSERT(UTF8_ACCEPT != state);
+    state = UTF8_ACCEPT;
+    CU_ASSERT(-1 == utf8_stream(&state, "\xf5", 1));
+    CU_ASSERT(UTF8_REJECT == state);
+    state = UTF8_ACCEPT;
+    CU_ASSERT(0 == utf8_stream(&state, "\xf4", 1));
+    state = UTF8_ACCEPT;
+    CU_ASSERT(-1 == utf8_stream(&state, "\xf4\xa0", 2));
+
+    /* A character finished in the next chunk. */
+    state = UTF8_ACCEPT;
+    CU_ASSERT(0 == utf8_stream(&state, "abc\xf0\x92", 5));
+    CU_ASSERT(0 == utf8_stream(&state, "\x80", 1));
+    CU_ASSERT(0 == utf8_stream(&state, "\xbaxyz", 4));
+    CU_ASSERT(UTF8_ACCEPT == state);
+    CU_ASSERT(0 == utf8_stream(&state, NULL, 0));
+    CU_ASSERT(UTF8_ACCEPT == state);
+
+    /* Or broken by it. */
+    state = UTF8_ACCEPT;
+    CU_ASSERT(0 == utf8_stream(&state, "abc\xed", 4));
+    CU_ASSERT(-1 == utf8_stream(&state, "\xa0\x80", 2));
 }
 
 void test_get_size()
@@ -114,12 +137,251 @@ void test_get_size()
 }
 
 
+/* A straightforward decoder to compare the optimized validator against. */
+static int _reference(const uint8_t *b, size_t *len)
+{
+    size_t i = 0;
+
+    while (i < *len) {
+        uint32_t c = b[i];
+        uint32_t min;
+        size_t n;
+
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if ((0xc2 <= c) && (c <= 0xdf)) {
+            n   = 2;
+            c   = c & 0x1f;
+            min = 0x80;
+        } else if ((0xe0 <= c) && (c <= 0xef)) {
+            n   = 3;
+            c   = c & 0x0f;
+            min = 0x800;
+        } else if ((0xf0 <= c) && (c <= 0xf4)) {
+            n   = 4;
+            c   = c & 0x07;
+            min = 0x10000;
+        } else {
+            return -1;
+        }
+
+        if (*len - i < n) {
+            *len = i;
+            return 0;
+        }
+
+        for (size_t k = 1; k < n; k++) {
+            if (0x80 != (0xc0 & b[i + k])) {
+                return -1;
+            }
+            c = (c << 6) | (0x3f & b[i + k]);
+        }
+
+        if ((c < min) || (0x10ffff < c) || ((0xd800 <= c) && (c <= 0xdfff))) {
+            return -1;
+        }
+        i += n;
+    }
+
+    return 0;
+}
+
+
+/* Appends a random character (usually valid) and returns its length. */
+static size_t _random_char(uint8_t *out)
+{
+    static const uint32_t ranges[][2] = {
+        {     0x20,     0x7e},
+        {     0x80,    0x7ff},
+        {    0x800,   0xd7ff},
+        {   0xe000,   0xffff},
+        {  0x10000, 0x10ffff},
+    };
+    int r = rand() % 100;
+    uint32_t c;
+
+    /* ASCII runs dominate, like JSON does. */
+    if (r < 50) {
+        size_t n = 1 + rand() % 40;
+
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (uint8_t) (0x20 + rand() % 0x5f);
+        }
+        return n;
+    }
+
+    /* Any byte at all, to break things. */
+    if (r < 53) {
+        out[0] = (uint8_t) rand();
+        return 1;
+    }
+
+    r = rand() % 5;
+    c = ranges[r][0] + (uint32_t) rand() % (ranges[r][1] - ranges[r][0] + 1);
+
+    if (c < 0x80) {
+        out[0] = (uint8_t) c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = (uint8_t) (0xc0 | (c >> 6));
+        out[1] = (uint8_t) (0x80 | (0x3f & c));
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = (uint8_t) (0xe0 | (c >> 12));
+        out[1] = (uint8_t) (0x80 | (0x3f & (c >> 6)));
+        out[2] = (uint8_t) (0x80 | (0x3f & c));
+        return 3;
+    }
+    out[0] = (uint8_t) (0xf0 | (c >> 18));
+    out[1] = (uint8_t) (0x80 | (0x3f & (c >> 12)));
+    out[2] = (uint8_t) (0x80 | (0x3f & (c >> 6)));
+    out[3] = (uint8_t) (0x80 | (0x3f & c));
+    return 4;
+}
+
+
+static void _against_reference(void)
+{
+    uint8_t buf[400];
+
+    srand(42);
+
+    for (int loop = 0; loop < 20000; loop++) {
+        size_t want = (size_t) (rand() % 300);
+        size_t len  = 0;
+
+        while (len < want) {
+            len += _random_char(&buf[len]);
+        }
+
+        /* Every ending, so partial characters land at every offset. */
+        for (size_t cut = 0; (cut < 4) && (cut <= len); cut++) {
+            size_t a = len - cut;
+            size_t b = len - cut;
+            int rv_a = utf8_validate((const char *) buf, &a);
+            int rv_b = _reference(buf, &b);
+
+            CU_ASSERT(rv_a == rv_b);
+            if (0 == rv_b) {
+                CU_ASSERT(a == b);
+            }
+        }
+    }
+}
+
+
+void test_against_reference()
+{
+    /* Each kernel the CPU can run, then the one normally picked. */
+    __kernel = (kernel_fn) _validate_none;
+    _against_reference();
+#if UTF8_X86
+    if (__builtin_cpu_supports("sse4.1")) {
+        __kernel = (kernel_fn) _validate_sse41;
+        _against_reference();
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        __kernel = (kernel_fn) _validate_avx2;
+        _against_reference();
+    }
+#endif
+    __kernel = _validate_select();
+    _against_reference();
+}
+
+
+void test_stream_against_reference()
+{
+    uint8_t buf[400];
+
+    srand(7);
+
+    for (int loop = 0; loop < 20000; loop++) {
+        size_t want   = (size_t) (rand() % 300);
+        size_t len    = 0;
+        size_t valid  = 0;
+        uint8_t state = UTF8_ACCEPT;
+        int rv_ref, rv = 0;
+
+        while (len < want) {
+            len += _random_char(&buf[len]);
+        }
+
+        /* Feed the text in random chunks. */
+        for (size_t at = 0; (0 == rv) && (at < len);) {
+            size_t n = (size_t) (rand() % 20);
+
+            if (len - at < n) {
+                n = len - at;
+            }
+
+            rv = utf8_stream(&state, (const char *) &buf[at], n);
+            at += n;
+        }
+
+        valid  = len;
+        rv_ref = _reference(buf, &valid);
+        if (0 != rv_ref) {
+            CU_ASSERT(-1 == rv);
+        } else if (valid == len) {
+            CU_ASSERT(0 == rv);
+            CU_ASSERT(UTF8_ACCEPT == state);
+        } else {
+            /* A partial character at the end may already be known to be
+             * invalid, but it is never accepted. */
+            CU_ASSERT(UTF8_ACCEPT != state);
+        }
+    }
+}
+
+
+void test_long_ascii()
+{
+    uint8_t buf[256];
+
+    memset(buf, 'a', sizeof(buf));
+
+    /* A bad byte anywhere in a long ASCII run is found. */
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        size_t len = sizeof(buf);
+
+        buf[i] = 0xff;
+        CU_ASSERT(-1 == utf8_validate((const char *) buf, &len));
+        buf[i] = 'a';
+    }
+
+    /* So is a lead byte cut short by ASCII, unless it could still be
+     * completed by more data. */
+    for (size_t i = 0; i < sizeof(buf) - 2; i++) {
+        size_t len = sizeof(buf);
+
+        buf[i] = 0xe2;
+        CU_ASSERT(-1 == utf8_validate((const char *) buf, &len));
+        buf[i] = 'a';
+    }
+
+    /* But not a lead byte at the very end. */
+    do {
+        size_t len = sizeof(buf);
+
+        buf[sizeof(buf) - 1] = 0xe2;
+        CU_ASSERT(0 == utf8_validate((const char *) buf, &len));
+        CU_ASSERT(sizeof(buf) - 1 == len);
+        buf[sizeof(buf) - 1] = 'a';
+    } while (0);
+}
+
+
 void add_suites(CU_pSuite *suite)
 {
     *suite = CU_add_suite("utf8 tests", NULL, NULL);
     CU_add_test(*suite, "general utf8() Tests", test_utf8);
-    CU_add_test(*suite, "utf8_maybe_valid() Tests", test_maybe_valid);
+    CU_add_test(*suite, "utf8_stream() Tests", test_stream);
     CU_add_test(*suite, "utf8_get_size() Tests", test_get_size);
+    CU_add_test(*suite, "utf8_validate() vs reference Tests", test_against_reference);
+    CU_add_test(*suite, "utf8_stream() vs reference Tests", test_stream_against_reference);
+    CU_add_test(*suite, "long ASCII Tests", test_long_ascii);
 }
 
 
@@ -153,6 +153,17 @@ void test_cws_rewrite_url()
 }
 
 
+void test_cws_now_usec()
+{
+    uint64_t a, b;
+
+    a = cws_now_usec();
+    b = cws_now_usec();
+    CU_ASSERT(0 != a);
+    CU_ASSERT(a <= b);
+}
+
+
 void add_suites(CU_pSuite *suite)
 {
     *suite = CU_add_suite("utils.c tests", NULL, NULL);
@@ -162,6 +173,7 @@ void add_suites(CU_pSuite *suite)
     CU_add_test(*suite, "cws_strncasecmp() Tests", test_cws_strncasecmp);
     CU_add_test(*suite, "cws_trim() Tests", test_cws_trim);
     CU_add_test(*suite, "cws_has_prefix() Tests", test_cws_has_prefix);
+    CU_add_test(*suite, "cws_now_usec() Tests", test_cws_now_usec);
 }
 
 